@@ -0,0 +1,176 @@
+#include "scenes.h"
+#include "util/parallel.h"
+#include "util/rgb2spec.h"
+#include <sys/resource.h>
+#include <fstream>
+#include <sstream>
+#include <map>
+
+// 固定分辨率、spp 和随机种子逐个渲染场景，把耗时等指标输出成 JSON。
+// 用法: benchmark [--scene name|file.rtw]... [--width 200] [--spp 16] [--depth 20] [--seed 1]
+//                 [--out result.json] [--compare baseline.json] [--threshold 0.05] [--cache dir]
+// --compare 时和基线逐场景比较 wall_ms，任何一个场景变慢超过 threshold 就返回 1。
+struct bench_result{
+    std::string name;
+    double wall_ms = 0;
+    double bvh_ms = 0;
+    double load_ms = 0;
+    bool cached = false;
+    uint64_t rays = 0;
+    double mrays_per_s = 0;
+    long peak_rss_kb = 0;
+};
+
+// 进程的峰值常驻内存，只增不减
+static long peak_rss_kb(){
+    rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+#ifdef __APPLE__
+    return usage.ru_maxrss / 1024;   // macOS 上单位是字节
+#else
+    return usage.ru_maxrss;
+#endif
+}
+
+static std::optional<bench_result> run_scene(const std::string& name, int width, int spp, int depth, unsigned seed,
+                                             const std::string& cache_dir){
+    // 场景内容也用 random_double 生成，先固定种子
+    seed_random(seed);
+    auto t1 = std::chrono::steady_clock::now();
+    std::optional<scene> loaded = make_scene(name, cache_dir, seed);
+    if(!loaded) return std::nullopt;
+    scene& s = *loaded;
+    s.cam.image_width = width;
+    s.cam.samples_per_pixel = spp;
+    s.cam.max_depth = depth;
+    s.cam.seed = seed;
+    s.cam.image_out = nullptr;
+    s.cam.verbose = false;
+    s.render();
+    auto t2 = std::chrono::steady_clock::now();
+
+    bench_result r;
+    r.name = s.name;
+    r.wall_ms = std::chrono::duration<double, std::milli>(t2 - t1).count();
+    r.bvh_ms = s.bvh_build_ms;
+    r.load_ms = s.load_ms;
+    r.cached = s.from_cache;
+    r.rays = s.cam.ray_count();
+    r.mrays_per_s = r.rays / (s.cam.render_time_ms() * 1000.0);
+    r.peak_rss_kb = peak_rss_kb();
+    return r;
+}
+
+static void write_json(std::ostream& out, const std::vector<bench_result>& results,
+                       int width, int spp, int depth, unsigned seed){
+    // 每个场景占一行，方便 --compare 逐行读回
+    out << "{\n";
+    out << "  \"config\": {\"width\": " << width << ", \"spp\": " << spp << ", \"depth\": " << depth
+        << ", \"seed\": " << seed << ", \"threads\": " << RunningThreads() << "},\n";
+    out << "  \"scenes\": [\n";
+    for(size_t i = 0; i < results.size(); i++){
+        const bench_result& r = results[i];
+        out << "    {\"name\": \"" << r.name << "\", \"wall_ms\": " << r.wall_ms
+            << ", \"bvh_ms\": " << r.bvh_ms << ", \"load_ms\": " << r.load_ms
+            << ", \"cached\": " << (r.cached ? "true" : "false") << ", \"rays\": " << r.rays
+            << ", \"mrays_per_s\": " << r.mrays_per_s << ", \"peak_rss_kb\": " << r.peak_rss_kb << "}"
+            << (i + 1 < results.size() ? "," : "") << "\n";
+    }
+    out << "  ]\n}\n";
+}
+
+static bool json_field(const std::string& line, const std::string& key, std::string& value){
+    size_t pos = line.find("\"" + key + "\"");
+    if(pos == std::string::npos) return false;
+    pos = line.find(':', pos);
+    if(pos == std::string::npos) return false;
+    pos = line.find_first_not_of(" \"", pos + 1);
+    size_t end = line.find_first_of(",\"}", pos);
+    value = line.substr(pos, end - pos);
+    return true;
+}
+
+// 读回 write_json 写出的文件：场景名 -> wall_ms
+static bool read_baseline(const std::string& filename, std::map<std::string, double>& baseline){
+    std::ifstream in(filename);
+    if(!in) return false;
+    std::string line;
+    while(std::getline(in, line)){
+        std::string name, wall;
+        if(json_field(line, "name", name) && json_field(line, "wall_ms", wall)){
+            baseline[name] = std::stod(wall);
+        }
+    }
+    return true;
+}
+
+int main(int argc, char** argv){
+    std::vector<std::string> names;
+    int width = 200, spp = 16, depth = 20;
+    unsigned seed = 1;
+    double threshold = 0.05;
+    std::string out_file, compare_file, cache_dir;
+    for(int i = 1; i < argc; i++){
+        std::string arg = argv[i];
+        if(i + 1 >= argc){
+            std::cerr << "missing value for " << arg << "\n";
+            return 2;
+        }
+        std::string value = argv[++i];
+        if(arg == "--scene") names.push_back(value);
+        else if(arg == "--width") width = std::stoi(value);
+        else if(arg == "--spp") spp = std::stoi(value);
+        else if(arg == "--depth") depth = std::stoi(value);
+        else if(arg == "--seed") seed = unsigned(std::stoul(value));
+        else if(arg == "--out") out_file = value;
+        else if(arg == "--compare") compare_file = value;
+        else if(arg == "--threshold") threshold = std::stod(value);
+        else if(arg == "--cache") cache_dir = value;
+        else{
+            std::cerr << "unknown option " << arg << "\n";
+            return 2;
+        }
+    }
+    if(!cache_dir.empty()){
+        RGBToSpectrumTableFile::SetCacheDirectory(cache_dir);
+        mipmap::set_cache_directory(cache_dir);
+    }
+    if(names.empty()){
+        for(const scene_entry& e : scene_registry()) names.push_back(e.name);
+    }
+
+    std::vector<bench_result> results;
+    for(const std::string& name : names){
+        std::optional<bench_result> r = run_scene(name, width, spp, depth, seed, cache_dir);
+        if(!r) return 2;
+        results.push_back(*r);
+        std::cerr << name << ": " << r->wall_ms << "ms\n";
+    }
+
+    write_json(std::cout, results, width, spp, depth, seed);
+    if(!out_file.empty()){
+        std::ofstream out(out_file);
+        write_json(out, results, width, spp, depth, seed);
+    }
+
+    if(compare_file.empty()) return 0;
+    std::map<std::string, double> baseline;
+    if(!read_baseline(compare_file, baseline)){
+        std::cerr << "cannot read baseline '" << compare_file << "'\n";
+        return 2;
+    }
+    bool regressed = false;
+    for(const bench_result& r : results){
+        auto it = baseline.find(r.name);
+        if(it == baseline.end()){
+            std::cerr << r.name << ": not in baseline\n";
+            continue;
+        }
+        double change = r.wall_ms / it->second - 1.0;
+        bool slow = change > threshold;
+        regressed |= slow;
+        std::cerr << r.name << ": " << it->second << "ms -> " << r.wall_ms << "ms ("
+                  << (change >= 0 ? "+" : "") << change * 100 << "%)" << (slow ? " REGRESSION" : "") << "\n";
+    }
+    return regressed ? 1 : 0;
+}
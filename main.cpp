@@ -1,350 +1,399 @@
-#include "util/rtweekend.h"
-#include "util/sphere.h"
-#include "util/camera.h"
-#include "util/hittable.h"
-#include "util/hittable_list.h"
-#include "util/bvh.h"
-#include "util/texture.h"
-#include "util/quad.h"
-#include "util/constant_medium.h"
+#include "scenes.h"
+#include "util/rgb2spec.h"
+#ifndef _WIN32
+#include "util/distributed.h"
+#endif
+#include <filesystem>
+#include <fstream>
 #include <iomanip>
-void bouncing_spheres(){
-    hittable_list world;
-    shared_ptr<check_texture> check = make_shared<check_texture>(0.32,color(.2,.3,.1),color(0.9,0.9,0.9));
-    auto material_ground = make_shared<lambertian>(check);
-    world.add(make_shared<sphere>(Point3(0,-1000,0),1000,material_ground));
-
-    for(int a =-11;a<11;a++){
-        for(int b=-11;b<11;b++){
-            double choose_mat = random_double();
-            Point3 center(a+0.9*random_double(),0.2,b+0.9*random_double());
-            if((center - Point3(4,0.2,0)).length() > 0.9){
-                shared_ptr<material> sphere_material;
-                if(choose_mat < 0.8){
-                    //diffuse
-                    color albedo = color::random() * color::random();
-                    sphere_material = make_shared<lambertian>(albedo);
-                    Point3 center2 = center+vec3(0,random_double(0,0.5),0);
-                    world.add(make_shared<sphere>(center,center2,0.2,sphere_material));
-                }
-                else if(choose_mat < 0.95){
-                    //metal
-                    color albedo = color::random(0.5,1);
-                    double fuzz = random_double(0,0.5);
-                    sphere_material =make_shared<metal>(albedo,fuzz);
-                    world.add(make_shared<sphere>(center,0.2,sphere_material));
+#include <map>
+
+// 用法: main [场景名|file.rtw]... [--width N] [--spp N] [--depth N] [--threads N] [--seed N]
+//            [--format ppm|ppm-binary|pfm] [--stream-rows N] [--spectral] [--trace tiles.json]
+//            [--sampler independent|stratified|halton|sobol|blue-noise]
+//            [--checkpoint file] [--checkpoint-every SECONDS] [--resume]
+//            [-o out.ppm] [--out-dir dir] [--cache dir] [--jobs jobs.txt]
+//            [--reserve-cores N] [--pin-threads] [--serial]
+//            [--listen PORT] [--spawn N] [--worker-threads N] [--tile N]
+//      main --worker HOST:PORT [--threads N] [--cache dir]
+// 默认渲染 cornell_box。只有一个场景且没有 -o 时图像写到 stdout；
+// 多个场景时每个场景写到 out-dir（默认当前目录）下的 <场景名>.<扩展名>，某个场景失败不影响其余场景。
+// 没有 --format 时按 -o 的扩展名选格式（.pfm 为浮点 HDR，其余为 ppm）。
+// --cache 时构建好的场景（含 BVH）缓存在该目录下，下次直接映射读回；--spectral 现场拟合的系数表和纹理的 .rtwtex 金字塔也写在这里。
+// --seed 在构建和渲染每个场景之前重置随机数种子，同样的参数得到同样的场景。
+// --reserve-cores 留出 N 个核心不用，--pin-threads 把工作线程绑定到核心上，--serial 只用主线程渲染（用于 profile），
+// 这三个选项对整个进程生效，不能写在任务文件里。
+//
+// 分布式渲染：--listen 在 PORT 上等 worker 连接（0 为随机端口），每帧切成 --tile 见方（默认 64）的 tile 分给 worker，
+// 本进程只负责分发和拼图；--spawn N 在本机启动 N 个 worker 进程（每个 --worker-threads 个线程），可以不写 --listen，
+// 这时只监听 127.0.0.1。
+// 其它机器上用 main --worker HOST:PORT 加入。worker 按请求构建场景，同一个场景只构建一次。只支持 POSIX 系统。
+// 分布式渲染时不能用 --stream-rows、--trace、--checkpoint 和 --resume。
+//
+// --jobs 文件每行是一个任务，写法与命令行相同（# 之后是注释），没写的选项沿用命令行上的值
+// （开关用 --no-spectral、--no-resume 关掉），例如
+//     final_scene --width 800 --spp 1000 -o final.pfm
+//     cornell_box --spp 64 --seed 7 -o cornell.ppm
+// 所有任务在同一个进程里依次渲染，共用线程池和纹理缓存；同一个场景（和种子）只构建一次。
+// 写到文件的图像在线程池上异步编码和写出，与下一个任务的渲染重叠。
+// --sampler 选择像素、镜头和路径上各维随机数的采样器，默认 sobol；独立随机采样的误差最大，只用于对比。
+// --stream-rows N 时每渲染完 N 行就写出，不保留整幅图像，用于超大分辨率。
+// --checkpoint 时每隔 --checkpoint-every 秒（默认 600）把累加进度写到该文件，被中断后加 --resume 接着渲染，
+// 结果与一次渲完逐位一致。检查点记着场景和视角，不是同一个场景时不会接着渲。
+// 多个场景或 --jobs 时文件名后面加 .<任务序号>.<场景名>，每个任务的每个场景各用一个文件。
+struct render_options{
+    int width = 0, spp = 0, depth = 0, threads = 0, stream_rows = 0;
+    std::optional<unsigned> seed;
+    std::optional<image_format> format;
+    std::optional<sampler_type> sampler;
+    bool spectral = false, resume = false;
+    double checkpoint_seconds = 600;
+    std::string trace_file, out_file, out_dir, checkpoint_file;
+};
+
+struct farm_options{
+    std::optional<int> listen_port;
+    int spawn = 0, worker_threads = 0, tile = 64;
+    std::string worker;   // HOST:PORT，非空时本进程是 worker
+};
+
+struct render_job{
+    std::vector<std::string> names;
+    render_options options;
+};
+
+// 解析一组参数，选项写进 options，场景名追加到 names；出错时返回 false
+static bool parse_args(const std::vector<std::string>& args, render_options& options, std::vector<std::string>& names,
+                       std::string* cache_dir, std::string* jobs_file, ParallelOptions* parallel, farm_options* farm){
+    try{
+        for(size_t i = 0; i < args.size(); i++){
+            const std::string& arg = args[i];
+            bool has_value = i + 1 < args.size();
+            if(arg == "--spectral") options.spectral = true;
+            else if(arg == "--no-spectral") options.spectral = false;
+            else if(arg == "--trace" && has_value) options.trace_file = args[++i];
+            else if(arg == "--width" && has_value) options.width = std::stoi(args[++i]);
+            else if(arg == "--spp" && has_value) options.spp = std::stoi(args[++i]);
+            else if(arg == "--depth" && has_value) options.depth = std::stoi(args[++i]);
+            else if(arg == "--threads" && has_value) options.threads = std::stoi(args[++i]);
+            else if(arg == "--stream-rows" && has_value) options.stream_rows = std::stoi(args[++i]);
+            else if(arg == "--seed" && has_value) options.seed = unsigned(std::stoul(args[++i]));
+            else if(arg == "--format" && has_value){
+                options.format = parse_image_format(args[++i]);
+                if(!options.format){
+                    std::cerr << "unknown format " << args[i] << " (ppm, ppm-binary, pfm)\n";
+                    return false;
                 }
-                else{
-                    //glass
-                    sphere_material = make_shared<dielectric>(1.5);
-                    world.add(make_shared<sphere>(center,0.2,sphere_material));
+            }
+            else if(arg == "--checkpoint" && has_value) options.checkpoint_file = args[++i];
+            else if(arg == "--checkpoint-every" && has_value) options.checkpoint_seconds = std::stod(args[++i]);
+            else if(arg == "--resume") options.resume = true;
+            else if(arg == "--no-resume") options.resume = false;
+            else if(arg == "--sampler" && has_value){
+                options.sampler = parse_sampler_type(args[++i]);
+                if(!options.sampler){
+                    std::cerr << "unknown sampler " << args[i] << " (independent, stratified, halton, sobol, blue-noise)\n";
+                    return false;
                 }
             }
+            else if(arg == "-o" && has_value) options.out_file = args[++i];
+            else if(arg == "--out-dir" && has_value) options.out_dir = args[++i];
+            else if(arg == "--cache" && has_value && cache_dir) *cache_dir = args[++i];
+            else if(arg == "--jobs" && has_value && jobs_file) *jobs_file = args[++i];
+            else if(arg == "--reserve-cores" && has_value && parallel) parallel->reservedCores = std::stoi(args[++i]);
+            else if(arg == "--pin-threads" && parallel) parallel->pinThreads = true;
+            else if(arg == "--serial" && parallel) parallel->disabled = true;
+            else if(arg == "--listen" && has_value && farm) farm->listen_port = std::stoi(args[++i]);
+            else if(arg == "--spawn" && has_value && farm) farm->spawn = std::stoi(args[++i]);
+            else if(arg == "--worker-threads" && has_value && farm) farm->worker_threads = std::stoi(args[++i]);
+            else if(arg == "--tile" && has_value && farm) farm->tile = std::stoi(args[++i]);
+            else if(arg == "--worker" && has_value && farm) farm->worker = args[++i];
+            else if(arg.starts_with("-")){
+                std::cerr << "unknown option " << arg << "\n";
+                return false;
+            }
+            else names.push_back(arg);
         }
     }
-    
-    auto material1 = make_shared<dielectric>(1.50);
-    world.add(make_shared<sphere>(Point3(0,1,0),1.0,material1));
-    auto material2 = make_shared<lambertian>(color(0.4,0.2,0.1));
-    world.add(make_shared<sphere>(Point3(-4,1,0),1.0,material2));
-    auto material3 = make_shared<metal>(color(0.7,0.6,0.5),0.0);
-    world.add(make_shared<sphere>(Point3(4,1,0),1.0,material3));
-
-    // double R = std::cos(pi/4);
-    // auto material_left = make_shared<lambertian>(color(0,0,1));
-    // auto material_right=make_shared<lambertian>(color(1,0,0));
-    // world.add(make_shared<sphere>(Point3(-R , 0 , -1), R, material_left));
-    // world.add(make_shared<sphere>(Point3(R,0,-1),R,material_right));
-    bvh_node bvh_root(world.objects,0,world.objects.size()-1);
-    camera  cam;
-    cam.background        = color(0.70, 0.80, 1.00);
-    cam.aspect_ratio=16.0/9.0;
-    cam.image_width = 1200;
-    cam.samples_per_pixel=100;
-    cam.max_depth=50;
-    cam.vfov = 20;
-    cam.lookfrom = Point3(13,2,3);
-    cam.lookat = Point3(0,0,0);
-    cam.vup = vec3(0,1,0);
-    cam.defocus_angle = 0.6;
-    cam.focus_dist=10.0;
-    //cam.render(bvh_root);
-    
-}
-void checkered_sphere(){
-    hittable_list world;
-    auto checker = make_shared<check_texture>(0.32,color(.2,.3,.1),color(.9,.9,.9));
-    world.add(make_shared<sphere>(Point3(0,-10,0),10,make_shared<lambertian>(checker)));
-    world.add(make_shared<sphere>(Point3(0,10,0),10,make_shared<lambertian>(checker)));
-    camera cam;
-    cam.background        = color(0.70, 0.80, 1.00);
-    cam.aspect_ratio = 16.0 / 9.0;
-    cam.image_width = 400;
-    cam.samples_per_pixel = 100;
-    cam.max_depth = 50;
-    cam.vfov = 20;
-    cam.lookfrom = Point3(13,2,3);
-    cam.lookat = Point3(0,0,0);
-    cam.vup = vec3(0,1,0);
-    cam.defocus_angle = 0;
-    //cam.render(world);
-}
-void earth(){
-    hittable_list world;
-    shared_ptr<image_texture> earth_texture = make_shared<image_texture>("../images/earthmap.jpg");
-    shared_ptr<lambertian> earth_surface = make_shared<lambertian>(earth_texture);
-    shared_ptr<sphere> globe = make_shared<sphere>(Point3(0,0,0),2,earth_surface);
-    world.add(globe);
-    camera cam;
-    cam.background        = color(0.70, 0.80, 1.00);
-    cam.aspect_ratio = 16.0 / 9.0;
-    cam.image_width = 400;
-    cam.samples_per_pixel = 100;
-    cam.max_depth = 50;
-    cam.vfov = 20;
-    cam.lookfrom = Point3(0,0,12);
-    cam.lookat = Point3(0,0,0);
-    cam.vup = vec3(0,1,0);
-    cam.defocus_angle = 0;
-    //cam.render(world);
-}
-void perlin_spheres(){
-    hittable_list world;
-    shared_ptr<noise_texture> pertex = make_shared<noise_texture>(4);
-    world.add(make_shared<sphere>(Point3(0,-1000,0),1000,make_shared<lambertian>(pertex)));
-    world.add(make_shared<sphere>(Point3(0,2,0),2,make_shared<lambertian>(pertex)));
-    camera cam;
-    cam.background        = color(0.70, 0.80, 1.00);
-    cam.aspect_ratio      = 16.0 / 9.0;
-    cam.image_width       = 400;
-    cam.samples_per_pixel = 100;
-    cam.max_depth         = 50;
-
-    cam.vfov     = 20;
-    cam.lookfrom = Point3(13,2,3);
-    cam.lookat   = Point3(0,0,0);
-    cam.vup      = vec3(0,1,0);
-
-    cam.defocus_angle = 0;
-
-    //cam.render(world);
-}
-void quads(){
-    hittable_list world;
-
-    // Materials
-    auto left_red     = make_shared<lambertian>(color(1.0, 0.2, 0.2));
-    auto back_green   = make_shared<lambertian>(color(0.2, 1.0, 0.2));
-    auto right_blue   = make_shared<lambertian>(color(0.2, 0.2, 1.0));
-    auto upper_orange = make_shared<lambertian>(color(1.0, 0.5, 0.0));
-    auto lower_teal   = make_shared<lambertian>(color(0.2, 0.8, 0.8));
-
-    // Quads
-    world.add(make_shared<quad>(Point3(-3,-2, 5), vec3(0, 0,-4), vec3(0, 4, 0), left_red));
-    world.add(make_shared<quad>(Point3(-2,-2, 0), vec3(4, 0, 0), vec3(0, 4, 0), back_green));
-    world.add(make_shared<quad>(Point3( 3,-2, 1), vec3(0, 0, 4), vec3(0, 4, 0), right_blue));
-    world.add(make_shared<quad>(Point3(-2, 3, 1), vec3(4, 0, 0), vec3(0, 0, 4), upper_orange));
-    world.add(make_shared<quad>(Point3(-2,-3, 5), vec3(4, 0, 0), vec3(0, 0,-4), lower_teal));
-    camera cam;
-    cam.background        = color(0.70, 0.80, 1.00);
-    cam.aspect_ratio      = 1.0;
-    cam.image_width       = 400;
-    cam.samples_per_pixel = 100;
-    cam.max_depth         = 50;
-
-    cam.vfov     = 80;
-    cam.lookfrom = Point3(0,0,9);
-    cam.lookat   = Point3(0,0,0);
-    cam.vup      = vec3(0,1,0);
-    cam.defocus_angle = 0;
-    //cam.render(world);
-}
-void simple_light(){
-    hittable_list world;
-    auto pertex = make_shared<noise_texture>(4);
-    world.add(make_shared<sphere>(Point3(0,-1000,0),1000,make_shared<lambertian>(pertex)));
-    world.add(make_shared<sphere>(Point3(0,2,0),2,make_shared<lambertian>(pertex)));
-
-    auto difflight = make_shared<diffuse_light>(color(4,4,4));
-    world.add(make_shared<quad>(Point3(3,1,-2),vec3(2,0,0),vec3(0,2,0),difflight));
-    world.add(make_shared<sphere>(Point3(0,7,0),2,difflight));
-    camera cam;
-    cam.aspect_ratio = 16.0 / 9.0;
-    cam.image_width = 400;
-    cam.samples_per_pixel = 100;
-    cam.max_depth = 50;
-    cam.background = color(0,0,0);
-    cam.vfov = 20;
-    cam.lookfrom = Point3(26,3,6);
-    cam.lookat = Point3(0,2,0);
-    cam.vup = vec3(0,1,0);
-    cam.defocus_angle = 0;
-    //cam.render(world);
-}
-void cornell_box(){
-    hittable_list world;
-    auto red   = make_shared<lambertian>(color(.65, .05, .05));
-    auto white = make_shared<lambertian>(color(.73, .73, .73));
-    auto green = make_shared<lambertian>(color(.12, .45, .15));
-    auto light = make_shared<diffuse_light>(color(15, 15, 15));
-    world.add(make_shared<quad>(Point3(555,0,0),vec3(0,555,0),vec3(0,0,555),green));
-    world.add(make_shared<quad>(Point3(0,0,0),vec3(0,555,0),vec3(0,0,555),red));
-    world.add(make_shared<quad>(Point3(343,554,332),vec3(-130,0,0),vec3(0,0,-105),light));
-    world.add(make_shared<quad>(Point3(0,0,0),vec3(555,0,0),vec3(0,0,555),white));
-    world.add(make_shared<quad>(Point3(555,555,555),vec3(-555,0,0),vec3(0,0,-555),white));
-    world.add(make_shared<quad>(Point3(0,0,555),vec3(555,0,0),vec3(0,555,0),white));
-    
-    auto empty_material = make_shared<material>();
-    quad lights(Point3(343, 554, 332), vec3(-130, 0, 0), vec3(0, 0, -105), empty_material);
-
-    shared_ptr<hittable> box1 = box(Point3(0,0,0), Point3(165,330,165), white);
-    box1 = make_shared<rotate_y>(box1, 15);
-    box1 = make_shared<translate>(box1, vec3(265,0,295));
-    world.add(box1);
-
-    shared_ptr<hittable> box2 = box(Point3(0,0,0), Point3(165,165,165), white);
-    box2 = make_shared<rotate_y>(box2, -18);
-    box2 = make_shared<translate>(box2, vec3(130,0,65));
-    world.add(box2);
-    bvh_node bvh_root(world.objects,0,world.objects.size()-1);
-    camera cam;
-
-    cam.aspect_ratio      = 1.0;
-    cam.image_width       = 800;
-    cam.samples_per_pixel = 100;
-    cam.max_depth         = 50;
-    cam.background        = color(0,0,0);
-
-    cam.vfov     = 40;
-    cam.lookfrom = Point3(278, 278, -800);
-    cam.lookat   = Point3(278, 278, 0);
-    cam.vup      = vec3(0,1,0);
-
-    cam.defocus_angle = 0;
-
-    cam.render(bvh_root, lights);
+    catch(const std::exception&){
+        std::cerr << "bad number in arguments\n";
+        return false;
+    }
+    return true;
 }
-void cornell_smoke(){
-    hittable_list world;
-    auto red   = make_shared<lambertian>(color(.65, .05, .05));
-    auto white = make_shared<lambertian>(color(.73, .73, .73));
-    auto green = make_shared<lambertian>(color(.12, .45, .15));
-    auto light = make_shared<diffuse_light>(color(7, 7, 7));
-    world.add(make_shared<quad>(Point3(555,0,0), vec3(0,555,0), vec3(0,0,555), green));
-    world.add(make_shared<quad>(Point3(0,0,0), vec3(0,555,0), vec3(0,0,555), red));
-    world.add(make_shared<quad>(Point3(113,554,127), vec3(330,0,0), vec3(0,0,305), light));
-    world.add(make_shared<quad>(Point3(0,555,0), vec3(555,0,0), vec3(0,0,555), white));
-    world.add(make_shared<quad>(Point3(0,0,0), vec3(555,0,0), vec3(0,0,555), white));
-    world.add(make_shared<quad>(Point3(0,0,555), vec3(555,0,0), vec3(0,555,0), white));
-
-    shared_ptr<hittable> box1 = box(Point3(0,0,0), Point3(165,330,165), white);
-    box1 = make_shared<rotate_y>(box1, 15);
-    box1 = make_shared<translate>(box1, vec3(265,0,295));
-
-    shared_ptr<hittable> box2 = box(Point3(0,0,0), Point3(165,165,165), white);
-    box2 = make_shared<rotate_y>(box2, -18);
-    box2 = make_shared<translate>(box2, vec3(130,0,65));
-
-    world.add(make_shared<constant_medium>(box1, 0.01, color(0,0,0)));
-    world.add(make_shared<constant_medium>(box2, 0.01, color(1,1,1)));
-    bvh_node bvh_root(world.objects,0,world.objects.size()-1);
-    camera cam;
-
-    cam.aspect_ratio      = 1.0;
-    cam.image_width       = 600;
-    cam.samples_per_pixel = 200;
-    cam.max_depth         = 50;
-    cam.background        = color(0,0,0);
-
-    cam.vfov     = 40;
-    cam.lookfrom = Point3(278, 278, -800);
-    cam.lookat   = Point3(278, 278, 0);
-    cam.vup      = vec3(0,1,0);
 
-    cam.defocus_angle = 0;
-
-    //cam.render(bvh_root);
+static bool read_jobs(const std::string& filename, const render_options& defaults, std::vector<render_job>& jobs){
+    std::ifstream in(filename);
+    if(!in){
+        std::cerr << "cannot open jobs file '" << filename << "'\n";
+        return false;
+    }
+    std::string line;
+    for(int line_no = 1; std::getline(in, line); line_no++){
+        if(size_t hash = line.find('#'); hash != std::string::npos) line.erase(hash);
+        std::istringstream tokens(line);
+        std::vector<std::string> args;
+        for(std::string token; tokens >> token;) args.push_back(token);
+        if(args.empty()) continue;
+        render_job job{{}, defaults};
+        if(!parse_args(args, job.options, job.names, nullptr, nullptr, nullptr, nullptr)){
+            std::cerr << filename << ":" << line_no << ": invalid job\n";
+            return false;
+        }
+        if(job.names.empty()) job.names.push_back("cornell_box");
+        if(job.names.size() > 1 && !job.options.out_file.empty()){
+            std::cerr << filename << ":" << line_no << ": -o only works with a single scene\n";
+            return false;
+        }
+        jobs.push_back(std::move(job));
+    }
+    return true;
 }
-void final_scene(int image_width, int samples_per_pixel, int max_depth) {
-    hittable_list boxes1;
-    auto ground = make_shared<lambertian>(color(0.48, 0.83, 0.53));
 
-    int boxes_per_side = 20;
-    for (int i = 0; i < boxes_per_side; i++) {
-        for (int j = 0; j < boxes_per_side; j++) {
-            auto w = 100.0;
-            auto x0 = -1000.0 + i*w;
-            auto z0 = -1000.0 + j*w;
-            auto y0 = 0.0;
-            auto x1 = x0 + w;
-            auto y1 = random_double(1,101);
-            auto z1 = z0 + w;
-
-            boxes1.add(box(Point3(x0,y0,z0), Point3(x1,y1,z1), ground));
+int main(int argc, char** argv){
+    render_options options;
+    std::vector<std::string> names;
+    std::string cache_dir, jobs_file;
+    ParallelOptions parallel;
+    farm_options farm;
+    if(!parse_args(std::vector<std::string>(argv + 1, argv + argc), options, names, &cache_dir, &jobs_file, &parallel, &farm)) return 2;
+#ifdef _WIN32
+    if(farm.listen_port || farm.spawn > 0 || !farm.worker.empty()){
+        std::cerr << "--listen, --spawn and --worker are not supported on Windows\n";
+        return 2;
+    }
+#endif
+    if(!cache_dir.empty()){
+        RGBToSpectrumTableFile::SetCacheDirectory(cache_dir);
+        mipmap::set_cache_directory(cache_dir);
+    }
+    parallel.nThreads = options.threads;
+
+    std::vector<render_job> jobs;
+    bool batch;
+    if(!jobs_file.empty()){
+        if(!names.empty()){
+            std::cerr << "scene names and --jobs cannot be combined\n";
+            return 2;
         }
+        if(!read_jobs(jobs_file, options, jobs)) return 2;
+        batch = true;   // 任务模式下不往 stdout 写图像
     }
-
-    hittable_list world;
-
-    world.add(make_shared<bvh_node>(boxes1));
-
-    auto light = make_shared<diffuse_light>(color(7, 7, 7));
-    world.add(make_shared<quad>(Point3(123,554,147), vec3(300,0,0), vec3(0,0,265), light));
-
-    auto center1 = Point3(400, 400, 200);
-    auto center2 = center1 + vec3(30,0,0);
-    auto sphere_material = make_shared<lambertian>(color(0.7, 0.3, 0.1));
-    world.add(make_shared<sphere>(center1, center2, 50, sphere_material));
-
-    world.add(make_shared<sphere>(Point3(260, 150, 45), 50, make_shared<dielectric>(1.5)));
-    world.add(make_shared<sphere>(
-        Point3(0, 150, 145), 50, make_shared<metal>(color(0.8, 0.8, 0.9), 1.0)
-    ));
-
-    auto boundary = make_shared<sphere>(Point3(360,150,145), 70, make_shared<dielectric>(1.5));
-    world.add(boundary);
-    world.add(make_shared<constant_medium>(boundary, 0.2, color(0.2, 0.4, 0.9)));
-    boundary = make_shared<sphere>(Point3(0,0,0), 5000, make_shared<dielectric>(1.5));
-    world.add(make_shared<constant_medium>(boundary, .0001, color(1,1,1)));
-
-    auto emat = make_shared<lambertian>(make_shared<image_texture>("earthmap.jpg"));
-    world.add(make_shared<sphere>(Point3(400,200,400), 100, emat));
-    auto pertext = make_shared<noise_texture>(0.2);
-    world.add(make_shared<sphere>(Point3(220,280,300), 80, make_shared<lambertian>(pertext)));
-
-    hittable_list boxes2;
-    auto white = make_shared<lambertian>(color(.73, .73, .73));
-    int ns = 1000;
-    for (int j = 0; j < ns; j++) {
-        boxes2.add(make_shared<sphere>(Point3::random(0,165), 10, white));
+    else{
+        if(names.empty()) names.push_back("cornell_box");
+        if(names.size() > 1 && !options.out_file.empty()){
+            std::cerr << "-o only works with a single scene, use --out-dir\n";
+            return 2;
+        }
+        batch = names.size() > 1 || !options.out_dir.empty();
+        jobs.push_back({names, options});
     }
 
-    world.add(make_shared<translate>(
-        make_shared<rotate_y>(
-            make_shared<bvh_node>(boxes2), 15),
-            vec3(-100,270,395)
-        )
-    );
-    camera cam;
-
-    cam.aspect_ratio      = 1.0;
-    cam.image_width       = image_width;
-    cam.samples_per_pixel = samples_per_pixel;
-    cam.max_depth         = max_depth;
-    cam.background        = color(0,0,0);
+    // 构建好的场景按 名字+种子 保留下来，后面的任务复制一份再改相机参数，不会互相影响
+    std::map<std::string, std::optional<scene>> built;
+    auto build_scene = [&](const std::string& name, std::optional<unsigned> seed) -> std::optional<scene>&{
+        std::string key = seed ? name + "@" + std::to_string(*seed) : name;
+        auto it = built.find(key);
+        if(it == built.end()){
+            if(seed) seed_random(*seed);
+            it = built.emplace(key, make_scene(name, cache_dir, seed.value_or(0))).first;
+            if(it->second && !cache_dir.empty()){
+                const scene& s = *it->second;
+                std::cerr << s.name << (s.from_cache ? ": loaded from cache in " : ": built in ") << s.load_ms << "ms\n";
+            }
+        }
+        return it->second;
+    };
+
+#ifndef _WIN32
+    if(!farm.worker.empty()){
+        size_t colon = farm.worker.rfind(':');
+        if(colon == std::string::npos){
+            std::cerr << "--worker expects HOST:PORT\n";
+            return 2;
+        }
+        ParallelInit(parallel);
+        int rc = farm::run_worker(farm.worker.substr(0, colon), std::stoi(farm.worker.substr(colon + 1)),
+            [&](const farm::frame_request& request) -> std::optional<scene>{
+                std::optional<scene>& base = build_scene(request.scene, request.seed);
+                if(!base) return std::nullopt;
+                scene s = *base;
+                if(request.width > 0) s.cam.image_width = request.width;
+                if(request.spp > 0) s.cam.samples_per_pixel = request.spp;
+                if(request.depth > 0) s.cam.max_depth = request.depth;
+                s.cam.spectral = request.spectral;
+                if(request.sampler) s.cam.sampler = *request.sampler;
+                return s;
+            });
+        texture_cache::wait_all();
+        ParallelCleanup();
+        return rc;
+    }
+    std::unique_ptr<farm::coordinator> coordinator;
+    if(farm.listen_port || farm.spawn > 0){
+        // 这些选项作用在本机的相机上，分布式渲染时本进程不渲染，不能悄悄忽略
+        for(const render_job& job : jobs){
+            const render_options& opt = job.options;
+            if(opt.stream_rows > 0 || !opt.trace_file.empty() || !opt.checkpoint_file.empty() || opt.resume){
+                std::cerr << "--stream-rows, --trace, --checkpoint and --resume cannot be combined with --listen or --spawn\n";
+                return 2;
+            }
+        }
+        coordinator = std::make_unique<farm::coordinator>(farm.listen_port.value_or(0), !farm.listen_port);
+        if(!coordinator->ok()) return 1;
+        std::cerr << "coordinator listening on port " << coordinator->port() << "\n";
+        std::vector<std::string> worker_args;
+        if(farm.worker_threads > 0) worker_args = {"--threads", std::to_string(farm.worker_threads)};
+        if(!cache_dir.empty()){
+            worker_args.push_back("--cache");
+            worker_args.push_back(cache_dir);
+        }
+        std::error_code ec;
+        std::filesystem::path exe = std::filesystem::read_symlink("/proc/self/exe", ec);
+        coordinator->spawn_local_workers(ec ? std::string(argv[0]) : exe.string(), farm.spawn, worker_args);
+    }
+    const bool distributed = coordinator != nullptr;
+#else
+    const bool distributed = false;
+#endif
+    // 线程池在所有参数检查完、worker 进程启动之后才创建，前面出错时直接返回，没有要清理的东西
+    ParallelInit(parallel);
+
+
+    int failed = 0;
+    struct pending_write{
+        std::string path;
+        shared_ptr<AsyncJob<bool>> job;
+    };
+    std::vector<pending_write> writes;
+    // 等待写出 path 的任务（为空时等待全部）
+    auto finish_writes = [&](const std::string* path){
+        for(size_t i = 0; i < writes.size();){
+            if(path && writes[i].path != *path){
+                i++;
+                continue;
+            }
+            if(!writes[i].job->GetResult()){
+                std::cerr << "cannot write '" << writes[i].path << "'\n";
+                failed++;
+            }
+            writes.erase(writes.begin() + i);
+        }
+    };
+    for(size_t job_index = 0; job_index < jobs.size(); job_index++){
+        const render_job& job = jobs[job_index];
+        const render_options& opt = job.options;
+        if(opt.threads != parallel.nThreads){
+            finish_writes(nullptr);   // 异步任务不能跨越线程池的重建
+            texture_cache::wait_all();
+            parallel.nThreads = opt.threads;
+            ParallelInit(parallel);
+        }
+        if(!opt.out_dir.empty()){
+            std::error_code ec;
+            std::filesystem::create_directories(opt.out_dir, ec);
+        }
+        for(const std::string& name : job.names){
+            // 分布式渲染时场景由 worker 构建，本进程不构建
+            std::optional<scene> s;
+            if(!distributed){
+                std::optional<scene>& base = build_scene(name, opt.seed);
+                if(!base){
+                    failed++;
+                    continue;
+                }
+                s = *base;
+                if(opt.width > 0) s->cam.image_width = opt.width;
+                if(opt.spp > 0) s->cam.samples_per_pixel = opt.spp;
+                if(opt.depth > 0) s->cam.max_depth = opt.depth;
+                s->cam.spectral = opt.spectral;
+                if(opt.sampler) s->cam.sampler = *opt.sampler;
+                s->cam.trace_file = opt.trace_file;
+                s->cam.stream_rows = opt.stream_rows;
+                s->cam.seed = opt.seed.value_or(0);
+                s->cam.checkpoint_file = opt.checkpoint_file;
+                if(!opt.checkpoint_file.empty()){
+                    if(batch) s->cam.checkpoint_file += "." + std::to_string(job_index + 1) + "." + s->name;
+                    s->cam.scene_key = scene_source_hash(name).value_or(0);
+                }
+                s->cam.checkpoint_seconds = opt.checkpoint_seconds;
+                s->cam.resume = opt.resume;
+            }
+            std::string scene_name = s ? s->name : name.ends_with(".rtw") ? std::filesystem::path(name).stem().string() : name;
+            image_format format = opt.format.value_or(image_format_for(opt.out_file));
+            bool streaming = s && opt.stream_rows > 0;
+
+            shared_ptr<std::ofstream> file;
+            std::string path;
+            if(batch || !opt.out_file.empty()){
+                path = opt.out_file;
+                if(path.empty()){
+                    path = (std::filesystem::path(opt.out_dir.empty() ? "." : opt.out_dir) /
+                            (scene_name + image_extension(format))).string();
+                }
+                finish_writes(&path);
+                file = make_shared<std::ofstream>(path, std::ios::binary);
+                if(!*file){
+                    std::cerr << "cannot write '" << path << "'\n";
+                    failed++;
+                    continue;
+                }
+                std::cerr << scene_name << " -> " << path << "\n";
+            }
 
-    cam.vfov     = 40;
-    cam.lookfrom = Point3(478, 278, -600);
-    cam.lookat   = Point3(278, 278, 0);
-    cam.vup      = vec3(0,1,0);
+            int w, h;
+            auto pixels = make_shared<std::vector<color>>();
+            if(s){
+                s->cam.output_format = format;
+                // 流式输出由相机边渲染边写；写到文件时渲染完再异步写出
+                s->cam.image_out = streaming ? (file ? file.get() : &std::cout) : nullptr;
+                s->render();
+                build_scene(name, opt.seed)->cam.sample_cost_ns = s->cam.sample_cost_ns;   // 同一场景的下一个任务据此选 tile 大小
+                w = s->cam.image_width;
+                h = s->cam.height();
+                if(!streaming) pixels->assign(s->cam.pixels(), s->cam.pixels() + size_t(w) * h);
+            }
+            else{
+#ifndef _WIN32
+                auto t1 = std::chrono::steady_clock::now();
+                farm::frame_request request{name, opt.width, opt.spp, opt.depth, opt.seed.value_or(0), opt.spectral, opt.sampler};
+                if(!coordinator->render(request, farm.tile, w, h, *pixels)){
+                    std::cerr << scene_name << ": distributed render failed\n";
+                    failed++;
+                    continue;
+                }
+                std::cerr << w << " " << h << "\nrender time: "
+                          << std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t1).count() << "ms\n";
+#endif
+            }
 
-    cam.defocus_angle = 0;
+            if(streaming){
+                if(file){
+                    file->close();
+                    if(file->fail()){
+                        std::cerr << "cannot write '" << path << "'\n";
+                        failed++;
+                    }
+                }
+            }
+            else if(file){
+                writes.push_back({path, RunAsync([file, pixels, format, w, h]{
+                    write_image(*file, format, w, h, pixels->data());
+                    file->close();
+                    return !file->fail();
+                })});
+            }
+            else{
+                write_image(std::cout, format, w, h, pixels->data());
+            }
+        }
+    }
 
-    //cam.render(world);
+    finish_writes(nullptr);
+    texture_cache::wait_all();
+#ifndef _WIN32
+    coordinator.reset();   // 通知 worker 退出并等本机启动的 worker 进程结束
+#endif
+    ParallelCleanup();
+    return failed ? 1 : 0;
 }
-
-int main(){
-    cornell_box();
-
-    return 0;
-}
\ No newline at end of file
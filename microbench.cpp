@@ -0,0 +1,171 @@
+#include "util/rtweekend.h"
+#include "util/hittable_list.h"
+#include "util/sphere.h"
+#include "util/quad.h"
+#include "util/material.h"
+#include "util/ONB.h"
+#include "util/colorspace.h"
+#include <chrono>
+#include <functional>
+#include <iomanip>
+#include <random>
+#include <vector>
+
+// 单独测量求交、采样等内核的耗时。输入是固定种子生成的随机光线/点，每个内核反复跑到至少 --min-time 毫秒。
+// 用法: microbench [--filter 子串] [--min-time 200] [--count 4096] [--seed 1] [--json]
+// 注意 rgb_to_spectrum 第一次用到系数表时会加载 .rtwspec，找不到就现场拟合，这部分不计时。
+
+// 阻止编译器把结果当成无用代码删掉
+template <typename T>
+inline void keep(const T& value)
+{
+    asm volatile("" : : "r"(&value) : "memory");
+}
+
+struct kernel_result
+{
+    std::string name;
+    double ns_per_op;
+    double ops_per_s;
+    uint64_t ops;
+};
+
+// op(i) 处理第 i 个输入，i 在 [0, count) 中循环
+static kernel_result run_kernel(const std::string& name, size_t count, double min_ms,
+                                const std::function<void(size_t)>& op)
+{
+    // 预热一轮，让输入进缓存
+    for(size_t i = 0; i < count; i++) op(i);
+    uint64_t ops = 0;
+    auto t1 = std::chrono::steady_clock::now();
+    double elapsed_ms = 0;
+    while(elapsed_ms < min_ms)
+    {
+        for(size_t i = 0; i < count; i++) op(i);
+        ops += count;
+        elapsed_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t1).count();
+    }
+    double ns = elapsed_ms * 1e6 / ops;
+    return {name, ns, 1e9 / ns, ops};
+}
+
+int main(int argc, char** argv)
+{
+    std::string filter;
+    double min_ms = 200;
+    size_t count = 4096;
+    unsigned seed = 1;
+    bool json = false;
+    for(int i = 1; i < argc; i++)
+    {
+        std::string arg = argv[i];
+        if(arg == "--json") json = true;
+        else if(i + 1 < argc && arg == "--filter") filter = argv[++i];
+        else if(i + 1 < argc && arg == "--min-time") min_ms = std::stod(argv[++i]);
+        else if(i + 1 < argc && arg == "--count") count = std::stoul(argv[++i]);
+        else if(i + 1 < argc && arg == "--seed") seed = unsigned(std::stoul(argv[++i]));
+        else
+        {
+            std::cerr << "unknown option " << arg << "\n";
+            return 2;
+        }
+    }
+
+    // 输入数据：光线起点分布在半径 4 的球壳上，方向指向原点附近，大约一半能打中单位大小的物体
+    std::mt19937 rng(seed);
+    std::uniform_real_distribution<double> uni(0.0, 1.0);
+    auto random_dir = [&]() {
+        double z = 1 - 2 * uni(rng), phi = 2 * pi * uni(rng);
+        double r = std::sqrt(std::max(0.0, 1 - z * z));
+        return vec3(r * std::cos(phi), r * std::sin(phi), z);
+    };
+    std::vector<Ray> rays(count);
+    for(Ray& r : rays)
+    {
+        Point3 origin = 4 * random_dir();
+        Point3 target = 1.5 * vec3(uni(rng) - 0.5, uni(rng) - 0.5, uni(rng) - 0.5) * 2;
+        r = Ray(origin, target - origin, uni(rng));
+    }
+    std::vector<vec3> normals(count);
+    for(vec3& n : normals) n = random_dir();
+    std::vector<RGB> colors(count);
+    for(RGB& c : colors) c = RGB(float(uni(rng)), float(uni(rng)), float(uni(rng)));
+    seed_random(seed);
+
+    aabb box(Point3(-1, -1, -1), Point3(1, 1, 1));
+    sphere ball(Point3(0, 0, 0), 1.0, nullptr);
+    quad square(Point3(-1, -1, 0), vec3(2, 0, 0), vec3(0, 2, 0), nullptr);
+
+    struct kernel
+    {
+        const char* name;
+        std::function<void(size_t)> op;
+    };
+    std::vector<kernel> kernels = {
+        {"aabb::hit", [&](size_t i) {
+            bool hit = box.hit(rays[i], interval(0.001, infinity));
+            keep(hit);
+        }},
+        {"sphere::hit", [&](size_t i) {
+            hit_record rec;
+            bool hit = ball.hit(rays[i], interval(0.001, infinity), rec);
+            keep(hit);
+            keep(rec);
+        }},
+        {"quad::hit", [&](size_t i) {
+            hit_record rec;
+            bool hit = square.hit(rays[i], interval(0.001, infinity), rec);
+            keep(hit);
+            keep(rec);
+        }},
+        {"random_cosine_direction", [&](size_t) {
+            vec3 d = random_cosine_direction();
+            keep(d);
+        }},
+        {"ONB", [&](size_t i) {
+            ONB onb(normals[i]);
+            keep(onb);
+        }},
+        {"rgb_to_spectrum", [&](size_t i) {
+            RGBSigmoidPolynomial rsp = RGBColorSpace::sRGB->ToRGBCoeffs(colors[i]);
+            keep(rsp);
+        }},
+    };
+
+    std::vector<kernel_result> results;
+    for(const kernel& k : kernels)
+    {
+        if(!filter.empty() && std::string(k.name).find(filter) == std::string::npos) continue;
+        if(std::string(k.name) == "rgb_to_spectrum")
+        {
+            RGBColorSpace::Init();
+            RGBColorSpace::sRGB->ToRGBCoeffs(RGB(0.5f, 0.5f, 0.5f));
+        }
+        results.push_back(run_kernel(k.name, count, min_ms, k.op));
+    }
+
+    if(json)
+    {
+        std::cout << "[\n";
+        for(size_t i = 0; i < results.size(); i++)
+        {
+            const kernel_result& r = results[i];
+            std::cout << "  {\"name\": \"" << r.name << "\", \"ns_per_op\": " << r.ns_per_op
+                      << ", \"ops_per_s\": " << r.ops_per_s << ", \"ops\": " << r.ops << "}"
+                      << (i + 1 < results.size() ? "," : "") << "\n";
+        }
+        std::cout << "]\n";
+    }
+    else
+    {
+        std::cout << std::left << std::setw(26) << "kernel" << std::right << std::setw(12) << "ns/op"
+                  << std::setw(16) << "Mops/s" << "\n";
+        for(const kernel_result& r : results)
+        {
+            std::cout << std::left << std::setw(26) << r.name << std::right << std::fixed << std::setprecision(2)
+                      << std::setw(12) << r.ns_per_op << std::setw(16) << r.ops_per_s * 1e-6 << "\n"
+                      << std::defaultfloat;
+        }
+    }
+    return 0;
+}
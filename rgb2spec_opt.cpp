@@ -0,0 +1,37 @@
+#include "util/rtweekend.h"
+#include "util/colorspace.h"
+#include "util/rgb2spec.h"
+#include <chrono>
+#include <vector>
+
+// 预先为颜色空间拟合 RGB -> 光谱系数表，写成一个 .rtwspec 文件供渲染时 mmap。
+// 用法: rgb2spec_opt [输出文件] [颜色空间...]
+// 默认输出到 $RTW_SPECTRUM_TABLES 或 rgbspectrum.rtwspec，包含 srgb dci-p3 rec2020 aces2065-1。
+int main(int argc, char** argv){
+    std::string output = argc > 1 ? argv[1] : RGBToSpectrumTableFile::DefaultPath();
+    std::vector<std::string> names;
+    for(int i = 2; i < argc; i++) names.push_back(argv[i]);
+    if(names.empty()) names = {"srgb", "dci-p3", "rec2020", "aces2065-1"};
+
+    RGBColorSpace::Init();
+    std::vector<std::unique_ptr<RGBToSpectrumTableData>> tables;
+    std::vector<RGBToSpectrumTableEntry> entries;
+    for(const std::string& name : names){
+        const RGBColorSpace* cs = RGBColorSpace::GetName(name);
+        if(!cs){
+            std::cerr << "unknown color space '" << name << "'\n";
+            return 1;
+        }
+        auto t1 = std::chrono::steady_clock::now();
+        tables.push_back(ComputeRGBToSpectrumTable(cs->XYZFromRGB, cs->RGBFromXYZ, &cs->illuminant));
+        auto t2 = std::chrono::steady_clock::now();
+        std::cerr << name << ": " << std::chrono::duration<double>(t2 - t1).count() << "s\n";
+        entries.push_back({cs->name, cs->RGBFromXYZ, tables.back()->zNodes.data(), tables.back()->coeffs.data()});
+    }
+    if(!WriteRGBToSpectrumTables(output, entries)){
+        std::cerr << "failed to write '" << output << "'\n";
+        return 1;
+    }
+    std::cerr << "wrote " << entries.size() << " tables to " << output << "\n";
+    return 0;
+}
@@ -0,0 +1,478 @@
+#ifndef SCENES_H
+#define SCENES_H
+#include "util/rtweekend.h"
+#include "util/sphere.h"
+#include "util/camera.h"
+#include "util/hittable.h"
+#include "util/hittable_list.h"
+#include "util/bvh.h"
+#include "util/texture.h"
+#include "util/quad.h"
+#include "util/constant_medium.h"
+#include "util/heterogeneous_medium.h"
+#include "util/scene.h"
+#include "util/scene_loader.h"
+#include "util/scene_cache.h"
+#include <fstream>
+#include <sstream>
+#include <optional>
+#include <string>
+#include <vector>
+
+inline scene bouncing_spheres(){
+    scene s("bouncing_spheres");
+    hittable_list world;
+    shared_ptr<check_texture> check = make_shared<check_texture>(0.32,color(.2,.3,.1),color(0.9,0.9,0.9));
+    auto material_ground = make_shared<lambertian>(check);
+    world.add(make_shared<sphere>(Point3(0,-1000,0),1000,material_ground));
+
+    for(int a =-11;a<11;a++){
+        for(int b=-11;b<11;b++){
+            double choose_mat = random_double();
+            Point3 center(a+0.9*random_double(),0.2,b+0.9*random_double());
+            if((center - Point3(4,0.2,0)).length() > 0.9){
+                shared_ptr<material> sphere_material;
+                if(choose_mat < 0.8){
+                    //diffuse
+                    color albedo = color::random() * color::random();
+                    sphere_material = make_shared<lambertian>(albedo);
+                    Point3 center2 = center+vec3(0,random_double(0,0.5),0);
+                    world.add(make_shared<sphere>(center,center2,0.2,sphere_material));
+                }
+                else if(choose_mat < 0.95){
+                    //metal
+                    color albedo = color::random(0.5,1);
+                    double fuzz = random_double(0,0.5);
+                    sphere_material =make_shared<metal>(albedo,fuzz);
+                    world.add(make_shared<sphere>(center,0.2,sphere_material));
+                }
+                else{
+                    //glass
+                    sphere_material = make_shared<dielectric>(1.5);
+                    world.add(make_shared<sphere>(center,0.2,sphere_material));
+                }
+            }
+        }
+    }
+
+    auto material1 = make_shared<dielectric>(1.50);
+    world.add(make_shared<sphere>(Point3(0,1,0),1.0,material1));
+    auto material2 = make_shared<lambertian>(color(0.4,0.2,0.1));
+    world.add(make_shared<sphere>(Point3(-4,1,0),1.0,material2));
+    auto material3 = make_shared<metal>(color(0.7,0.6,0.5),0.0);
+    world.add(make_shared<sphere>(Point3(4,1,0),1.0,material3));
+
+    s.world = s.build_bvh(world);
+    camera& cam = s.cam;
+    cam.background        = color(0.70, 0.80, 1.00);
+    cam.aspect_ratio=16.0/9.0;
+    cam.image_width = 1200;
+    cam.samples_per_pixel=100;
+    cam.max_depth=50;
+    cam.vfov = 20;
+    cam.lookfrom = Point3(13,2,3);
+    cam.lookat = Point3(0,0,0);
+    cam.vup = vec3(0,1,0);
+    cam.defocus_angle = 0.6;
+    cam.focus_dist=10.0;
+    return s;
+}
+inline scene checkered_sphere(){
+    scene s("checkered_sphere");
+    auto world = make_shared<hittable_list>();
+    auto checker = make_shared<check_texture>(0.32,color(.2,.3,.1),color(.9,.9,.9));
+    world->add(make_shared<sphere>(Point3(0,-10,0),10,make_shared<lambertian>(checker)));
+    world->add(make_shared<sphere>(Point3(0,10,0),10,make_shared<lambertian>(checker)));
+    s.world = world;
+    camera& cam = s.cam;
+    cam.background        = color(0.70, 0.80, 1.00);
+    cam.aspect_ratio = 16.0 / 9.0;
+    cam.image_width = 400;
+    cam.samples_per_pixel = 100;
+    cam.max_depth = 50;
+    cam.vfov = 20;
+    cam.lookfrom = Point3(13,2,3);
+    cam.lookat = Point3(0,0,0);
+    cam.vup = vec3(0,1,0);
+    cam.defocus_angle = 0;
+    return s;
+}
+inline scene earth(){
+    scene s("earth");
+    auto world = make_shared<hittable_list>();
+    shared_ptr<image_texture> earth_texture = make_shared<image_texture>("../images/earthmap.jpg");
+    shared_ptr<lambertian> earth_surface = make_shared<lambertian>(earth_texture);
+    shared_ptr<sphere> globe = make_shared<sphere>(Point3(0,0,0),2,earth_surface);
+    world->add(globe);
+    s.world = world;
+    camera& cam = s.cam;
+    cam.background        = color(0.70, 0.80, 1.00);
+    cam.aspect_ratio = 16.0 / 9.0;
+    cam.image_width = 400;
+    cam.samples_per_pixel = 100;
+    cam.max_depth = 50;
+    cam.vfov = 20;
+    cam.lookfrom = Point3(0,0,12);
+    cam.lookat = Point3(0,0,0);
+    cam.vup = vec3(0,1,0);
+    cam.defocus_angle = 0;
+    return s;
+}
+inline scene perlin_spheres(){
+    scene s("perlin_spheres");
+    auto world = make_shared<hittable_list>();
+    shared_ptr<noise_texture> pertex = make_shared<noise_texture>(4);
+    world->add(make_shared<sphere>(Point3(0,-1000,0),1000,make_shared<lambertian>(pertex)));
+    world->add(make_shared<sphere>(Point3(0,2,0),2,make_shared<lambertian>(pertex)));
+    s.world = world;
+    camera& cam = s.cam;
+    cam.background        = color(0.70, 0.80, 1.00);
+    cam.aspect_ratio      = 16.0 / 9.0;
+    cam.image_width       = 400;
+    cam.samples_per_pixel = 100;
+    cam.max_depth         = 50;
+
+    cam.vfov     = 20;
+    cam.lookfrom = Point3(13,2,3);
+    cam.lookat   = Point3(0,0,0);
+    cam.vup      = vec3(0,1,0);
+
+    cam.defocus_angle = 0;
+    return s;
+}
+inline scene quads(){
+    scene s("quads");
+    auto world = make_shared<hittable_list>();
+
+    // Materials
+    auto left_red     = make_shared<lambertian>(color(1.0, 0.2, 0.2));
+    auto back_green   = make_shared<lambertian>(color(0.2, 1.0, 0.2));
+    auto right_blue   = make_shared<lambertian>(color(0.2, 0.2, 1.0));
+    auto upper_orange = make_shared<lambertian>(color(1.0, 0.5, 0.0));
+    auto lower_teal   = make_shared<lambertian>(color(0.2, 0.8, 0.8));
+
+    // Quads
+    world->add(make_shared<quad>(Point3(-3,-2, 5), vec3(0, 0,-4), vec3(0, 4, 0), left_red));
+    world->add(make_shared<quad>(Point3(-2,-2, 0), vec3(4, 0, 0), vec3(0, 4, 0), back_green));
+    world->add(make_shared<quad>(Point3( 3,-2, 1), vec3(0, 0, 4), vec3(0, 4, 0), right_blue));
+    world->add(make_shared<quad>(Point3(-2, 3, 1), vec3(4, 0, 0), vec3(0, 0, 4), upper_orange));
+    world->add(make_shared<quad>(Point3(-2,-3, 5), vec3(4, 0, 0), vec3(0, 0,-4), lower_teal));
+    s.world = world;
+    camera& cam = s.cam;
+    cam.background        = color(0.70, 0.80, 1.00);
+    cam.aspect_ratio      = 1.0;
+    cam.image_width       = 400;
+    cam.samples_per_pixel = 100;
+    cam.max_depth         = 50;
+
+    cam.vfov     = 80;
+    cam.lookfrom = Point3(0,0,9);
+    cam.lookat   = Point3(0,0,0);
+    cam.vup      = vec3(0,1,0);
+    cam.defocus_angle = 0;
+    return s;
+}
+inline scene simple_light(){
+    scene s("simple_light");
+    auto world = make_shared<hittable_list>();
+    auto pertex = make_shared<noise_texture>(4);
+    world->add(make_shared<sphere>(Point3(0,-1000,0),1000,make_shared<lambertian>(pertex)));
+    world->add(make_shared<sphere>(Point3(0,2,0),2,make_shared<lambertian>(pertex)));
+
+    auto difflight = make_shared<diffuse_light>(color(4,4,4));
+    world->add(make_shared<quad>(Point3(3,1,-2),vec3(2,0,0),vec3(0,2,0),difflight));
+    world->add(make_shared<sphere>(Point3(0,7,0),2,difflight));
+    s.world = world;
+    s.collect_lights();
+    camera& cam = s.cam;
+    cam.aspect_ratio = 16.0 / 9.0;
+    cam.image_width = 400;
+    cam.samples_per_pixel = 100;
+    cam.max_depth = 50;
+    cam.background = color(0,0,0);
+    cam.vfov = 20;
+    cam.lookfrom = Point3(26,3,6);
+    cam.lookat = Point3(0,2,0);
+    cam.vup = vec3(0,1,0);
+    cam.defocus_angle = 0;
+    return s;
+}
+inline scene cornell_box(){
+    scene s("cornell_box");
+    hittable_list world;
+    auto red   = make_shared<lambertian>(color(.65, .05, .05));
+    auto white = make_shared<lambertian>(color(.73, .73, .73));
+    auto green = make_shared<lambertian>(color(.12, .45, .15));
+    auto light = make_shared<diffuse_light>(color(15, 15, 15));
+    world.add(make_shared<quad>(Point3(555,0,0),vec3(0,555,0),vec3(0,0,555),green));
+    world.add(make_shared<quad>(Point3(0,0,0),vec3(0,555,0),vec3(0,0,555),red));
+    world.add(make_shared<quad>(Point3(343,554,332),vec3(-130,0,0),vec3(0,0,-105),light));
+    world.add(make_shared<quad>(Point3(0,0,0),vec3(555,0,0),vec3(0,0,555),white));
+    world.add(make_shared<quad>(Point3(555,555,555),vec3(-555,0,0),vec3(0,0,-555),white));
+    world.add(make_shared<quad>(Point3(0,0,555),vec3(555,0,0),vec3(0,555,0),white));
+
+    shared_ptr<hittable> box1 = box(Point3(0,0,0), Point3(165,330,165), white);
+    box1 = make_shared<rotate_y>(box1, 15);
+    box1 = make_shared<translate>(box1, vec3(265,0,295));
+    world.add(box1);
+
+    shared_ptr<hittable> box2 = box(Point3(0,0,0), Point3(165,165,165), white);
+    box2 = make_shared<rotate_y>(box2, -18);
+    box2 = make_shared<translate>(box2, vec3(130,0,65));
+    world.add(box2);
+    s.world = s.build_bvh(world);
+    s.collect_lights();
+    camera& cam = s.cam;
+
+    cam.aspect_ratio      = 1.0;
+    cam.image_width       = 800;
+    cam.samples_per_pixel = 100;
+    cam.max_depth         = 50;
+    cam.background        = color(0,0,0);
+
+    cam.vfov     = 40;
+    cam.lookfrom = Point3(278, 278, -800);
+    cam.lookat   = Point3(278, 278, 0);
+    cam.vup      = vec3(0,1,0);
+
+    cam.defocus_angle = 0;
+    return s;
+}
+inline scene cornell_smoke(){
+    scene s("cornell_smoke");
+    hittable_list world;
+    auto red   = make_shared<lambertian>(color(.65, .05, .05));
+    auto white = make_shared<lambertian>(color(.73, .73, .73));
+    auto green = make_shared<lambertian>(color(.12, .45, .15));
+    auto light = make_shared<diffuse_light>(color(7, 7, 7));
+    world.add(make_shared<quad>(Point3(555,0,0), vec3(0,555,0), vec3(0,0,555), green));
+    world.add(make_shared<quad>(Point3(0,0,0), vec3(0,555,0), vec3(0,0,555), red));
+    world.add(make_shared<quad>(Point3(113,554,127), vec3(330,0,0), vec3(0,0,305), light));
+    world.add(make_shared<quad>(Point3(0,555,0), vec3(555,0,0), vec3(0,0,555), white));
+    world.add(make_shared<quad>(Point3(0,0,0), vec3(555,0,0), vec3(0,0,555), white));
+    world.add(make_shared<quad>(Point3(0,0,555), vec3(555,0,0), vec3(0,555,0), white));
+
+    shared_ptr<hittable> box1 = box(Point3(0,0,0), Point3(165,330,165), white);
+    box1 = make_shared<rotate_y>(box1, 15);
+    box1 = make_shared<translate>(box1, vec3(265,0,295));
+
+    shared_ptr<hittable> box2 = box(Point3(0,0,0), Point3(165,165,165), white);
+    box2 = make_shared<rotate_y>(box2, -18);
+    box2 = make_shared<translate>(box2, vec3(130,0,65));
+
+    world.add(make_shared<constant_medium>(box1, 0.01, color(0,0,0)));
+    world.add(make_shared<constant_medium>(box2, 0.01, color(1,1,1)));
+    s.world = s.build_bvh(world);
+    camera& cam = s.cam;
+
+    cam.aspect_ratio      = 1.0;
+    cam.image_width       = 600;
+    cam.samples_per_pixel = 200;
+    cam.max_depth         = 50;
+    cam.background        = color(0,0,0);
+
+    cam.vfov     = 40;
+    cam.lookfrom = Point3(278, 278, -800);
+    cam.lookat   = Point3(278, 278, 0);
+    cam.vup      = vec3(0,1,0);
+
+    cam.defocus_angle = 0;
+    return s;
+}
+inline scene final_scene(int image_width = 800, int samples_per_pixel = 10000, int max_depth = 40) {
+    scene s("final_scene");
+    // 地球纹理在后台解码，和下面的几何体、BVH 构建重叠
+    texture_cache::prefetch("../images/earthmap.jpg");
+    hittable_list boxes1;
+    auto ground = make_shared<lambertian>(color(0.48, 0.83, 0.53));
+
+    int boxes_per_side = 20;
+    for (int i = 0; i < boxes_per_side; i++) {
+        for (int j = 0; j < boxes_per_side; j++) {
+            auto w = 100.0;
+            auto x0 = -1000.0 + i*w;
+            auto z0 = -1000.0 + j*w;
+            auto y0 = 0.0;
+            auto x1 = x0 + w;
+            auto y1 = random_double(1,101);
+            auto z1 = z0 + w;
+
+            boxes1.add(box(Point3(x0,y0,z0), Point3(x1,y1,z1), ground));
+        }
+    }
+
+    auto world = make_shared<hittable_list>();
+
+    world->add(s.build_bvh(boxes1));
+
+    auto light = make_shared<diffuse_light>(color(7, 7, 7));
+    world->add(make_shared<quad>(Point3(123,554,147), vec3(300,0,0), vec3(0,0,265), light));
+
+    auto center1 = Point3(400, 400, 200);
+    auto center2 = center1 + vec3(30,0,0);
+    auto sphere_material = make_shared<lambertian>(color(0.7, 0.3, 0.1));
+    world->add(make_shared<sphere>(center1, center2, 50, sphere_material));
+
+    world->add(make_shared<sphere>(Point3(260, 150, 45), 50, make_shared<dielectric>(1.5)));
+    world->add(make_shared<sphere>(
+        Point3(0, 150, 145), 50, make_shared<metal>(color(0.8, 0.8, 0.9), 1.0)
+    ));
+
+    auto boundary = make_shared<sphere>(Point3(360,150,145), 70, make_shared<dielectric>(1.5));
+    world->add(boundary);
+    world->add(make_shared<constant_medium>(boundary, 0.2, color(0.2, 0.4, 0.9)));
+    boundary = make_shared<sphere>(Point3(0,0,0), 5000, make_shared<dielectric>(1.5));
+    world->add(make_shared<constant_medium>(boundary, .0001, color(1,1,1)));
+
+    auto emat = make_shared<lambertian>(make_shared<image_texture>("../images/earthmap.jpg"));
+    world->add(make_shared<sphere>(Point3(400,200,400), 100, emat));
+    auto pertext = make_shared<noise_texture>(0.2);
+    world->add(make_shared<sphere>(Point3(220,280,300), 80, make_shared<lambertian>(pertext)));
+
+    hittable_list boxes2;
+    auto white = make_shared<lambertian>(color(.73, .73, .73));
+    int ns = 1000;
+    for (int j = 0; j < ns; j++) {
+        boxes2.add(make_shared<sphere>(Point3::random(0,165), 10, white));
+    }
+
+    world->add(make_shared<translate>(
+        make_shared<rotate_y>(
+            s.build_bvh(boxes2), 15),
+            vec3(-100,270,395)
+        )
+    );
+    s.world = world;
+    camera& cam = s.cam;
+
+    cam.aspect_ratio      = 1.0;
+    cam.image_width       = image_width;
+    cam.samples_per_pixel = samples_per_pixel;
+    cam.max_depth         = max_depth;
+    cam.background        = color(0,0,0);
+
+    cam.vfov     = 40;
+    cam.lookfrom = Point3(478, 278, -600);
+    cam.lookat   = Point3(278, 278, 0);
+    cam.vup      = vec3(0,1,0);
+
+    cam.defocus_angle = 0;
+    return s;
+}
+// cornell_smoke 的变体：一团密度不均匀的噪声云，大部分体积是空的
+inline scene cornell_cloud(){
+    scene s("cornell_cloud");
+    hittable_list world;
+    auto red   = make_shared<lambertian>(color(.65, .05, .05));
+    auto white = make_shared<lambertian>(color(.73, .73, .73));
+    auto green = make_shared<lambertian>(color(.12, .45, .15));
+    auto light = make_shared<diffuse_light>(color(7, 7, 7));
+    world.add(make_shared<quad>(Point3(555,0,0), vec3(0,555,0), vec3(0,0,555), green));
+    world.add(make_shared<quad>(Point3(0,0,0), vec3(0,555,0), vec3(0,0,555), red));
+    world.add(make_shared<quad>(Point3(113,554,127), vec3(330,0,0), vec3(0,0,305), light));
+    world.add(make_shared<quad>(Point3(0,555,0), vec3(555,0,0), vec3(0,0,555), white));
+    world.add(make_shared<quad>(Point3(0,0,0), vec3(555,0,0), vec3(0,0,555), white));
+    world.add(make_shared<quad>(Point3(0,0,555), vec3(555,0,0), vec3(0,555,0), white));
+
+    auto grid = density_grid::from_noise(64, 64, 64, Point3(60,20,60), Point3(495,500,495), 0.015);
+    world.add(make_shared<heterogeneous_medium>(grid, 0.2, color(1,1,1)));
+    s.world = s.build_bvh(world);
+    s.collect_lights();
+    camera& cam = s.cam;
+
+    cam.aspect_ratio      = 1.0;
+    cam.image_width       = 600;
+    cam.samples_per_pixel = 200;
+    cam.max_depth         = 50;
+    cam.background        = color(0,0,0);
+
+    cam.vfov     = 40;
+    cam.lookfrom = Point3(278, 278, -800);
+    cam.lookat   = Point3(278, 278, 0);
+    cam.vup      = vec3(0,1,0);
+
+    cam.defocus_angle = 0;
+    return s;
+}
+
+// 所有场景，按名字查找
+struct scene_entry{
+    const char* name;
+    scene (*build)();
+};
+
+inline const std::vector<scene_entry>& scene_registry(){
+    static const std::vector<scene_entry> entries = {
+        {"bouncing_spheres", bouncing_spheres},
+        {"checkered_sphere", checkered_sphere},
+        {"earth",            earth},
+        {"perlin_spheres",   perlin_spheres},
+        {"quads",            quads},
+        {"simple_light",     simple_light},
+        {"cornell_box",      cornell_box},
+        {"cornell_smoke",    cornell_smoke},
+        {"cornell_cloud",    cornell_cloud},
+        {"final_scene",      []{ return final_scene(); }},
+    };
+    return entries;
+}
+
+inline const scene_entry* find_scene(const std::string& name){
+    for(const scene_entry& e : scene_registry()){
+        if(name == e.name) return &e;
+    }
+    return nullptr;
+}
+
+// 以 .rtw 结尾时读场景文件，否则按名字找内置场景
+inline std::optional<scene> make_scene(const std::string& name){
+    if(name.ends_with(".rtw")) return scene_loader::load(name);
+    const scene_entry* entry = find_scene(name);
+    if(!entry){
+        std::cerr << "unknown scene '" << name << "', available:";
+        for(const scene_entry& e : scene_registry()) std::cerr << " " << e.name;
+        std::cerr << " or a .rtw file\n";
+        return std::nullopt;
+    }
+    return entry->build();
+}
+
+// 场景来源的哈希：.rtw 文件取文件内容，内置场景取名字；文件读不出来时返回空
+inline std::optional<uint64_t> scene_source_hash(const std::string& name){
+    if(!name.ends_with(".rtw")) return scene_cache::hash(name);
+    std::ifstream in(name, std::ios::binary);
+    if(!in) return std::nullopt;
+    std::stringstream buffer;
+    buffer << in.rdbuf();
+    return scene_cache::hash(buffer.str());
+}
+
+// 同上，但先到 cache_dir 里找构建好的场景，没有就构建后写进去。
+// .rtw 文件的 key 取文件内容的哈希；内置场景取名字和编译时间，场景代码改了重新编译即失效。
+// 内置场景会用 random_double 生成内容，调用方固定了种子时把它作为 salt 传进来。
+inline std::optional<scene> make_scene(const std::string& name, const std::string& cache_dir, uint64_t salt = 0){
+    if(cache_dir.empty()) return make_scene(name);
+    std::optional<uint64_t> source = scene_source_hash(name);
+    if(!source) return make_scene(name);
+    uint64_t key = name.ends_with(".rtw") ? *source : scene_cache::hash(std::string("@" __DATE__ " " __TIME__), *source);
+    key = scene_cache::hash(&salt, sizeof(salt), key);
+    std::string stem = std::filesystem::path(name).stem().string();
+    std::string path = scene_cache::path(cache_dir, stem, key);
+
+    auto t1 = std::chrono::steady_clock::now();
+    if(std::optional<scene> cached = scene_cache::load(path, key)){
+        auto t2 = std::chrono::steady_clock::now();
+        cached->load_ms = std::chrono::duration<double, std::milli>(t2 - t1).count();
+        cached->from_cache = true;
+        return cached;
+    }
+    std::optional<scene> s = make_scene(name);
+    if(!s) return s;
+    auto t2 = std::chrono::steady_clock::now();
+    s->load_ms = std::chrono::duration<double, std::milli>(t2 - t1).count();
+    std::error_code ec;
+    std::filesystem::create_directories(cache_dir, ec);
+    if(!scene_cache::save(*s, path, key)) std::cerr << "cannot write scene cache '" << path << "'\n";
+    return s;
+}
+#endif
@@ -3,10 +3,14 @@
 #include "rtweekend.h"
 #include "hittable.h"
 #include "hittable_list.h"
+#include "stats.h"
+#include "parallel.h"
 #include <algorithm>
 class bvh_node :public hittable{
 public:
     bool hit(const Ray& r,interval ray_t,hit_record& rec) const override{
+        RTW_STAT_TIMER(BVH);
+        RTW_STAT_COUNT(BVHNodeVisits);
         if(!bbox.hit(r,ray_t)){
             return false;
         }
@@ -17,10 +21,24 @@ public:
     aabb bounding_box() const override{
         return bbox;
     }
+    void collect_lights(const shared_ptr<hittable>& self, std::vector<shared_ptr<hittable>>& lights) const override{
+        left->collect_lights(left, lights);
+        if(right != left) right->collect_lights(right, lights);
+    }
     bvh_node(std::vector<shared_ptr<hittable>>& objects,size_t start,size_t end){
-        bbox = aabb::empty;
-        for(size_t index=start;index<=end;index++){
-            bbox = aabb(bbox,objects[index]->bounding_box());
+        bool parallel = end - start >= parallel_build_threshold;
+        if(parallel){
+            bbox = ParallelReduce(int64_t(start), int64_t(end) + 1, 0, aabb::empty, [&](int64_t first, int64_t last){
+                aabb box = aabb::empty;
+                for(int64_t index = first; index < last; index++) box = aabb(box, objects[index]->bounding_box());
+                return box;
+            }, [](const aabb& a, const aabb& b){ return aabb(a, b); });
+        }
+        else{
+            bbox = aabb::empty;
+            for(size_t index=start;index<=end;index++){
+                bbox = aabb(bbox,objects[index]->bounding_box());
+            }
         }
         int axis = bbox.longest_axis();
         auto comparator = (axis==0) ? box_x_compare :
@@ -38,16 +56,29 @@ public:
         else{
             std::sort(objects.begin()+start,objects.begin()+end+1,comparator);
             int mid = start + len/2;
-            left = make_shared<bvh_node>(objects,start,mid);
-            right = make_shared<bvh_node>(objects,mid+1,end);
+            if(parallel){
+                // 两棵子树处理的是 objects 中不相交的区间，可以同时构建
+                ParallelFor(0, 2, 1, [&](int64_t first, int64_t){
+                    if(first == 0) left = make_shared<bvh_node>(objects,start,mid);
+                    else right = make_shared<bvh_node>(objects,mid+1,end);
+                });
+            }
+            else{
+                left = make_shared<bvh_node>(objects,start,mid);
+                right = make_shared<bvh_node>(objects,mid+1,end);
+            }
         }
         bbox = aabb(left->bounding_box(),right->bounding_box());
     }
     bvh_node(hittable_list list) : bvh_node (list.objects,0,list.objects.size()-1) {}
 private:
+    friend class scene_cache;
+    friend class linear_bvh;
     shared_ptr<hittable> left;
     shared_ptr<hittable> right;
     aabb bbox;
+    // 图元数超过这个值的子树并行构建
+    static constexpr size_t parallel_build_threshold = 4096;
     static bool box_compare(
         const shared_ptr<hittable> a,const shared_ptr<hittable> b,int axis_index
     ){
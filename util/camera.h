@@ -5,10 +5,16 @@
 #include "hittable.h"
 #include "material.h"
 #include "pdf.h"
+#include "image_io.h"
+#include "checkpoint.h"
+#include "sampler.h"
 #include "RTV.h"
 #include "parallel.h"
+#include "colorspace.h"
+#include "stats.h"
 #include <tuple>
 #include <chrono>
+#include <atomic>
 class camera{
 public:
     double aspect_ratio=16.0/9.0;
@@ -22,9 +28,55 @@ public:
     double defocus_angle = 0;
     double focus_dist = 10;
     color background;
+    bool   spectral = false;  // 每条路径携带 NSpectrumSamples 个波长，结果在 XYZ 中累加后转回 sRGB
+    std::ostream* image_out = &std::cout;  // 为空时不输出图像
+    image_format output_format = image_format::ppm;
+    bool   verbose = true;                 // 是否在 stderr 上打印尺寸、耗时等信息
+    std::string trace_file;                // 非空时把每个 tile 的耗时写成 Chrome trace JSON
+    bool   ray_cones = true;               // 主光线带上像素大小的光锥，纹理据此选择 MIP 层级和噪声八度数
+    double sample_cost_ns = 0;             // 每个样本的平均耗时，每次 render 后更新，下一帧据此选 tile 大小；为 0 时按面积估计
+    int    stream_rows = 0;                // > 0 且有 image_out 时逐条带渲染并立即写出，只保留两条带的像素，内存与图像高度无关
+    unsigned seed = 0;                     // 每个样本的随机数由 (seed, 像素, 样本序号) 决定
+    sampler_type sampler = sampler_type::sobol;   // 像素、镜头、时间和路径上各维随机数的来源
+    std::string checkpoint_file;           // 非空时分轮渲染，每隔 checkpoint_seconds 把累加进度异步写到这个文件
+    double checkpoint_seconds = 600;
+    bool   resume = false;                 // 从 checkpoint_file 接着渲染，结果与一次渲完逐位一致
+    uint64_t scene_key = 0;                // 场景内容的标识，写进检查点，续渲时场景不同就从头渲染
+
+    // 对光源做重要性采样
     void render(const hittable& world, const hittable& lights){
+        render_scene(world, &lights);
+    }
+    // 没有显式光源时只按材质采样
+    void render(const hittable& world){
+        render_scene(world, nullptr);
+    }
+
+    // 上一次 render 追踪的光线数和耗时
+    uint64_t ray_count() const { return rays_traced; }
+    double render_time_ms() const { return render_ms; }
+    // 上一次 render 的各阶段计数和耗时，只有定义了 RTW_STATS 才有数据
+    const stats::Totals& statistics() const { return render_stats; }
+    // 分块渲染（分布式渲染的 worker 用）：先 prepare 一次，之后每块 render_region 把 region 内的像素按行写进 out，
+    // out 的宽度是 region 的宽度。不分配整幅图像，不写输出，也不统计光线数
+    void prepare(){
+        initialize(false);
+    }
+    void render_region(const hittable& world, const hittable* lights, const Bounds2i& region, color* out) const{
+        int width = region.pMax.x - region.pMin.x;
+        ParallelFor2D(region, [&](Bounds2i tile){
+            for(Point2i p : tile){
+                out[(p.y - region.pMin.y) * width + (p.x - region.pMin.x)] = render_pixel(p.x, p.y, world, lights);
+            }
+        });
+    }
+    // 上一次 render 的图像，按行从上到下的线性颜色；image_out 为空时调用者可以自己写出（流式输出时没有）
+    int height() const { return image_height; }
+    const color* pixels() const { return colorBuffer.data(); }
+private:
+    void render_scene(const hittable& world, const hittable* lights){
         initialize();
-        std::cout << "P3\n" << image_width << " " << image_height << "\n255\n";
+        rays_traced = 0;
         #define NO_VRS
         #ifdef USE_VRS
 
@@ -36,16 +88,7 @@ public:
                 int i = rtvToPixel[RTVStep][index].first;
                 int j = rtvToPixel[RTVStep][index].second;
                 auto[shaderX, shaderY] = getCenterPixel(i, j, RTVStep);
-                color pixel_color(0, 0, 0);
-                for(int sampleu = 0; sampleu < sqrt_spp; sampleu++)
-                {
-                    for(int samplev = 0; samplev < sqrt_spp; samplev++)
-                    {
-                        Ray r = get_ray(i, j, sampleu, samplev);
-                        pixel_color += ray_color(r,max_depth,world, lights);
-                    }
-                }
-                pixel_color *= recip_sqrt_spp;
+                color pixel_color = render_pixel(i, j, world, lights);
                 for(int spiltY = 0; spiltY < RTVOFFSET::sizeX[RTVStep]; spiltY++)
                 {
                     for(int spiltX = 0; spiltX < RTVOFFSET::sizeX[RTVStep]; spiltX++)
@@ -58,28 +101,47 @@ public:
             }
         }
         std::chrono::high_resolution_clock::time_point t2 = std::chrono::high_resolution_clock::now();
-        std::chrono::duration<double> time_span = std::chrono::duration_cast<std::chrono::milliseconds>(t2 - t1);
-        std::cerr << "render time: " << time_span.count() << "ms\n";
+        render_ms = std::chrono::duration<double, std::milli>(t2 - t1).count();
+        if(verbose) std::cerr << "render time: " << render_ms << "ms\n";
         #endif
         
         #ifdef NO_VRS
         std::chrono::high_resolution_clock::time_point t1 = std::chrono::high_resolution_clock::now();
 
-        Bounds2i image(0.0f, 0.0f, image_width, image_height);
-        
-        ParallelFor2D(image, [&](Point2i p){
-            color pixel_color(0,0,0);
-            for(int sampleu = 0; sampleu < sqrt_spp; sampleu++)
-            {
-                for(int samplev = 0; samplev < sqrt_spp; samplev++)
-                {
-                    Ray r = get_ray(p.x, p.y, sampleu, samplev);
-                    pixel_color += ray_color(r,max_depth, world, lights);
-                }
-            }
-            pixel_color *= recip_sqrt_spp;
-            colorBuffer[p.y * image_width + p.x] = pixel_color;
-        });
+        std::atomic<uint64_t> total_rays = 0;
+        stats::Registry::Get().Reset();
+        std::atomic<int64_t> total_tile_ns = 0;
+        // 对 [y0, y1) 这些行的每个像素调用 shade，统计光线数和耗时
+        auto render_band = [&](int y0, int y1, auto&& shade){
+            Bounds2i band(Point2i(0, y0), Point2i(image_width, y1));
+            ParallelFor2D(band, [&](Bounds2i tile){
+                // 每个 tile 结束时把本线程的计数累加一次，避免每条光线都做原子操作
+                uint64_t rays_before = thread_ray_count();
+                auto tile_begin = std::chrono::steady_clock::now();
+                for(Point2i p : tile) shade(p);
+                total_tile_ns += std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - tile_begin).count();
+                total_rays += thread_ray_count() - rays_before;
+            }, tile_size(image_width * (y1 - y0)));
+        };
+        // 渲染 [y0, y1) 这些行，结果从 rows 开始按行存放
+        auto render_rows = [&](int y0, int y1, color* rows){
+            render_band(y0, y1, [&](Point2i p){
+                rows[(p.y - y0) * image_width + p.x] = render_pixel(p.x, p.y, world, lights);
+            });
+        };
+        bool streaming = stream_rows > 0 && image_out;
+        if(streaming && !checkpoint_file.empty() && verbose) std::cerr << "checkpoints are not written while streaming rows\n";
+        uint64_t samples = uint64_t(image_width) * image_height * samples_per_pixel;
+        if(!trace_file.empty()) TileTrace::Start();
+        if(streaming) render_streaming(render_rows);
+        else if(!checkpoint_file.empty()) samples = render_checkpointed(render_band, world, lights);
+        else render_rows(0, image_height, colorBuffer.data());
+        rays_traced = total_rays;
+        if(samples > 0) sample_cost_ns = double(total_tile_ns) / double(samples);
+        if(!trace_file.empty() && !TileTrace::Stop(trace_file)){
+            std::cerr << "failed to write trace '" << trace_file << "'\n";
+        }
+        render_stats = stats::Registry::Get().Merge();
 
         // for(int j = 0;j<image_height;j++){
         //     for(int i =0 ;i < image_width ;i ++ ){
@@ -97,17 +159,16 @@ public:
         //     }
         // }
         std::chrono::high_resolution_clock::time_point t2 = std::chrono::high_resolution_clock::now();
-        std::chrono::duration<double> time_span = std::chrono::duration_cast<std::chrono::milliseconds>(t2 - t1);
-        std::cerr << "render time: " << time_span.count() << "ms\n";
+        render_ms = std::chrono::duration<double, std::milli>(t2 - t1).count();
+        if(verbose) std::cerr << "render time: " << render_ms << "ms\n";
         #endif
-        for(int j = 0;j<image_height;j++){
-            for(int i =0 ;i < image_width ;i ++ ){
-                write_color(std::cout, colorBuffer[j * image_width + i]);
-            }
-        }
-        std::clog << "\rDone.                     \n";
+        if(verbose) texture_cache::report(std::cerr);
+        #ifdef RTW_STATS
+        if(verbose) stats::Report(std::cerr, render_stats);
+        #endif
+        if(image_out && !streaming) write_image(*image_out, output_format, image_width, image_height, colorBuffer.data());
+        if(verbose) std::clog << "\rDone.                     \n";
     }
-private:
     int image_height;
     Point3 center;
     Point3 pixel00_loc;
@@ -118,18 +179,126 @@ private:
     vec3 defocus_disk_u;
     vec3 defocus_disk_v;
     int sqrt_spp;
-    double recip_sqrt_spp;
-    std::vector<color> colorBuffer;
+    shared_ptr<const Sampler> sampler_prototype;   // 每个像素复制一份，采样器带着当前样本的状态
+    double pixel_spread = 0;
+    std::vector<color, FirstTouchAllocator<color>> colorBuffer;  // 每个像素都会被写一次，不预先清零，由渲染线程首次写入
     std::vector<std::vector<std::pair<int, int>>> rtvToPixel;
-    int* belongRTV;
-    void initialize(){
+    std::vector<int> belongRTV;
+    const RGBColorSpace* colorSpace = nullptr;
+    uint64_t rays_traced = 0;
+    double render_ms = 0;
+    stats::Totals render_stats;
+    // 条带按 stream_rows 切分，两块缓冲轮流使用：渲染完一条就交给线程池异步写出，同时渲染下一条。
+    // 写出任务按顺序串起来（启动下一个写出前等上一个做完），所以某块缓冲被重新渲染时它的写出一定已经结束。
+    // pfm 的扫描线从下往上存，条带也从图像底部开始渲染。
+    template<typename RenderRows>
+    void render_streaming(RenderRows& render_rows){
+        write_image_header(*image_out, output_format, image_width, image_height);
+        int n_bands = (image_height + stream_rows - 1) / stream_rows;
+        bool bottom_up = output_format == image_format::pfm;
+        std::vector<color> buffers[2];
+        shared_ptr<AsyncJob<void>> pending;
+        for(int b = 0; b < n_bands; b++){
+            int band = bottom_up ? n_bands - 1 - b : b;
+            int y0 = band * stream_rows, y1 = std::min(image_height, y0 + stream_rows);
+            std::vector<color>& rows = buffers[b % 2];
+            rows.resize(size_t(image_width) * (y1 - y0));
+            render_rows(y0, y1, rows.data());
+            if(pending) pending->Wait();
+            pending = RunAsync([this, &rows, count = y1 - y0]{
+                write_image_rows(*image_out, output_format, image_width, rows.data(), count);
+            });
+        }
+        if(pending) pending->Wait();
+        image_out->flush();
+    }
+    // 分轮渲染：每轮给每个像素再加 sqrt_spp 个样本，累加和与样本数留在内存里，
+    // 两轮之间距上次写出超过 checkpoint_seconds 就复制一份交给线程池异步写出，渲完再同步写一次。
+    // 每个像素的样本按序号依次加到同一个和上，所以分几轮、从哪一轮续渲都与 render_pixel 一次渲完逐位一致。
+    // 返回本次实际渲染的样本数
+    template<typename RenderBand>
+    uint64_t render_checkpointed(RenderBand& render_band, const hittable& world, const hittable* lights){
+        render_checkpoint progress;
+        progress.width = image_width;
+        progress.height = image_height;
+        progress.spp = samples_per_pixel;
+        progress.sampler = uint8_t(sampler);
+        progress.depth = max_depth;
+        progress.seed = seed;
+        progress.spectral = spectral;
+        progress.scene = scene_key;
+        progress.view = {lookfrom.x(), lookfrom.y(), lookfrom.z(), lookat.x(), lookat.y(), lookat.z(),
+                         vup.x(), vup.y(), vup.z(), vfov, aspect_ratio, defocus_angle, focus_dist};
+        size_t n = size_t(image_width) * image_height;
+        std::optional<render_checkpoint> saved = resume ? read_checkpoint(checkpoint_file) : std::nullopt;
+        if(resume && !saved) std::cerr << "cannot read checkpoint '" << checkpoint_file << "', starting from scratch\n";
+        else if(saved && !saved->same_settings(progress)){
+            std::cerr << "checkpoint '" << checkpoint_file << "' was made with different settings, starting from scratch\n";
+            saved.reset();
+        }
+        uint64_t done = 0;
+        if(saved){
+            progress.sum = std::move(saved->sum);
+            progress.count = std::move(saved->count);
+            for(uint32_t c : progress.count) done += std::min<uint32_t>(c, progress.spp);
+            if(verbose) std::cerr << "resuming at " << done / n << " of " << progress.spp << " samples per pixel\n";
+        }
+        else{
+            progress.sum.assign(n, color(0, 0, 0));
+            progress.count.assign(n, 0);
+        }
+
+        uint32_t lowest = *std::min_element(progress.count.begin(), progress.count.end());
+        int passes = lowest >= uint32_t(progress.spp) ? 0 : (progress.spp - lowest + sqrt_spp - 1) / sqrt_spp;
+        shared_ptr<AsyncJob<bool>> pending;
+        auto finish_pending = [&]{
+            if(pending && !pending->GetResult()) std::cerr << "cannot write checkpoint '" << checkpoint_file << "'\n";
+            pending.reset();
+        };
+        auto last_write = std::chrono::steady_clock::now();
+        for(int pass = 0; pass < passes; pass++){
+            render_band(0, image_height, [&](Point2i p){
+                size_t index = size_t(p.y) * image_width + p.x;
+                uint32_t begin = progress.count[index], end = std::min<uint32_t>(progress.spp, begin + sqrt_spp);
+                if(begin >= end) return;
+                accumulate_pixel(p.x, p.y, begin, end, progress.sum[index], world, lights);
+                progress.count[index] = end;
+            });
+            if(pass + 1 < passes &&
+               std::chrono::duration<double>(std::chrono::steady_clock::now() - last_write).count() >= checkpoint_seconds){
+                finish_pending();
+                pending = RunAsync([this, snapshot = progress]{ return write_checkpoint(checkpoint_file, snapshot); });
+                last_write = std::chrono::steady_clock::now();
+            }
+        }
+        finish_pending();
+        if(passes > 0 && !write_checkpoint(checkpoint_file, progress)) std::cerr << "cannot write checkpoint '" << checkpoint_file << "'\n";
+        ParallelFor(0, int64_t(n), [&](int64_t i){ colorBuffer[i] = resolve_pixel(progress.sum[i]); });
+        return uint64_t(n) * progress.spp - done;
+    }
+    // 让每个 tile 大约耗时 tile_target_ms，同时保证每个线程平均至少分到 16 个 tile，最后一批 tile 拖尾不会太长
+    int tile_size(int pixels) const{
+        constexpr double tile_target_ms = 4;
+        if(sample_cost_ns <= 0) return 0;
+        double pixel_ns = sample_cost_ns * samples_per_pixel;
+        double by_cost = std::sqrt(tile_target_ms * 1e6 / pixel_ns);
+        double by_balance = std::sqrt(pixels / (16.0 * RunningThreads()));
+        return std::clamp(int(std::min(by_cost, by_balance)), 1, 64);
+    }
+    static uint64_t& thread_ray_count(){
+        static thread_local uint64_t count = 0;
+        return count;
+    }
+    // full_frame 为 false 时只计算相机参数，不分配帧缓冲
+    void initialize(bool full_frame = true){
         image_height = static_cast<int>(image_width / aspect_ratio);
         image_height = (image_height < 1 ) ? 1 : image_height;
-        std::cerr << image_width << " " << image_height << "\n";
+        if(verbose && full_frame) std::cerr << image_width << " " << image_height << "\n";
         center = lookfrom;
         pixel_sample_scale = 1.0 / samples_per_pixel;
-        sqrt_spp = static_cast<int>(std::sqrt(samples_per_pixel));
-        recip_sqrt_spp = 1.0 / (sqrt_spp * sqrt_spp);
+        sqrt_spp = std::max(1, static_cast<int>(std::sqrt(samples_per_pixel)));
+        sampler_prototype = CreateSampler(sampler, samples_per_pixel, seed);
+        if(sampler == sampler_type::blue_noise) BlueNoiseSampler::Mask();   // 掩码第一次使用时生成，放在计时之外
         //viewpoer
         
         double theta = degrees_to_radians(vfov);
@@ -152,46 +321,173 @@ private:
         double defocus_radius = focus_dist * std::tan(degrees_to_radians(defocus_angle/2.0));
         defocus_disk_u = defocus_radius * u;
         defocus_disk_v = defocus_radius * v;
+        // 一个像素对应的张角；每个像素有多条光线时各自只负责像素的一部分，与 pbrt 一样按 1/sqrt(spp) 缩小，但不小于 1/8
+        pixel_spread = ray_cones ? pixel_delta_v.length() / focus_dist * std::max(0.125, 1.0 / sqrt_spp) : 0;
         
-        colorBuffer.resize(image_width * image_height);
-        rtvToPixel.resize(5);
-        belongRTV = new int[image_width * image_height]{0};
-        setMask(rtvToPixel, image_width, image_height, belongRTV);
-        
+        if(!full_frame || (stream_rows > 0 && image_out)){
+            // 流式输出或分块渲染时不需要整幅图像，释放上一次渲染留下的缓冲
+            colorBuffer.clear();
+            colorBuffer.shrink_to_fit();
+        }
+        else{
+            colorBuffer.resize(image_width * image_height);
+        }
+        #ifdef USE_VRS
+        if(full_frame){
+            rtvToPixel.assign(5, {});
+            belongRTV.assign(image_width * image_height, 0);
+            setMask(rtvToPixel, image_width, image_height, belongRTV.data());
+        }
+        #endif
+
+        if(spectral){
+            // 系数表第一次使用时才拟合，放在计时之外
+            std::chrono::high_resolution_clock::time_point t1 = std::chrono::high_resolution_clock::now();
+            RGBColorSpace::Init();
+            colorSpace = RGBColorSpace::sRGB;
+            colorSpace->ToRGBCoeffs(RGB(0.5f, 0.25f, 0.125f));
+            std::chrono::high_resolution_clock::time_point t2 = std::chrono::high_resolution_clock::now();
+            if(verbose) std::cerr << "rgb to spectrum table: " << std::chrono::duration<double, std::milli>(t2 - t1).count() << "ms\n";
+        }
+    }
+    color render_pixel(int i, int j, const hittable& world, const hittable* lights) const{
+        color sum(0,0,0);
+        accumulate_pixel(i, j, 0, samples_per_pixel, sum, world, lights);
+        return resolve_pixel(sum);
+    }
+    // 把像素 (i, j) 的第 [begin, end) 个样本依次加到 sum 上（光谱渲染时加的是 XYZ）。
+    // 每个样本开始时把采样器定位到 (像素, s)，路径上所有的 random_double 都从它取
+    void accumulate_pixel(int i, int j, uint32_t begin, uint32_t end, color& sum, const hittable& world, const hittable* lights) const{
+        std::unique_ptr<Sampler> pixel_sampler = sampler_prototype->Clone();
+        Sampler* previous = std::exchange(active_sampler(), pixel_sampler.get());
+        for(uint32_t s = begin; s < end; s++){
+            pixel_sampler->StartPixelSample(i, j, s);
+            Ray r = get_ray(i, j, *pixel_sampler);
+            if(spectral)
+            {
+                SampledWavelengths lambda = SampledWavelengths::SampleUniform(random_double());
+                XYZ xyz = ray_color_spectral(r, max_depth, world, lights, lambda).ToXYZ(lambda);
+                sum += color(xyz.X, xyz.Y, xyz.Z);
+            }
+            else
+            {
+                sum += ray_color(r,max_depth, world, lights);
+            }
+        }
+        active_sampler() = previous;
     }
-    color ray_color(const Ray& r,int depth,const hittable& world, const hittable& lights) const{
+    color resolve_pixel(const color& sum) const{
+        if(spectral)
+        {
+            RGB rgb = colorSpace->ToRGB(XYZ(float(sum.x()), float(sum.y()), float(sum.z())));
+            return color(rgb.r, rgb.g, rgb.b) * pixel_sample_scale;
+        }
+        return sum * pixel_sample_scale;
+    }
+    color ray_color(const Ray& r,int depth,const hittable& world, const hittable* lights) const{
         if(depth <= 0 ){
             return color(0,0,0);
         }
         hit_record rec;
+        ++thread_ray_count();
         if(!world.hit(r,interval(0.001,infinity),rec)){ return background; }
         
         color attenuation;
         Ray scattered;
-        double pdf_value;
+        double pdf_value = 0;
         color color_from_emission = rec.mat->emitted(r, rec, rec.u, rec.v, rec.p);
-        if(!rec.mat->scatter(r,rec,attenuation,scattered, pdf_value)){
+        if(!scatter(r,rec,attenuation,scattered, pdf_value)){
             return color_from_emission;
         }
-        hittable_pdf light_pdf(lights, rec.p);
-        scattered = Ray(rec.p, light_pdf.generate(), r.time());
-        pdf_value = light_pdf.value(scattered.direction());
+        // pdf 为 0 表示镜面反射/折射，方向是确定的，只能沿材质给出的方向继续
+        if(pdf_value <= 0){
+            return color_from_emission + attenuation * ray_color(scattered,depth-1,world, lights);
+        }
+        if(lights){
+            hittable_pdf light_pdf(*lights, rec.p);
+            material_pdf surface_pdf(r, rec, scattered);
+            mixture_pdf mix(light_pdf, surface_pdf);
+            scattered = Ray(rec.p, mix.generate(), r.time());
+            pdf_value = mix.value(scattered.direction());
+        }
+        // 漫反射方向上足迹的真实大小难以估计，保守地沿用入射光锥，只会少做滤波
+        if(r.cone_width() > 0 || r.cone_spread() > 0) scattered.set_cone(r.cone_width_at(rec.t), r.cone_spread());
         double scatter_pdf = rec.mat->scattering_pdf(r, rec, scattered);
         color color_from_scatter = (scatter_pdf * attenuation * ray_color(scattered,depth-1,world, lights)) / pdf_value;
         return color_from_emission + color_from_scatter;
     }
-    vec3 sample_square() const {
-        return vec3(random_double()-0.5,random_double()-0.5,0.0);
-    }
+    SampledSpectrum ray_color_spectral(const Ray& r, int depth, const hittable& world, const hittable* lights,
+                                       const SampledWavelengths& lambda) const{
+        if(depth <= 0){
+            return SampledSpectrum(0.f);
+        }
+        hit_record rec;
+        ++thread_ray_count();
+        if(!world.hit(r,interval(0.001,infinity),rec)){ return illuminant_spectrum(background, lambda); }
 
-    vec3 sample_square_stratified(int s_i, int s_j) const{
-        auto px = ((s_i + random_double()) * recip_sqrt_spp) - 0.5;
-        auto py = ((s_j + random_double()) * recip_sqrt_spp) - 0.5;
-        return vec3(px, py, 0.0); 
+        color attenuation;
+        Ray scattered;
+        double pdf_value = 0;
+        SampledSpectrum spectrum_from_emission = illuminant_spectrum(rec.mat->emitted(r, rec, rec.u, rec.v, rec.p), lambda);
+        if(!scatter(r,rec,attenuation,scattered, pdf_value)){
+            return spectrum_from_emission;
+        }
+        SampledSpectrum albedo = albedo_spectrum(attenuation, lambda);
+        if(pdf_value <= 0){
+            return spectrum_from_emission + albedo * ray_color_spectral(scattered, depth-1, world, lights, lambda);
+        }
+        if(lights){
+            hittable_pdf light_pdf(*lights, rec.p);
+            material_pdf surface_pdf(r, rec, scattered);
+            mixture_pdf mix(light_pdf, surface_pdf);
+            scattered = Ray(rec.p, mix.generate(), r.time());
+            pdf_value = mix.value(scattered.direction());
+        }
+        // 漫反射方向上足迹的真实大小难以估计，保守地沿用入射光锥，只会少做滤波
+        if(r.cone_width() > 0 || r.cone_spread() > 0) scattered.set_cone(r.cone_width_at(rec.t), r.cone_spread());
+        double scatter_pdf = rec.mat->scattering_pdf(r, rec, scattered);
+        return spectrum_from_emission +
+               albedo * float(scatter_pdf / pdf_value) * ray_color_spectral(scattered, depth-1, world, lights, lambda);
     }
-
-    Ray get_ray(int i,int j, int s_i, int s_j) const {
-        vec3 offset=sample_square_stratified(s_i, s_j);
+    // 材质自己的采样分布：scatter 已经按它抽好了一个方向，generate 直接返回这个方向，
+    // value 用 scattering_pdf（漫反射类材质按散射分布采样，两者相同）
+    class material_pdf : public pdf{
+    public:
+        material_pdf(const Ray& r_in, const hit_record& rec, const Ray& scattered)
+            : r_in(r_in), rec(rec), scattered(scattered){}
+        double value(const vec3& direction) const override{
+            return rec.mat->scattering_pdf(r_in, rec, Ray(rec.p, direction, r_in.time()));
+        }
+        vec3 generate() const override{
+            return scattered.direction();
+        }
+    private:
+        const Ray& r_in;
+        const hit_record& rec;
+        Ray scattered;
+    };
+    bool scatter(const Ray& r, const hit_record& rec, color& attenuation, Ray& scattered, double& pdf) const{
+        RTW_STAT_TIMER(Scatter);
+        RTW_STAT_COUNT(MaterialScatters);
+        return rec.mat->scatter(r, rec, attenuation, scattered, pdf);
+    }
+    // 材质的 RGB 反射率按 sigmoid 多项式上采样成光谱
+    SampledSpectrum albedo_spectrum(const color& c, const SampledWavelengths& lambda) const{
+        RGB rgb(std::clamp(float(c.x()), 0.f, 1.f), std::clamp(float(c.y()), 0.f, 1.f), std::clamp(float(c.z()), 0.f, 1.f));
+        return RGBAlbedoSpectrum(*colorSpace, rgb).Sample(lambda);
+    }
+    // 发光体和背景乘上颜色空间的光源光谱
+    SampledSpectrum illuminant_spectrum(const color& c, const SampledWavelengths& lambda) const{
+        if(c.x() <= 0 && c.y() <= 0 && c.z() <= 0){
+            return SampledSpectrum(0.f);
+        }
+        RGB rgb(std::max(float(c.x()), 0.f), std::max(float(c.y()), 0.f), std::max(float(c.z()), 0.f));
+        return RGBIlluminantSpectrum(*colorSpace, rgb).Sample(lambda);
+    }
+    // 像素内的位置取采样器的像素维度，之后依次是镜头（有景深时）和时间
+    Ray get_ray(int i,int j, Sampler& pixel_sampler) const {
+        auto [sx, sy] = pixel_sampler.GetPixel2D();
+        vec3 offset(sx - 0.5, sy - 0.5, 0.0);
         vec3 pixel_sample=pixel00_loc + 
                           ((i+ offset.x()) * pixel_delta_u)+
                           ((j+ offset.y()) * pixel_delta_v);
@@ -199,7 +495,9 @@ private:
         vec3 direction = pixel_sample - ray_origin;
         direction = unit_vector(direction);
         double ray_time = random_double();
-        return Ray(ray_origin,direction,ray_time);
+        Ray r(ray_origin,direction,ray_time);
+        r.set_cone(0, pixel_spread);
+        return r;
     }
     Point3 defocus_disk_sample() const {
         vec3 p = random_in_unit_disk();
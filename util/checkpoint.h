@@ -0,0 +1,94 @@
+#ifndef CHECKPOINT_H
+#define CHECKPOINT_H
+#include "rtweekend.h"
+#include "color.h"
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <optional>
+#include <string>
+#include <vector>
+
+// 渲染进度的快照：每个像素已经累加的样本和（double，续渲后逐位一致）和已经完成的样本数。
+// 随机数按 (seed, 像素, 样本序号) 定位，样本数就是随机数状态，不需要另外保存。
+// 文件格式（小端）：8 字节 magic，宽、高、spp、深度、种子、是否光谱、采样器、场景 key、视角（13 个 double），
+// 然后是每个像素 3 个 double 和 1 个 uint32。
+struct render_checkpoint{
+    int32_t width = 0, height = 0, spp = 0, depth = 0;
+    uint32_t seed = 0;
+    uint8_t spectral = 0;
+    uint8_t sampler = 0;
+    uint64_t scene = 0;                 // 场景来源的哈希，见 scene_source_hash
+    std::array<double, 13> view{};      // lookfrom、lookat、vup、vfov、宽高比、光圈角和对焦距离
+    std::vector<color> sum;
+    std::vector<uint32_t> count;
+
+    // 同一个场景、同一个视角、参数一致时才能接着渲
+    bool same_settings(const render_checkpoint& o) const{
+        return width == o.width && height == o.height && spp == o.spp && depth == o.depth &&
+               seed == o.seed && spectral == o.spectral && sampler == o.sampler &&
+               scene == o.scene && view == o.view;
+    }
+};
+
+inline constexpr char checkpoint_magic[8] = {'R', 'T', 'W', 'C', 'K', 'P', 'T', '3'};
+
+// 先写到 path.tmp 再改名，写到一半被杀掉时旧的检查点还在
+inline bool write_checkpoint(const std::string& path, const render_checkpoint& c){
+    std::string tmp = path + ".tmp";
+    {
+        std::ofstream out(tmp, std::ios::binary);
+        if(!out) return false;
+        out.write(checkpoint_magic, sizeof(checkpoint_magic));
+        out.write((const char*)&c.width, sizeof(c.width));
+        out.write((const char*)&c.height, sizeof(c.height));
+        out.write((const char*)&c.spp, sizeof(c.spp));
+        out.write((const char*)&c.depth, sizeof(c.depth));
+        out.write((const char*)&c.seed, sizeof(c.seed));
+        out.write((const char*)&c.spectral, sizeof(c.spectral));
+        out.write((const char*)&c.sampler, sizeof(c.sampler));
+        out.write((const char*)&c.scene, sizeof(c.scene));
+        out.write((const char*)c.view.data(), sizeof(c.view));
+        std::vector<double> sums(c.sum.size() * 3);
+        for(size_t i = 0; i < c.sum.size(); i++){
+            for(int k = 0; k < 3; k++) sums[i * 3 + k] = c.sum[i][k];
+        }
+        out.write((const char*)sums.data(), sums.size() * sizeof(double));
+        out.write((const char*)c.count.data(), c.count.size() * sizeof(uint32_t));
+        out.close();
+        if(out.fail()) return false;
+    }
+    std::error_code ec;
+    std::filesystem::rename(tmp, path, ec);
+    return !ec;
+}
+
+inline std::optional<render_checkpoint> read_checkpoint(const std::string& path){
+    std::ifstream in(path, std::ios::binary);
+    if(!in) return std::nullopt;
+    char magic[sizeof(checkpoint_magic)];
+    render_checkpoint c;
+    in.read(magic, sizeof(magic));
+    in.read((char*)&c.width, sizeof(c.width));
+    in.read((char*)&c.height, sizeof(c.height));
+    in.read((char*)&c.spp, sizeof(c.spp));
+    in.read((char*)&c.depth, sizeof(c.depth));
+    in.read((char*)&c.seed, sizeof(c.seed));
+    in.read((char*)&c.spectral, sizeof(c.spectral));
+    in.read((char*)&c.sampler, sizeof(c.sampler));
+    in.read((char*)&c.scene, sizeof(c.scene));
+    in.read((char*)c.view.data(), sizeof(c.view));
+    if(!in || std::memcmp(magic, checkpoint_magic, sizeof(magic)) != 0 || c.width <= 0 || c.height <= 0) return std::nullopt;
+    size_t n = size_t(c.width) * c.height;
+    std::vector<double> sums(n * 3);
+    c.count.resize(n);
+    in.read((char*)sums.data(), sums.size() * sizeof(double));
+    in.read((char*)c.count.data(), c.count.size() * sizeof(uint32_t));
+    if(!in) return std::nullopt;
+    c.sum.resize(n);
+    for(size_t i = 0; i < n; i++) c.sum[i] = color(sums[i * 3], sums[i * 3 + 1], sums[i * 3 + 2]);
+    return c;
+}
+#endif
@@ -12,30 +12,29 @@ XYZ XYZ::FromxyY(Point2f xy, float Y)
 
 RGBSigmoidPolynomial RGBToSpectrumTable::operator()(RGB rgb) const
 {
-    if(rgb[0] < 0.f && rgb[1] < 0.f && rgb[2] < 0.f && rgb[0] > 1.f && rgb[1] > 1.f && rgb[2] > 1.f)
-    {
-        CHECK_EQ(1, 2);
-    }
+    CHECK_GE(std::min({rgb[0], rgb[1], rgb[2]}), 0.f);
+    CHECK_LE(std::max({rgb[0], rgb[1], rgb[2]}), 1.f);
     if(rgb[0] == rgb[1] && rgb[1] == rgb[2])
     {
         return RGBSigmoidPolynomial(0, 0, (rgb[0] - .5f) / std::sqrt(rgb[0] * (1 - rgb[0])));
     }
+    // 最大分量决定用哪张表，另外两个分量按最大分量归一化后作为表内坐标
     int maxc = 
         (rgb[0] > rgb[1]) ? (rgb[0] > rgb[2] ? 0 : 2) : (rgb[1] > rgb[2] ? 1 : 2);
-    int z = rgb[maxc];
-    int x = rgb[(maxc + 1) % 3] * (res - 1) / z;
-    int y = rgb[(maxc + 2) % 3] * (res - 1) / z;
+    float z = rgb[maxc];
+    float x = rgb[(maxc + 1) % 3] * (res - 1) / z;
+    float y = rgb[(maxc + 2) % 3] * (res - 1) / z;
     int xi = std::min((int)x, res - 2), yi = std::min((int)y, res - 2);
-    int zi = FindInterval(res, [&](int i){ return zNodes[i] < z; });
+    int zi = std::min<int>(FindInterval(res, [&](int i){ return zNodes[i] < z; }), res - 2);
 
-    int dx = x - xi, dy = y - yi, dz = (z - zNodes[zi]) / (zNodes[zi + 1] - zNodes[zi]);
+    float dx = x - xi, dy = y - yi, dz = (z - zNodes[zi]) / (zNodes[zi + 1] - zNodes[zi]);
 
     std::array<float ,3> c;
     for(int i = 0; i < 3; ++i)
     {
         auto co = [&](int dx, int dy, int dz) -> float
         {
-            return (*coeffs)[maxc][xi + dx][yi + dy][zi + dz][i];
+            return (*coeffs)[maxc][zi + dz][yi + dy][xi + dx][i];
         };
 
         c[i] = Lerp(dz,
@@ -2,6 +2,7 @@
 #define COLOR_H
 #include "rtweekend.h"
 #include "vecmath.h"
+#include "simd.h"
 using color=vec3;
 
 inline double linear_to_gamma(double linear_component){
@@ -10,6 +11,10 @@ inline double linear_to_gamma(double linear_component){
     }
     return 0;
 }
+// 线性 sRGB 的亮度 Y
+inline double luminance(const color& c){
+    return 0.2126 * c.x() + 0.7152 * c.y() + 0.0722 * c.z();
+}
 inline void write_color(std::ostream& out, const color& pixel_color){
     auto r=pixel_color.x();
     auto g=pixel_color.y();
@@ -278,7 +283,21 @@ public:
 
     float operator()(float lambda) const
     {
-        return s(EvaluatePolynomial(lambda, c0, c1, c2));
+        return s(EvaluatePolynomial(lambda, c2, c1, c0));
+    }
+
+    // 一次计算 4 个波长
+    void Evaluate4(const float* lambda, float* out) const
+    {
+        if(!std::isfinite(c2))
+        {
+            for(int i = 0; i < 4; ++i) out[i] = (*this)(lambda[i]);
+            return;
+        }
+        float4 l = float4::load(lambda);
+        float4 x = (float4(c0) * l + float4(c1)) * l + float4(c2);
+        float4 one(1.f), half(0.5f);
+        (half + x / (float4(2.f) * sqrt(one + x * x))).store(out);
     }
 
     float MaxValue() const
@@ -309,6 +328,8 @@ class RGBToSpectrumTable
 public:
     static constexpr int res = 64;
     using CoefficientArray = float[3][res][res][res][3];
+    RGBToSpectrumTable(const float* zNodes, const CoefficientArray* coeffs)
+     : zNodes(zNodes), coeffs(coeffs) {}
     RGBSigmoidPolynomial operator()(RGB rgb) const;
 private:
     const float* zNodes;
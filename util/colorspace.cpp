@@ -1,4 +1,6 @@
 #include "colorspace.h"
+#include "rgb2spec.h"
+#include <filesystem>
 
 const RGBColorSpace* RGBColorSpace::sRGB;
 const RGBColorSpace* RGBColorSpace::DCI_P3;
@@ -7,10 +9,11 @@ const RGBColorSpace* RGBColorSpace::ACES2065_1;
 
 RGBColorSpace::RGBColorSpace(
     Point2f r, Point2f g, Point2f b,
-    Spectrum illuminant, const RGBToSpectrumTable* rgbToSpectrumTable
+    Spectrum illuminant, const RGBToSpectrumTable* rgbToSpectrumTable, std::string name
 )
- : r(r), g(g), b(b), rgbToSpectrumTable(rgbToSpectrumTable)
+ : r(r), g(g), b(b), name(std::move(name)), illuminant(illuminant), rgbToSpectrumTable(rgbToSpectrumTable)
 {
+    Spectra::Init();
     XYZ W = SpectrumToXYZ(illuminant); //illuminant XYZ
     w = W.xy();
     XYZ R = XYZ::FromxyY(r), G = XYZ::FromxyY(g), B = XYZ::FromxyY(b);
@@ -23,6 +26,66 @@ RGBColorSpace::RGBColorSpace(
     RGBFromXYZ = InvertOrExit(XYZFromRGB);
 }
 
+RGBColorSpace::~RGBColorSpace() = default;
+
+void RGBColorSpace::Init()
+{
+    static std::once_flag once;
+    std::call_once(once, []
+    {
+        Spectra::Init();
+        Spectrum D65 = GetNamedSpectrum("stdillum-D65");
+        sRGB = new RGBColorSpace(Point2f(.64, .33), Point2f(.3, .6), Point2f(.15, .06), D65, nullptr, "srgb");
+        DCI_P3 = new RGBColorSpace(Point2f(.68, .32), Point2f(.265, .690), Point2f(.15, .06), D65, nullptr, "dci-p3");
+        Rec2020 = new RGBColorSpace(Point2f(.708, .292), Point2f(.170, .797), Point2f(.131, .046), D65, nullptr, "rec2020");
+        // ACES 的白点是 D60，这里没有 D60 的实测表，用 6000K 黑体近似
+        ACES2065_1 = new RGBColorSpace(Point2f(.7347, .2653), Point2f(0., 1.), Point2f(.0001, -.077),
+                                       new BlackBodySpectrum(6000.f), nullptr, "aces2065-1");
+    });
+}
+
+const RGBToSpectrumTable* RGBColorSpace::Table() const
+{
+    std::call_once(tableOnce, [this]
+    {
+        if(rgbToSpectrumTable) return;
+        auto bind = [this](const shared_ptr<RGBToSpectrumTableFile>& file)
+        {
+            const float* zNodes;
+            const RGBToSpectrumTable::CoefficientArray* coeffs;
+            if(!file || !file->Find(name, RGBFromXYZ, &zNodes, &coeffs)) return false;
+            tableFile = file;
+            ownedTable = std::make_unique<RGBToSpectrumTable>(zNodes, coeffs);
+            rgbToSpectrumTable = ownedTable.get();
+            return true;
+        };
+        // 1. rgb2spec_opt 生成的共享文件，所有颜色空间共用一次映射
+        static shared_ptr<RGBToSpectrumTableFile> shared = RGBToSpectrumTableFile::Open(RGBToSpectrumTableFile::DefaultPath());
+        if(bind(shared)) return;
+        // 2. 之前现场拟合后留下的单独缓存（没有名字的颜色空间和没有配置缓存目录时不缓存）
+        std::string cache = name.empty() ? std::string() : RGBToSpectrumTableFile::CachePath(name);
+        if(!cache.empty() && bind(RGBToSpectrumTableFile::Open(cache))) return;
+        // 3. 现场拟合，写出缓存后映射回来；写不出去就直接用内存里的结果
+        std::cerr << "fitting rgb to spectrum table for color space '" << name << "'\n";
+        ownedTableData = ComputeRGBToSpectrumTable(XYZFromRGB, RGBFromXYZ, &illuminant);
+        if(!cache.empty())
+        {
+            std::error_code ec;
+            std::filesystem::create_directories(std::filesystem::path(cache).parent_path(), ec);
+            RGBToSpectrumTableEntry entry{name, RGBFromXYZ, ownedTableData->zNodes.data(), ownedTableData->coeffs.data()};
+            if(WriteRGBToSpectrumTables(cache, std::span(&entry, 1)) && bind(RGBToSpectrumTableFile::Open(cache)))
+            {
+                ownedTableData.reset();
+                return;
+            }
+        }
+        ownedTable = std::make_unique<RGBToSpectrumTable>(ownedTableData->zNodes.data(),
+                                                          ownedTableData->Coefficients());
+        rgbToSpectrumTable = ownedTable.get();
+    });
+    return rgbToSpectrumTable;
+}
+
 SquareMatrix<3> ConvertRGBColorSpace(const RGBColorSpace& from, const RGBColorSpace& to)
 {
     if(from == to) return {};
@@ -61,10 +124,10 @@ const RGBColorSpace* RGBColorSpace::Lookup(Point2f r, Point2f g, Point2f b, Poin
 
 RGBSigmoidPolynomial RGBColorSpace::ToRGBCoeffs(RGB rgb) const
 {
-    return (*rgbToSpectrumTable)(rgb);
+    return (*Table())(rgb);
 }
 
 std::string RGBColorSpace::ToString() const
 {
-    return std::format("[ RGBColorSpace r: {} g: {} b: {} w: {} illuminant: {} RGBToXYZ: {} XYZToRGB: {} ]", r.ToString(), g.ToString(), b.ToString(), w.ToString(), illuminant.ToString(), XYZFromRGB.ToString(), RGBFromXYZ.ToString());
+    return std::format("[ RGBColorSpace name: {} r: {} g: {} b: {} w: {} illuminant: {} RGBToXYZ: {} XYZToRGB: {} ]", name, r.ToString(), g.ToString(), b.ToString(), w.ToString(), illuminant.ToString(), XYZFromRGB.ToString(), RGBFromXYZ.ToString());
 }
\ No newline at end of file
@@ -4,14 +4,28 @@
 #include "spectrum.h"
 #include "vecmath.h"
 #include "color.h"
+#include <mutex>
+struct RGBToSpectrumTableData;
+class RGBToSpectrumTableFile;
+
 class RGBColorSpace
 {
 public:
+    // rgbToSpectrumTable 为空时，第一次用到时才按 name 从 .rtwspec 文件中取出系数表，
+    // 文件里没有时再现场拟合
     RGBColorSpace(Point2f r, Point2f g, Point2f b, 
-                  Spectrum illumiant, const RGBToSpectrumTable* rgbToSpectrumTable);
+                  Spectrum illumiant, const RGBToSpectrumTable* rgbToSpectrumTable = nullptr,
+                  std::string name = "");
+    ~RGBColorSpace();
+    RGBColorSpace(const RGBColorSpace&) = delete;
+    RGBColorSpace& operator=(const RGBColorSpace&) = delete;
+
+    // 创建 sRGB、DCI-P3、Rec2020 和 ACES2065-1，使用这几个静态指针前必须调用
+    static void Init();
 
     RGBSigmoidPolynomial ToRGBCoeffs(RGB rgb) const;
     Point2f r, g, b, w;
+    std::string name;
     DenselySampledSpectrum illuminant;
     SquareMatrix<3> XYZFromRGB, RGBFromXYZ;
     static const RGBColorSpace *sRGB, *DCI_P3, *Rec2020, *ACES2065_1;
@@ -36,7 +50,13 @@ public:
     static const RGBColorSpace *GetName(std::string n);
     static const RGBColorSpace *Lookup(Point2f r, Point2f g, Point2f b, Point2f w);
 private:
-    const RGBToSpectrumTable *rgbToSpectrumTable;
+    const RGBToSpectrumTable* Table() const;
+
+    mutable const RGBToSpectrumTable *rgbToSpectrumTable;
+    mutable std::once_flag tableOnce;
+    mutable shared_ptr<RGBToSpectrumTableFile> tableFile;
+    mutable std::unique_ptr<RGBToSpectrumTableData> ownedTableData;
+    mutable std::unique_ptr<RGBToSpectrumTable> ownedTable;
 };
 
 SquareMatrix<3> ConvertRGBColorSpace(const RGBColorSpace& from, const RGBColorSpace& to);
@@ -37,10 +37,12 @@ public:
         rec.normal = vec3(1,0,0);// arbitrary 直接设定
         rec.front_face = true;// arbitrary 直接设定
         rec.mat = phase_fuction;
+        rec.dpdu = rec.dpdv = rec.curvature = 0;
         return true;
     }
     aabb bounding_box() const override { return boundary -> bounding_box(); }
 private:
+    friend class scene_cache;
     shared_ptr<hittable> boundary;
     double neg_inv_density;
     shared_ptr<material> phase_fuction;
@@ -0,0 +1,529 @@
+#ifndef DISTRIBUTED_H
+#define DISTRIBUTED_H
+// 只支持 POSIX（socket、poll、fork/execv），Windows 上整个头文件为空，main 拒绝分布式渲染的选项
+#ifndef _WIN32
+#include "rtweekend.h"
+#include "scene.h"
+#include "parallel.h"
+#include <arpa/inet.h>
+#include <sys/time.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <chrono>
+#include <cstring>
+#include <deque>
+#include <functional>
+#include <map>
+#include <memory>
+#include <optional>
+#include <string>
+#include <thread>
+#include <vector>
+
+// 多进程 / 多机分块渲染。coordinator 监听一个 TCP 端口，worker 进程连上来后：
+//   coordinator -> worker  frame  要渲染的场景和相机参数，worker 构建（或复用）场景后回 ready（或 error）
+//   coordinator -> worker  tile   一个 Bounds2i，worker 用 ParallelFor2D 渲染后回 result，附带 float RGB 像素
+//   coordinator -> worker  bye    worker 退出
+// 每个 worker 同时有两个 tile 在途，网络传输和渲染重叠。worker 断开时它手上的 tile 重新排队，新 worker 可以随时加入。
+// 相机的随机数按 (seed, 像素, 样本序号) 定位，结果与 worker 的个数、线程数和 tile 的分配都无关。
+// 消息是 [u32 类型][u32 长度][内容]，数值按本机字节序直接拷贝，要求所有机器都是小端。
+namespace farm{
+
+enum class message : uint32_t{
+    hello = 1,
+    frame,
+    ready,
+    error,
+    tile,
+    result,
+    bye
+};
+
+struct frame_request{
+    std::string scene;
+    int width = 0, spp = 0, depth = 0;
+    unsigned seed = 0;
+    bool spectral = false;
+    std::optional<sampler_type> sampler;   // 为空时用相机的默认采样器
+};
+
+// 简单的定长字段序列化
+class writer{
+public:
+    template<typename T>
+    writer& put(const T& value){
+        const char* p = reinterpret_cast<const char*>(&value);
+        data.insert(data.end(), p, p + sizeof(T));
+        return *this;
+    }
+    writer& put(const std::string& s){
+        put(uint32_t(s.size()));
+        data.insert(data.end(), s.begin(), s.end());
+        return *this;
+    }
+    writer& put_bytes(const void* bytes, size_t size){
+        const char* p = static_cast<const char*>(bytes);
+        data.insert(data.end(), p, p + size);
+        return *this;
+    }
+    std::vector<char> data;
+};
+
+class reader{
+public:
+    explicit reader(const std::vector<char>& data) : data(data) {}
+    template<typename T>
+    bool get(T& value){
+        if(pos + sizeof(T) > data.size()) return false;
+        std::memcpy(&value, data.data() + pos, sizeof(T));
+        pos += sizeof(T);
+        return true;
+    }
+    bool get(std::string& s){
+        uint32_t n;
+        if(!get(n) || pos + n > data.size()) return false;
+        s.assign(data.data() + pos, n);
+        pos += n;
+        return true;
+    }
+    const char* rest(size_t size){
+        if(pos + size > data.size()) return nullptr;
+        const char* p = data.data() + pos;
+        pos += size;
+        return p;
+    }
+private:
+    const std::vector<char>& data;
+    size_t pos = 0;
+};
+
+// 一条 TCP 连接，收发完整的消息，出错（包括对端关闭）时返回 false
+class connection{
+public:
+    explicit connection(int fd) : fd(fd){
+        int one = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    }
+    ~connection(){ if(fd >= 0) close(fd); }
+    connection(const connection&) = delete;
+    connection& operator=(const connection&) = delete;
+
+    int handle() const { return fd; }
+
+    // 一次 recv 最多等 seconds 秒，超时当作连接出错；消息发到一半就不动的对端不会让 receive 一直阻塞
+    void set_receive_timeout(int seconds){
+        timeval tv{seconds, 0};
+        setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    }
+
+    bool send(message type, const std::vector<char>& payload = {}){
+        uint32_t header[2] = {uint32_t(type), uint32_t(payload.size())};
+        return write_all(header, sizeof(header)) && write_all(payload.data(), payload.size());
+    }
+    // 最大的消息是一个 tile 的 float RGB，coordinator 把 tile 限制在 max_tile 见方以内
+    static constexpr int max_tile = 4096;
+    static constexpr uint32_t max_payload = uint32_t(max_tile) * max_tile * 3 * sizeof(float) + 1024;
+
+    bool receive(message& type, std::vector<char>& payload){
+        uint32_t header[2];
+        if(!read_all(header, sizeof(header))) return false;
+        // 长度不可信（连上来的可能不是 worker），超过上限就当作连接出错，不按它分配内存
+        if(header[1] > max_payload) return false;
+        type = message(header[0]);
+        payload.resize(header[1]);
+        return read_all(payload.data(), payload.size());
+    }
+private:
+    int fd;
+    bool write_all(const void* data, size_t size){
+        const char* p = static_cast<const char*>(data);
+        while(size > 0){
+            ssize_t n = ::send(fd, p, size, 0);
+            if(n < 0 && errno == EINTR) continue;
+            if(n <= 0) return false;
+            p += n;
+            size -= size_t(n);
+        }
+        return true;
+    }
+    bool read_all(void* data, size_t size){
+        char* p = static_cast<char*>(data);
+        while(size > 0){
+            ssize_t n = ::recv(fd, p, size, 0);
+            if(n < 0 && errno == EINTR) continue;
+            if(n <= 0) return false;
+            p += n;
+            size -= size_t(n);
+        }
+        return true;
+    }
+};
+
+class coordinator{
+public:
+    // 在 port 上监听，port 为 0 时由系统挑一个空闲端口。loopback_only 时只监听 127.0.0.1（只有本机 --spawn 的 worker），
+    // 否则监听所有地址
+    coordinator(int port, bool loopback_only){
+        signal(SIGPIPE, SIG_IGN);
+        listen_fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);   // 不让 fork 出来的 worker 继承监听端口
+        int one = 1;
+        setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+        sockaddr_in addr{};
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(loopback_only ? INADDR_LOOPBACK : INADDR_ANY);
+        addr.sin_port = htons(uint16_t(port));
+        socklen_t len = sizeof(addr);
+        if(listen_fd < 0 || bind(listen_fd, (sockaddr*)&addr, sizeof(addr)) != 0 || listen(listen_fd, 64) != 0 ||
+           getsockname(listen_fd, (sockaddr*)&addr, &len) != 0){
+            std::cerr << "cannot listen on port " << port << ": " << std::strerror(errno) << "\n";
+            if(listen_fd >= 0) close(listen_fd);
+            listen_fd = -1;
+            return;
+        }
+        bound_port = ntohs(addr.sin_port);
+    }
+    ~coordinator(){
+        for(auto& w : workers) w->conn.send(message::bye);
+        workers.clear();
+        if(listen_fd >= 0) close(listen_fd);
+        for(pid_t pid : children) waitpid(pid, nullptr, 0);
+    }
+
+    bool ok() const { return listen_fd >= 0; }
+    int port() const { return bound_port; }
+
+    // 在本机启动 n 个 worker 进程：exe --worker 127.0.0.1:port 再加上 extra_args
+    void spawn_local_workers(const std::string& exe, int n, const std::vector<std::string>& extra_args){
+        // 参数在 fork 之前准备好，子进程里只调用 execv，不碰可能被其它线程锁住的 malloc
+        std::vector<std::string> args = {exe, "--worker", "127.0.0.1:" + std::to_string(bound_port)};
+        args.insert(args.end(), extra_args.begin(), extra_args.end());
+        std::vector<char*> argv;
+        for(std::string& a : args) argv.push_back(a.data());
+        argv.push_back(nullptr);
+        for(int i = 0; i < n; i++){
+            pid_t pid = fork();
+            if(pid == 0){
+                execv(exe.c_str(), argv.data());
+                _exit(127);
+            }
+            if(pid > 0) children.push_back(pid);
+        }
+    }
+
+    // 把一帧切成 tile_size 见方的 tile 分给 worker，结果写进 pixels（按行从上到下），返回是否成功。
+    // 帧的尺寸由第一个 ready 的 worker 报告，之后的 worker 必须一致。
+    bool render(const frame_request& request, int tile_size, int& width, int& height, std::vector<color>& pixels){
+        if(!ok()) return false;
+        this->tile_size = std::clamp(tile_size, 1, connection::max_tile);
+        frame_id++;
+        frame = request;
+        width = height = 0;
+        pending.clear();
+        tiles_done = 0;
+        tiles_total = 0;
+        frame_failed = false;
+        for(auto& w : workers){
+            w->in_flight.clear();   // 上一帧失败时留下的 tile 不再等
+            if(w->greeted) start_frame(*w);
+        }
+
+        bool waiting_notice = false;
+        while(height == 0 || tiles_done < tiles_total){
+            std::vector<pollfd> fds;
+            fds.push_back({listen_fd, POLLIN, 0});
+            for(auto& w : workers) fds.push_back({w->conn.handle(), POLLIN, 0});
+            int n = poll(fds.data(), fds.size(), 1000);
+            if(n < 0 && errno != EINTR) return false;
+
+            if(n == 0 && std::none_of(workers.begin(), workers.end(), [](const auto& w){ return w->greeted; })){
+                if(!children.empty() && all_children_exited()){
+                    std::cerr << "all local workers exited\n";
+                    return false;
+                }
+                if(!waiting_notice) std::cerr << "waiting for workers on port " << bound_port << "\n";
+                waiting_notice = true;
+                continue;
+            }
+            // 先处理已有连接，再接受新连接，fds 下标才和 workers 对应
+            std::vector<worker*> broken;
+            for(size_t i = 1; i < fds.size(); i++){
+                if(!(fds[i].revents & (POLLIN | POLLHUP | POLLERR))) continue;
+                worker& w = *workers[i - 1];
+                if(!handle_message(w, width, height, pixels)) broken.push_back(&w);
+            }
+            // 连上来却迟迟不发 hello 的连接（端口扫描、健康检查、刚连上就挂掉的 worker）到期后关掉
+            auto now = std::chrono::steady_clock::now();
+            for(auto& w : workers){
+                if(!w->greeted && now > w->hello_deadline && std::find(broken.begin(), broken.end(), w.get()) == broken.end()){
+                    broken.push_back(w.get());
+                }
+            }
+            for(worker* w : broken) drop(*w);
+            if(frame_failed) return false;
+            if(fds[0].revents & POLLIN) accept_worker();
+        }
+        return true;
+    }
+private:
+    struct tile_job{
+        uint32_t id;
+        Bounds2i bounds;
+    };
+    struct worker{
+        explicit worker(int fd) : conn(fd) {}
+        connection conn;
+        bool greeted = false;               // 收到 hello 之前只是一个握手中的连接，不发帧和 tile
+        std::chrono::steady_clock::time_point hello_deadline;
+        uint32_t frame = 0;                 // 已经为哪一帧 ready
+        std::map<uint32_t, tile_job> in_flight;
+    };
+
+    int listen_fd = -1;
+    int bound_port = 0;
+    std::vector<pid_t> children;
+    std::vector<std::unique_ptr<worker>> workers;
+    uint32_t frame_id = 0;
+    frame_request frame;
+    std::deque<tile_job> pending;
+    size_t tiles_done = 0, tiles_total = 0;
+    int tile_size = 64;
+    bool frame_failed = false;
+
+    bool all_children_exited(){
+        for(auto it = children.begin(); it != children.end();){
+            if(waitpid(*it, nullptr, WNOHANG) == *it) it = children.erase(it);
+            else ++it;
+        }
+        return children.empty();
+    }
+
+    static constexpr int hello_seconds = 5;
+    static constexpr int receive_timeout_seconds = 60;
+
+    // 新连接先放进 poll 集合等 hello，这里不阻塞
+    void accept_worker(){
+        int fd = accept(listen_fd, nullptr, nullptr);
+        if(fd < 0) return;
+        auto w = std::make_unique<worker>(fd);
+        w->conn.set_receive_timeout(hello_seconds);
+        w->hello_deadline = std::chrono::steady_clock::now() + std::chrono::seconds(hello_seconds);
+        workers.push_back(std::move(w));
+    }
+
+    bool start_frame(worker& w){
+        writer out;
+        out.put(frame_id).put(frame.scene).put(int32_t(frame.width)).put(int32_t(frame.spp))
+           .put(int32_t(frame.depth)).put(uint32_t(frame.seed)).put(uint8_t(frame.spectral))
+           .put(uint8_t(frame.sampler ? uint8_t(*frame.sampler) : 0xff));
+        return w.conn.send(message::frame, out.data);
+    }
+
+    bool send_tiles(worker& w){
+        while(w.in_flight.size() < 2 && !pending.empty()){
+            tile_job t = pending.front();
+            pending.pop_front();
+            writer out;
+            out.put(frame_id).put(t.id).put(int32_t(t.bounds.pMin.x)).put(int32_t(t.bounds.pMin.y))
+               .put(int32_t(t.bounds.pMax.x)).put(int32_t(t.bounds.pMax.y));
+            w.in_flight.emplace(t.id, t);
+            if(!w.conn.send(message::tile, out.data)) return false;
+        }
+        return true;
+    }
+
+    // 第一个 worker ready 之后才知道帧的尺寸，这时切 tile
+    void make_tiles(int width, int height){
+        uint32_t id = 0;
+        for(int y = 0; y < height; y += tile_size){
+            for(int x = 0; x < width; x += tile_size){
+                pending.push_back({id++, Bounds2i(Point2i(x, y), Point2i(std::min(x + tile_size, width), std::min(y + tile_size, height)))});
+            }
+        }
+        tiles_total = pending.size();
+    }
+
+    bool handle_message(worker& w, int& width, int& height, std::vector<color>& pixels){
+        message type;
+        std::vector<char> payload;
+        if(!w.conn.receive(type, payload)) return false;
+        if(!w.greeted){
+            if(type != message::hello) return false;
+            w.greeted = true;
+            w.conn.set_receive_timeout(receive_timeout_seconds);
+            return start_frame(w);
+        }
+        reader in(payload);
+        uint32_t frame;
+        if(!in.get(frame)) return false;
+        if(frame != frame_id) return true;   // 上一帧迟到的消息
+        if(type == message::ready){
+            int32_t w_width, w_height;
+            if(!in.get(w_width) || !in.get(w_height)) return false;
+            if(height == 0){
+                width = w_width;
+                height = w_height;
+                pixels.assign(size_t(width) * height, color());
+                make_tiles(width, height);
+            }
+            else if(w_width != width || w_height != height){
+                std::cerr << "worker reported a " << w_width << "x" << w_height << " frame, expected "
+                          << width << "x" << height << "\n";
+                return false;
+            }
+            w.frame = frame_id;
+            // 先 ready 的 worker 可能已经被其它 worker 的 ready 触发过，这里统一补发
+            for(auto& other : workers){
+                if(other->frame == frame_id && !send_tiles(*other)) return false;
+            }
+            return true;
+        }
+        if(type == message::error){
+            std::string text;
+            in.get(text);
+            // 场景在每个 worker 上都会构建失败，放弃这一帧，但连接留给后面的帧
+            std::cerr << "worker failed: " << text << "\n";
+            frame_failed = true;
+            return true;
+        }
+        if(type == message::result){
+            uint32_t id;
+            if(!in.get(id)) return false;
+            auto it = w.in_flight.find(id);
+            if(it == w.in_flight.end()) return false;
+            const Bounds2i& b = it->second.bounds;
+            int tw = b.pMax.x - b.pMin.x, th = b.pMax.y - b.pMin.y;
+            const char* data = in.rest(size_t(tw) * th * 3 * sizeof(float));
+            if(!data) return false;
+            for(int y = 0; y < th; y++){
+                for(int x = 0; x < tw; x++){
+                    float rgb[3];
+                    std::memcpy(rgb, data + (size_t(y) * tw + x) * sizeof(rgb), sizeof(rgb));
+                    pixels[size_t(b.pMin.y + y) * width + b.pMin.x + x] = color(rgb[0], rgb[1], rgb[2]);
+                }
+            }
+            w.in_flight.erase(it);
+            tiles_done++;
+            return send_tiles(w);
+        }
+        return false;
+    }
+
+    // 断开的 worker 手上的 tile 放回队列，交给其它 worker
+    void drop(worker& w){
+        for(auto& [id, t] : w.in_flight) pending.push_front(t);
+        w.in_flight.clear();
+        if(w.greeted){
+            size_t left = std::count_if(workers.begin(), workers.end(), [](const auto& o){ return o->greeted; }) - 1;
+            std::cerr << "lost a worker, " << left << " left\n";
+        }
+        for(auto it = workers.begin(); it != workers.end(); ++it){
+            if(it->get() == &w){
+                workers.erase(it);
+                break;
+            }
+        }
+        // 发送失败的连接下一轮 poll 时会被发现
+        for(auto& other : workers){
+            if(other->frame == frame_id) send_tiles(*other);
+        }
+    }
+};
+
+// 连接 host:port 上的 coordinator 并处理请求，直到收到 bye 或连接断开。build 按请求构建场景（可以自己缓存），失败时返回空。
+// 连接失败时每秒重试一次，最多 retry_seconds 秒，方便 worker 比 coordinator 先启动。
+inline int run_worker(const std::string& host, int port, const std::function<std::optional<scene>(const frame_request&)>& build,
+                      int retry_seconds = 10){
+    signal(SIGPIPE, SIG_IGN);
+    addrinfo hints{}, *result = nullptr;
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    if(getaddrinfo(host.c_str(), std::to_string(port).c_str(), &hints, &result) != 0 || !result){
+        std::cerr << "cannot resolve " << host << "\n";
+        return 1;
+    }
+    int fd = -1;
+    for(int attempt = 0; fd < 0 && attempt <= retry_seconds; attempt++){
+        if(attempt > 0) std::this_thread::sleep_for(std::chrono::seconds(1));
+        for(addrinfo* a = result; a; a = a->ai_next){
+            fd = socket(a->ai_family, a->ai_socktype, a->ai_protocol);
+            if(fd < 0) continue;
+            if(connect(fd, a->ai_addr, a->ai_addrlen) == 0) break;
+            close(fd);
+            fd = -1;
+        }
+    }
+    freeaddrinfo(result);
+    if(fd < 0){
+        std::cerr << "cannot connect to " << host << ":" << port << "\n";
+        return 1;
+    }
+    connection conn(fd);
+    writer hello;
+    hello.put(int32_t(RunningThreads()));
+    if(!conn.send(message::hello, hello.data)) return 1;
+
+    std::optional<scene> current;
+    uint32_t current_frame = 0;
+    std::vector<color> tile_pixels;
+    message type;
+    std::vector<char> payload;
+    while(conn.receive(type, payload)){
+        reader in(payload);
+        if(type == message::bye) return 0;
+        if(type == message::frame){
+            frame_request request;
+            int32_t width, spp, depth;
+            uint32_t frame_seed;
+            uint8_t spectral, sampler;
+            if(!in.get(current_frame) || !in.get(request.scene) || !in.get(width) || !in.get(spp) || !in.get(depth) ||
+               !in.get(frame_seed) || !in.get(spectral) || !in.get(sampler)) return 1;
+            request.width = width;
+            request.spp = spp;
+            request.depth = depth;
+            request.seed = frame_seed;
+            request.spectral = spectral;
+            if(sampler != 0xff) request.sampler = sampler_type(sampler);
+            current = build(request);
+            writer out;
+            out.put(current_frame);
+            if(!current){
+                out.put(std::string("cannot build scene '" + request.scene + "'"));
+                if(!conn.send(message::error, out.data)) return 1;
+                continue;
+            }
+            current->cam.verbose = false;
+            current->cam.seed = request.seed;
+            current->cam.image_out = nullptr;
+            current->cam.prepare();
+            out.put(int32_t(current->cam.image_width)).put(int32_t(current->cam.height()));
+            if(!conn.send(message::ready, out.data)) return 1;
+        }
+        else if(type == message::tile){
+            uint32_t frame, id;
+            int32_t x0, y0, x1, y1;
+            if(!in.get(frame) || !in.get(id) || !in.get(x0) || !in.get(y0) || !in.get(x1) || !in.get(y1)) return 1;
+            if(!current || frame != current_frame) continue;
+            Bounds2i tile(Point2i(x0, y0), Point2i(x1, y1));
+            tile_pixels.resize(size_t(x1 - x0) * (y1 - y0));
+            current->cam.render_region(*current->world, current->lights.get(), tile, tile_pixels.data());
+            std::vector<float> rgb(tile_pixels.size() * 3);
+            for(size_t i = 0; i < tile_pixels.size(); i++){
+                for(int k = 0; k < 3; k++) rgb[i * 3 + k] = float(tile_pixels[i][k]);
+            }
+            writer out;
+            out.put(frame).put(id).put_bytes(rgb.data(), rgb.size() * sizeof(float));
+            if(!conn.send(message::result, out.data)) return 1;
+        }
+    }
+    return 0;
+}
+
+}
+#endif
+#endif
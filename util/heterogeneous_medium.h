@@ -0,0 +1,230 @@
+#ifndef HETEROGENEOUS_MEDIUM_H
+#define HETEROGENEOUS_MEDIUM_H
+#include "rtweekend.h"
+#include "hittable.h"
+#include "material.h"
+#include "texture.h"
+#include "mapped_file.h"
+#include <cstring>
+#include <functional>
+#include <vector>
+
+// [min,max] 内均匀分布的体素密度，体素中心之间三线性插值，边界外为 0
+class density_grid{
+public:
+    density_grid(int nx, int ny, int nz, const Point3& min, const Point3& max, std::vector<float> data)
+     : res{nx, ny, nz}, min(min), max(max), data(std::move(data))
+    {
+        for(int a = 0; a < 3; a++) voxel[a] = (max[a] - min[a]) / res[a];
+    }
+    // 在每个体素中心对 density 求值，比如用噪声生成烟雾
+    density_grid(int nx, int ny, int nz, const Point3& min, const Point3& max,
+                 const std::function<double(const Point3&)>& density)
+     : density_grid(nx, ny, nz, min, max, std::vector<float>(size_t(nx) * ny * nz))
+    {
+        for(int z = 0; z < nz; z++){
+            for(int y = 0; y < ny; y++){
+                for(int x = 0; x < nx; x++){
+                    Point3 p(min.x() + (x + 0.5) * voxel[0], min.y() + (y + 0.5) * voxel[1], min.z() + (z + 0.5) * voxel[2]);
+                    data[index(x, y, z)] = float(std::max(0.0, density(p)));
+                }
+            }
+        }
+    }
+
+    // 原始的 float32 体数据，x 变化最快，文件大小必须正好是 nx*ny*nz*4 字节
+    static shared_ptr<density_grid> load_raw(const std::string& filename, int nx, int ny, int nz,
+                                             const Point3& min, const Point3& max){
+        auto file = mapped_file::open(filename);
+        size_t count = size_t(nx) * ny * nz;
+        if(!file || nx <= 0 || ny <= 0 || nz <= 0 || file->size() != count * sizeof(float)){
+            std::cerr << "cannot load volume '" << filename << "' as " << nx << "x" << ny << "x" << nz << " float32\n";
+            return nullptr;
+        }
+        std::vector<float> data(count);
+        std::memcpy(data.data(), file->data(), file->size());
+        for(float& d : data) d = std::isfinite(d) ? std::max(d, 0.f) : 0.f;
+        return make_shared<density_grid>(nx, ny, nz, min, max, std::move(data));
+    }
+
+    double density(const Point3& p) const{
+        double g[3];
+        int i0[3];
+        double f[3];
+        for(int a = 0; a < 3; a++){
+            g[a] = (p[a] - min[a]) / voxel[a] - 0.5;
+            if(g[a] < -0.5 || g[a] > res[a] - 0.5) return 0.0;
+            g[a] = std::clamp(g[a], 0.0, double(res[a] - 1));
+            i0[a] = std::min(int(g[a]), std::max(res[a] - 2, 0));
+            f[a] = g[a] - i0[a];
+        }
+        int dx = res[0] > 1, dy = res[1] > 1, dz = res[2] > 1;
+        auto at = [&](int x, int y, int z){ return double(data[index(i0[0] + x, i0[1] + y, i0[2] + z)]); };
+        double c00 = at(0, 0, 0) * (1 - f[0]) + at(dx, 0, 0) * f[0];
+        double c10 = at(0, dy, 0) * (1 - f[0]) + at(dx, dy, 0) * f[0];
+        double c01 = at(0, 0, dz) * (1 - f[0]) + at(dx, 0, dz) * f[0];
+        double c11 = at(0, dy, dz) * (1 - f[0]) + at(dx, dy, dz) * f[0];
+        double c0 = c00 * (1 - f[1]) + c10 * f[1];
+        double c1 = c01 * (1 - f[1]) + c11 * f[1];
+        return c0 * (1 - f[2]) + c1 * f[2];
+    }
+
+    // 世界空间 [lo,hi] 内插值结果的上界：所有可能参与插值的体素的最大值
+    double max_density(const Point3& lo, const Point3& hi) const{
+        int first[3], last[3];
+        for(int a = 0; a < 3; a++){
+            first[a] = std::clamp(int(std::floor((lo[a] - min[a]) / voxel[a] - 0.5)), 0, res[a] - 1);
+            last[a] = std::clamp(int(std::ceil((hi[a] - min[a]) / voxel[a] - 0.5)), 0, res[a] - 1);
+        }
+        float m = 0;
+        for(int z = first[2]; z <= last[2]; z++){
+            for(int y = first[1]; y <= last[1]; y++){
+                for(int x = first[0]; x <= last[0]; x++) m = std::max(m, data[index(x, y, z)]);
+            }
+        }
+        return m;
+    }
+
+    // 用 Perlin 噪声生成的云：噪声为负的地方是空的
+    static shared_ptr<density_grid> from_noise(int nx, int ny, int nz, const Point3& min, const Point3& max, double scale){
+        perlin noise;
+        return make_shared<density_grid>(nx, ny, nz, min, max, [&](const Point3& p){
+            return std::max(0.0, noise.noise(scale * p));
+        });
+    }
+
+    const Point3& lower() const { return min; }
+    const Point3& upper() const { return max; }
+private:
+    friend class scene_cache;
+    int res[3];
+    Point3 min, max;
+    double voxel[3];
+    std::vector<float> data;
+
+    size_t index(int x, int y, int z) const{
+        return (size_t(z) * res[1] + y) * res[0] + x;
+    }
+};
+
+// 密度不均匀的参与介质，边界就是密度网格的包围盒。
+// 用 delta tracking 采样自由程：按上界密度 sigma_bar 走一步，再以 density / sigma_bar 的概率接受为真实碰撞。
+// 上界存在一个粗的 majorant 网格里，光线用 3D DDA 逐格前进，空的格子直接跳过，稠密区域外也不会用全局最大值走小步。
+class heterogeneous_medium : public hittable{
+public:
+    // density_scale 把网格里的值换算成单位长度上的消光系数，majorant_res 是上界网格每个轴的格数
+    heterogeneous_medium(shared_ptr<density_grid> grid, double density_scale, shared_ptr<texture> tex, int majorant_res = 16)
+     : grid(std::move(grid)), density_scale(density_scale), phase_function(make_shared<isotropic>(tex))
+    {
+        build_majorants(majorant_res);
+    }
+    heterogeneous_medium(shared_ptr<density_grid> grid, double density_scale, const color& albedo, int majorant_res = 16)
+     : heterogeneous_medium(std::move(grid), density_scale, make_shared<solid_color>(albedo), majorant_res) {}
+
+    bool hit(const Ray& r, interval ray_t, hit_record& rec) const override{
+        if(!clip(r, ray_t)) return false;
+        double dir_length = r.direction().length();
+
+        // DDA 初始化：起点所在的格子、沿各轴跨过一个格子的 t、到下一个格子边界的 t
+        Point3 start = r.at(ray_t.min);
+        int cell[3], step[3], out[3];
+        double t_next[3], t_delta[3];
+        for(int a = 0; a < 3; a++){
+            double d = r.direction()[a];
+            double pos = (start[a] - bbox_min[a]) / cell_size[a];
+            cell[a] = std::clamp(int(pos), 0, majorant_res - 1);
+            if(d > 0){
+                step[a] = 1;
+                out[a] = majorant_res;
+                t_next[a] = ray_t.min + (bbox_min[a] + (cell[a] + 1) * cell_size[a] - start[a]) / d;
+                t_delta[a] = cell_size[a] / d;
+            }
+            else if(d < 0){
+                step[a] = -1;
+                out[a] = -1;
+                t_next[a] = ray_t.min + (bbox_min[a] + cell[a] * cell_size[a] - start[a]) / d;
+                t_delta[a] = -cell_size[a] / d;
+            }
+            else{
+                step[a] = 0;
+                out[a] = -2;
+                t_next[a] = infinity;
+                t_delta[a] = infinity;
+            }
+        }
+
+        double t = ray_t.min;
+        while(true){
+            int axis = (t_next[0] < t_next[1]) ? (t_next[0] < t_next[2] ? 0 : 2) : (t_next[1] < t_next[2] ? 1 : 2);
+            double t_exit = std::min(t_next[axis], ray_t.max);
+            double sigma_bar = majorants[(size_t(cell[2]) * majorant_res + cell[1]) * majorant_res + cell[0]];
+            if(sigma_bar > 0){
+                // 在这个格子里做 delta tracking，指数分布无记忆，出格子时从边界接着走即可
+                while(true){
+                    t -= std::log(1 - random_double()) / (sigma_bar * dir_length);
+                    if(t >= t_exit) break;
+                    Point3 p = r.at(t);
+                    if(random_double() * sigma_bar < density_scale * grid->density(p)){
+                        rec.t = t;
+                        rec.p = p;
+                        rec.normal = vec3(1,0,0);   // 介质内部没有法线，随便给一个
+                        rec.front_face = true;
+                        rec.mat = phase_function;
+                        rec.dpdu = rec.dpdv = rec.curvature = 0;
+                        return true;
+                    }
+                }
+            }
+            if(t_exit >= ray_t.max) return false;
+            t = t_exit;
+            cell[axis] += step[axis];
+            if(cell[axis] == out[axis]) return false;
+            t_next[axis] += t_delta[axis];
+        }
+    }
+    aabb bounding_box() const override{
+        return aabb(grid->lower(), grid->upper());
+    }
+private:
+    friend class scene_cache;
+    shared_ptr<density_grid> grid;
+    double density_scale;
+    shared_ptr<material> phase_function;
+    int majorant_res = 0;
+    Point3 bbox_min;
+    vec3 cell_size;
+    std::vector<double> majorants;
+
+    void build_majorants(int n){
+        majorant_res = std::max(n, 1);
+        bbox_min = grid->lower();
+        cell_size = (grid->upper() - grid->lower()) / majorant_res;
+        majorants.resize(size_t(majorant_res) * majorant_res * majorant_res);
+        for(int z = 0; z < majorant_res; z++){
+            for(int y = 0; y < majorant_res; y++){
+                for(int x = 0; x < majorant_res; x++){
+                    Point3 lo = bbox_min + vec3(x * cell_size.x(), y * cell_size.y(), z * cell_size.z());
+                    Point3 hi = lo + cell_size;
+                    majorants[(size_t(z) * majorant_res + y) * majorant_res + x] = density_scale * grid->max_density(lo, hi);
+                }
+            }
+        }
+    }
+
+    // 把 ray_t 裁剪到包围盒内
+    bool clip(const Ray& r, interval& ray_t) const{
+        const Point3& lo = grid->lower();
+        const Point3& hi = grid->upper();
+        for(int a = 0; a < 3; a++){
+            double inv = 1.0 / r.direction()[a];
+            double t0 = (lo[a] - r.origin()[a]) * inv;
+            double t1 = (hi[a] - r.origin()[a]) * inv;
+            if(t0 > t1) std::swap(t0, t1);
+            ray_t.min = std::max(ray_t.min, t0);
+            ray_t.max = std::min(ray_t.max, t1);
+            if(ray_t.min >= ray_t.max) return false;
+        }
+        return true;
+    }
+};
+#endif
@@ -2,6 +2,7 @@
 #define HITTABLE_H
 #include "rtweekend.h"
 #include "aabb.h"
+#include <vector>
 class material;
 class hit_record{
 public:
@@ -12,6 +13,9 @@ public:
     shared_ptr<material> mat;
     double u;
     double v;
+    double dpdu = 0;        // |∂p/∂u|、|∂p/∂v|，把世界空间的足迹换算到纹理坐标，0 表示没有参数化
+    double dpdv = 0;
+    double curvature = 0;   // 表面曲率，光锥经镜面反射/折射后张角的变化与它成正比
     void set_face_normal(const Ray& r,const vec3 & outwrad_normal){
         front_face = dot(r.direction(),outwrad_normal) < 0.0;
         normal = front_face? outwrad_normal: - outwrad_normal;
@@ -29,6 +33,13 @@ public:
     virtual vec3 random(const vec3& origin) const{
         return vec3(1, 0, 0);
     }
+    // 把发光的图元追加到 lights，self 是指向自身的指针。
+    // 组合类型递归到子物体，变换类型给找到的光源套上同样的变换
+    virtual void collect_lights(const shared_ptr<hittable>& self, std::vector<shared_ptr<hittable>>& lights) const {}
+    // 发射功率的估计，只用于在光源之间分配采样概率，不发光时为 0
+    virtual double light_power() const{
+        return 0.0;
+    }
 };
 class translate : public hittable{
 public:
@@ -46,7 +57,20 @@ public:
     aabb bounding_box() const {
         return bbox;
     }
+    double pdf_value(const Point3& origin, const vec3& direction) const override{
+        return object->pdf_value(origin - offset, direction);
+    }
+    vec3 random(const vec3& origin) const override{
+        return object->random(origin - offset);
+    }
+    void collect_lights(const shared_ptr<hittable>& self, std::vector<shared_ptr<hittable>>& lights) const override{
+        std::vector<shared_ptr<hittable>> inner;
+        object->collect_lights(object, inner);
+        for(const auto& light : inner) lights.push_back(make_shared<translate>(light, offset));
+    }
+    double light_power() const override{ return object->light_power(); }
 private:
+    friend class scene_cache;
     shared_ptr<hittable> object;
     vec3 offset;
     aabb bbox;
@@ -104,7 +128,27 @@ public:
         return true;
     }
     aabb bounding_box() const override{ return bbox; }
+    double pdf_value(const Point3& origin, const vec3& direction) const override{
+        return object->pdf_value(to_object(origin), to_object(direction));
+    }
+    vec3 random(const vec3& origin) const override{
+        return to_world(object->random(to_object(origin)));
+    }
+    void collect_lights(const shared_ptr<hittable>& self, std::vector<shared_ptr<hittable>>& lights) const override{
+        std::vector<shared_ptr<hittable>> inner;
+        object->collect_lights(object, inner);
+        double angle = radians_to_degrees(std::atan2(sin_theta, cos_theta));
+        for(const auto& light : inner) lights.push_back(make_shared<rotate_y>(light, angle));
+    }
+    double light_power() const override{ return object->light_power(); }
 private:
+    friend class scene_cache;
+    vec3 to_object(const vec3& v) const{
+        return vec3(cos_theta * v[0] - sin_theta * v[2], v[1], sin_theta * v[0] + cos_theta * v[2]);
+    }
+    vec3 to_world(const vec3& v) const{
+        return vec3(cos_theta * v[0] + sin_theta * v[2], v[1], -sin_theta * v[0] + cos_theta * v[2]);
+    }
     shared_ptr<hittable> object;
     double sin_theta;
     double cos_theta;
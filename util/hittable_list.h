@@ -30,6 +30,21 @@ public:
     aabb bounding_box() const override{
         return bbox;
     }
+    // 作为光源组时等概率地挑一个成员采样，pdf 是各成员的平均
+    double pdf_value(const Point3& origin, const vec3& direction) const override{
+        if(objects.empty()) return 0.0;
+        double sum = 0;
+        for(const shared_ptr<hittable>& object : objects) sum += object->pdf_value(origin, direction);
+        return sum / objects.size();
+    }
+    vec3 random(const vec3& origin) const override{
+        if(objects.empty()) return vec3(1, 0, 0);
+        int n = int(objects.size());
+        return objects[std::min(int(random_double() * n), n - 1)]->random(origin);
+    }
+    void collect_lights(const shared_ptr<hittable>& self, std::vector<shared_ptr<hittable>>& lights) const override{
+        for(const shared_ptr<hittable>& object : objects) object->collect_lights(object, lights);
+    }
 private:
     aabb bbox;
 };
@@ -0,0 +1,103 @@
+#ifndef IMAGE_IO_H
+#define IMAGE_IO_H
+#include "rtweekend.h"
+#include "color.h"
+#include "parallel.h"
+#include <bit>
+#include <cstdint>
+#include <cstring>
+#include <optional>
+#include <sstream>
+#include <string>
+#include <vector>
+
+// 输出图像格式：ppm 是文本 P3（伽马校正后 8 位），ppm_binary 是二进制 P6，pfm 是线性的 32 位浮点 HDR
+enum class image_format{
+    ppm,
+    ppm_binary,
+    pfm
+};
+
+inline std::optional<image_format> parse_image_format(const std::string& name){
+    if(name == "ppm") return image_format::ppm;
+    if(name == "ppm-binary" || name == "p6") return image_format::ppm_binary;
+    if(name == "pfm") return image_format::pfm;
+    return std::nullopt;
+}
+
+// 按扩展名猜格式，认不出时用 ppm
+inline image_format image_format_for(const std::string& filename){
+    if(filename.ends_with(".pfm")) return image_format::pfm;
+    return image_format::ppm;
+}
+
+inline const char* image_extension(image_format f){
+    return f == image_format::pfm ? ".pfm" : ".ppm";
+}
+
+inline void write_image_header(std::ostream& out, image_format format, int width, int height){
+    switch(format){
+    case image_format::ppm: out << "P3\n" << width << " " << height << "\n255\n"; break;
+    case image_format::ppm_binary: out << "P6\n" << width << " " << height << "\n255\n"; break;
+    // 比例因子为负表示小端
+    case image_format::pfm: out << "PF\n" << width << " " << height << "\n-1.0\n"; break;
+    }
+}
+
+// 写出 rows 中连续的 count 行（按图像中从上到下存放）。ppm 按给出的顺序写；pfm 的扫描线在文件里从下往上，
+// 所以这 count 行倒过来写，分块写出时调用者要从图像最下面的一块开始。各行并行编码，最后一次写出。
+inline void write_image_rows(std::ostream& out, image_format format, int width, const color* rows, int count){
+    switch(format){
+    case image_format::ppm:{
+        std::vector<std::string> text(count);
+        ParallelFor(0, count, [&](int64_t j){
+            std::ostringstream row;
+            for(int i = 0; i < width; i++){
+                write_color(row, rows[size_t(j) * width + i]);
+            }
+            text[j] = row.str();
+        });
+        for(const std::string& row : text) out << row;
+        break;
+    }
+    case image_format::ppm_binary:{
+        static const interval intensity(0.000, 0.999);
+        std::vector<unsigned char> bytes(size_t(width) * count * 3);
+        ParallelFor(0, count, [&](int64_t j){
+            for(int i = 0; i < width; i++){
+                const color& c = rows[size_t(j) * width + i];
+                for(int k = 0; k < 3; k++) bytes[(size_t(j) * width + i) * 3 + k] = (unsigned char)(256 * intensity.clamp(linear_to_gamma(c[k])));
+            }
+        });
+        out.write(reinterpret_cast<const char*>(bytes.data()), std::streamsize(bytes.size()));
+        break;
+    }
+    case image_format::pfm:{
+        std::vector<float> data(size_t(width) * count * 3);
+        ParallelFor(0, count, [&](int64_t j){
+            float* row = data.data() + size_t(count - 1 - j) * width * 3;
+            for(int i = 0; i < width; i++){
+                const color& c = rows[size_t(j) * width + i];
+                for(int k = 0; k < 3; k++) row[size_t(i) * 3 + k] = float(c[k]);
+            }
+            if constexpr (std::endian::native == std::endian::big){
+                for(int i = 0; i < width * 3; i++){
+                    uint32_t bits;
+                    std::memcpy(&bits, &row[i], 4);
+                    bits = (bits >> 24) | ((bits >> 8) & 0xff00) | ((bits << 8) & 0xff0000) | (bits << 24);
+                    std::memcpy(&row[i], &bits, 4);
+                }
+            }
+        });
+        out.write(reinterpret_cast<const char*>(data.data()), std::streamsize(data.size() * sizeof(float)));
+        break;
+    }
+    }
+}
+
+// pixels 是 width*height 个按行从上到下存放的线性颜色
+inline void write_image(std::ostream& out, image_format format, int width, int height, const color* pixels){
+    write_image_header(out, format, width, height);
+    write_image_rows(out, format, width, pixels, height);
+}
+#endif
@@ -0,0 +1,115 @@
+#ifndef LIGHT_LIST_H
+#define LIGHT_LIST_H
+#include "rtweekend.h"
+#include "hittable.h"
+#include <vector>
+
+// Walker 别名表：按权重 O(1) 地抽取下标，只需要一个均匀随机数
+class alias_table{
+public:
+    alias_table() = default;
+    explicit alias_table(const std::vector<double>& weights){
+        size_t n = weights.size();
+        bins.resize(n);
+        double sum = 0;
+        for(double w : weights) sum += std::max(w, 0.0);
+        for(size_t i = 0; i < n; i++) bins[i].p = sum > 0 ? std::max(weights[i], 0.0) / sum : 1.0 / n;
+
+        // q 是 p 放大 n 倍后的值，小于 1 的桶用大于 1 的桶填满
+        std::vector<int> under, over;
+        for(size_t i = 0; i < n; i++){
+            bins[i].q = bins[i].p * n;
+            (bins[i].q < 1.0 ? under : over).push_back(int(i));
+        }
+        while(!under.empty() && !over.empty()){
+            int small = under.back(), large = over.back();
+            under.pop_back();
+            over.pop_back();
+            bins[small].alias = large;
+            bins[large].q -= 1.0 - bins[small].q;
+            (bins[large].q < 1.0 ? under : over).push_back(large);
+        }
+        // 剩下的只差舍入误差
+        for(int i : under) bins[i].q = 1.0;
+        for(int i : over) bins[i].q = 1.0;
+    }
+
+    // u 在 [0,1) 内，返回抽到的下标
+    int sample(double u) const{
+        double scaled = u * bins.size();
+        int offset = std::min(int(scaled), int(bins.size()) - 1);
+        double up = scaled - offset;
+        return up < bins[offset].q ? offset : bins[offset].alias;
+    }
+    double pmf(int index) const{ return bins[index].p; }
+    size_t size() const{ return bins.size(); }
+private:
+    struct bin{
+        double q = 0, p = 0;
+        int alias = -1;
+    };
+    std::vector<bin> bins;
+};
+
+// 一组用于重要性采样的光源，按发射功率挑选其中一个再在它上面采样。
+// 不发光的代理几何体（比如材质为空的光源形状）功率为 0，这时所有光源等概率。
+class light_list : public hittable{
+public:
+    explicit light_list(std::vector<shared_ptr<hittable>> lights) : lights(std::move(lights)){
+        std::vector<double> power;
+        bool all_emit = true;
+        for(const auto& light : this->lights){
+            power.push_back(light->light_power());
+            all_emit = all_emit && power.back() > 0;
+            bbox = aabb(bbox, light->bounding_box());
+        }
+        if(!all_emit) std::fill(power.begin(), power.end(), 1.0);
+        table = alias_table(power);
+    }
+
+    // 收集 world 中所有发光的图元，没有时返回空
+    static shared_ptr<light_list> collect(const shared_ptr<hittable>& world){
+        std::vector<shared_ptr<hittable>> lights;
+        world->collect_lights(world, lights);
+        if(lights.empty()) return nullptr;
+        return make_shared<light_list>(std::move(lights));
+    }
+
+    bool hit(const Ray& r, interval ray_t, hit_record& rec) const override{
+        bool hit_anything = false;
+        for(const auto& light : lights){
+            if(light->hit(r, ray_t, rec)){
+                hit_anything = true;
+                ray_t.max = rec.t;
+            }
+        }
+        return hit_anything;
+    }
+    aabb bounding_box() const override{
+        return bbox;
+    }
+    // 方向上可能有多个光源，各自的 pdf 按被选中的概率加权求和；包围盒不相交的光源直接跳过
+    double pdf_value(const Point3& origin, const vec3& direction) const override{
+        Ray r(origin, direction);
+        double sum = 0;
+        for(size_t i = 0; i < lights.size(); i++){
+            if(!lights[i]->bounding_box().hit(r, interval(0.001, infinity))) continue;
+            sum += table.pmf(int(i)) * lights[i]->pdf_value(origin, direction);
+        }
+        return sum;
+    }
+    vec3 random(const vec3& origin) const override{
+        int index = lights.size() == 1 ? 0 : table.sample(random_double());
+        return lights[index]->random(origin);
+    }
+    void collect_lights(const shared_ptr<hittable>& self, std::vector<shared_ptr<hittable>>& out) const override{
+        for(const auto& light : lights) light->collect_lights(light, out);
+    }
+    size_t size() const{ return lights.size(); }
+private:
+    friend class scene_cache;
+    std::vector<shared_ptr<hittable>> lights;
+    alias_table table;
+    aabb bbox;
+};
+#endif
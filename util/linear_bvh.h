@@ -0,0 +1,165 @@
+#ifndef LINEAR_BVH_H
+#define LINEAR_BVH_H
+#include "rtweekend.h"
+#include "hittable.h"
+#include "bvh.h"
+#include "stats.h"
+#include <functional>
+#include <vector>
+
+// 展平后的 BVH 节点，用下标而不是指针互相引用，可以原样写进文件再映射回来。
+// 内部节点的第一个孩子紧跟在自己后面，第二个孩子的下标存在 offset 中；
+// 叶子节点 count > 0，offset 是图元在图元表中的下标。
+struct linear_bvh_node{
+    double bounds[6];   // x.min, x.max, y.min, y.max, z.min, z.max
+    int32_t offset;
+    int32_t count;
+    int32_t axis;       // 划分轴，遍历时按光线方向决定先访问哪个孩子
+    int32_t pad;
+};
+static_assert(sizeof(linear_bvh_node) == 64, "linear_bvh_node is written to disk as is");
+
+class linear_bvh : public hittable{
+public:
+    // nodes 可以指向映射的文件，keep_alive 负责让它活得和本对象一样久。
+    // primitives 是图元表中 [first_primitive, first_primitive + size) 这一段，只含这棵树的叶子引用的图元，
+    // 不能包含本对象，否则两者互相持有，永远不会释放
+    linear_bvh(const linear_bvh_node* nodes, int root, std::vector<shared_ptr<hittable>> primitives, int first_primitive,
+               shared_ptr<const void> keep_alive)
+     : nodes(nodes), root(root), first_primitive(first_primitive), primitives(std::move(primitives)), keep_alive(std::move(keep_alive))
+    {
+        const double* b = nodes[root].bounds;
+        bbox = aabb(interval(b[0], b[1]), interval(b[2], b[3]), interval(b[4], b[5]));
+    }
+
+    bool hit(const Ray& r, interval ray_t, hit_record& rec) const override{
+        RTW_STAT_TIMER(BVH);
+        const Point3& origin = r.origin();
+        const vec3& dir = r.direction();
+        double inv_dir[3] = {1.0 / dir.x(), 1.0 / dir.y(), 1.0 / dir.z()};
+        bool dir_neg[3] = {inv_dir[0] < 0, inv_dir[1] < 0, inv_dir[2] < 0};
+        int stack[max_depth];
+        int top = 0;
+        int current = root;
+        bool hit_anything = false;
+        while(true){
+            RTW_STAT_COUNT(BVHNodeVisits);
+            const linear_bvh_node& node = nodes[current];
+            if(node_hit(node, origin, inv_dir, ray_t)){
+                if(node.count > 0){
+                    for(int i = 0; i < node.count; i++){
+                        if(primitives[node.offset - first_primitive + i]->hit(r, ray_t, rec)){
+                            hit_anything = true;
+                            ray_t.max = rec.t;
+                        }
+                    }
+                    if(top == 0) break;
+                    current = stack[--top];
+                }
+                else if(dir_neg[node.axis]){
+                    stack[top++] = current + 1;
+                    current = node.offset;
+                }
+                else{
+                    stack[top++] = node.offset;
+                    current = current + 1;
+                }
+            }
+            else{
+                if(top == 0) break;
+                current = stack[--top];
+            }
+        }
+        return hit_anything;
+    }
+    aabb bounding_box() const override{
+        return bbox;
+    }
+    void collect_lights(const shared_ptr<hittable>& self, std::vector<shared_ptr<hittable>>& lights) const override{
+        std::vector<int> stack = {root};
+        while(!stack.empty()){
+            const linear_bvh_node& node = nodes[stack.back()];
+            int index = stack.back();
+            stack.pop_back();
+            if(node.count > 0){
+                for(int i = 0; i < node.count; i++){
+                    const shared_ptr<hittable>& object = primitives[node.offset - first_primitive + i];
+                    object->collect_lights(object, lights);
+                }
+            }
+            else{
+                stack.push_back(node.offset);
+                stack.push_back(index + 1);
+            }
+        }
+    }
+
+    static constexpr int max_depth = 64;
+
+    // 把 bvh_node 树按深度优先展开追加到 nodes 后面，返回根节点下标。
+    // 不是 bvh_node 的孩子成为叶子，primitive_index 负责给它分配图元表中的下标。
+    static int flatten(const bvh_node& node, std::vector<linear_bvh_node>& nodes,
+                       const std::function<int(const shared_ptr<hittable>&)>& primitive_index){
+        int depth = 0;
+        return flatten(node, nodes, primitive_index, 1, depth);
+    }
+private:
+    const linear_bvh_node* nodes;
+    int root;
+    int first_primitive;
+    std::vector<shared_ptr<hittable>> primitives;
+    shared_ptr<const void> keep_alive;
+    aabb bbox;
+
+    // 与 aabb::hit 相同的 slab 测试，用预先算好的倒数
+    static bool node_hit(const linear_bvh_node& node, const Point3& origin, const double* inv_dir, interval ray_t){
+        for(int a = 0; a < 3; a++){
+            double t0 = (node.bounds[2 * a] - origin[a]) * inv_dir[a];
+            double t1 = (node.bounds[2 * a + 1] - origin[a]) * inv_dir[a];
+            if(t0 > t1) std::swap(t0, t1);
+            ray_t.min = t0 > ray_t.min ? t0 : ray_t.min;
+            ray_t.max = t1 < ray_t.max ? t1 : ray_t.max;
+            if(ray_t.min >= ray_t.max) return false;
+        }
+        return true;
+    }
+    static void set_bounds(linear_bvh_node& n, const aabb& box){
+        for(int a = 0; a < 3; a++){
+            n.bounds[2 * a] = box.axis_interval(a).min;
+            n.bounds[2 * a + 1] = box.axis_interval(a).max;
+        }
+    }
+    static int leaf(const shared_ptr<hittable>& object, std::vector<linear_bvh_node>& nodes,
+                    const std::function<int(const shared_ptr<hittable>&)>& primitive_index){
+        int index = primitive_index(object);
+        linear_bvh_node n{};
+        set_bounds(n, object->bounding_box());
+        n.offset = index;
+        n.count = 1;
+        nodes.push_back(n);
+        return int(nodes.size()) - 1;
+    }
+    static int child(const shared_ptr<hittable>& object, std::vector<linear_bvh_node>& nodes,
+                     const std::function<int(const shared_ptr<hittable>&)>& primitive_index, int depth, int& max_seen){
+        if(auto inner = std::dynamic_pointer_cast<bvh_node>(object)) return flatten(*inner, nodes, primitive_index, depth, max_seen);
+        max_seen = std::max(max_seen, depth);
+        return leaf(object, nodes, primitive_index);
+    }
+    static int flatten(const bvh_node& node, std::vector<linear_bvh_node>& nodes,
+                       const std::function<int(const shared_ptr<hittable>&)>& primitive_index, int depth, int& max_seen){
+        // 只有一个物体的节点 left 和 right 相同
+        if(node.left == node.right) return child(node.left, nodes, primitive_index, depth, max_seen);
+        CHECK_LT(depth, max_depth);
+        int index = int(nodes.size());
+        nodes.emplace_back();
+        child(node.left, nodes, primitive_index, depth + 1, max_seen);
+        int second = child(node.right, nodes, primitive_index, depth + 1, max_seen);
+        linear_bvh_node& n = nodes[index];
+        set_bounds(n, node.bbox);
+        n.offset = second;
+        n.count = 0;
+        n.axis = node.bbox.longest_axis();
+        return index;
+    }
+};
+#endif
@@ -0,0 +1,119 @@
+#ifndef MAPPED_FILE_H
+#define MAPPED_FILE_H
+#include "rtweekend.h"
+#include <atomic>
+#include <string>
+#include <vector>
+#ifdef _WIN32
+    #ifndef NOMINMAX
+        #define NOMINMAX
+    #endif
+    #include <windows.h>
+#else
+    #include <fcntl.h>
+    #include <sys/mman.h>
+    #include <sys/stat.h>
+    #include <unistd.h>
+#endif
+
+// 只读的内存映射文件。页面由操作系统按需换入，不会一次性读入整个文件。
+class mapped_file{
+public:
+    static shared_ptr<mapped_file> open(const std::string& filename){
+        shared_ptr<mapped_file> f(new mapped_file());
+        if(!f->map(filename)) return nullptr;
+        return f;
+    }
+    ~mapped_file(){
+#ifdef _WIN32
+        if(ptr) UnmapViewOfFile(ptr);
+        if(mapping) CloseHandle(mapping);
+        if(file != INVALID_HANDLE_VALUE) CloseHandle(file);
+#else
+        if(ptr) munmap(ptr, length);
+#endif
+    }
+    mapped_file(const mapped_file&) = delete;
+    mapped_file& operator=(const mapped_file&) = delete;
+
+    const unsigned char* data() const { return static_cast<const unsigned char*>(ptr); }
+    size_t size() const { return length; }
+
+    // 提示操作系统访问是随机的，避免预读把整块纹理读进内存
+    void advise_random() const{
+#ifndef _WIN32
+        if(ptr) madvise(ptr, length, MADV_RANDOM);
+#endif
+    }
+
+    // 当前驻留在物理内存中的字节数
+    size_t resident_bytes() const{
+#ifdef _WIN32
+        return length;
+#else
+        if(!ptr) return 0;
+        size_t page = size_t(sysconf(_SC_PAGESIZE));
+        size_t pages = (length + page - 1) / page;
+    #ifdef __APPLE__
+        std::vector<char> vec(pages);
+    #else
+        std::vector<unsigned char> vec(pages);
+    #endif
+        if(mincore(ptr, length, vec.data()) != 0) return length;
+        size_t resident = 0;
+        for(size_t i = 0; i < pages; i++){
+            if(vec[i] & 1) resident += page;
+        }
+        return std::min(resident, length);
+#endif
+    }
+private:
+    mapped_file() = default;
+    bool map(const std::string& filename){
+#ifdef _WIN32
+        file = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr,
+                           OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+        if(file == INVALID_HANDLE_VALUE) return false;
+        LARGE_INTEGER sz;
+        if(!GetFileSizeEx(file, &sz) || sz.QuadPart == 0) return false;
+        length = size_t(sz.QuadPart);
+        mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        if(!mapping) return false;
+        ptr = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+        return ptr != nullptr;
+#else
+        int fd = ::open(filename.c_str(), O_RDONLY);
+        if(fd < 0) return false;
+        struct stat st;
+        if(fstat(fd, &st) != 0 || st.st_size == 0){
+            ::close(fd);
+            return false;
+        }
+        length = size_t(st.st_size);
+        void* p = mmap(nullptr, length, PROT_READ, MAP_SHARED, fd, 0);
+        ::close(fd);
+        if(p == MAP_FAILED) return false;
+        ptr = p;
+        return true;
+#endif
+    }
+    void*  ptr = nullptr;
+    size_t length = 0;
+#ifdef _WIN32
+    HANDLE file = INVALID_HANDLE_VALUE;
+    HANDLE mapping = nullptr;
+#endif
+};
+
+// 写缓存文件时先写到同一目录下的临时文件再改名。文件名带上进程号和计数，
+// 多个进程（比如 --spawn 的 worker）同时写同一个缓存时各写各的，最后改名的那个留下
+inline std::string unique_temp_path(const std::string& path){
+    static std::atomic<unsigned> counter{0};
+#ifdef _WIN32
+    unsigned long pid = GetCurrentProcessId();
+#else
+    unsigned long pid = (unsigned long)getpid();
+#endif
+    return path + "." + std::to_string(pid) + "." + std::to_string(counter++) + ".tmp";
+}
+#endif
@@ -3,7 +3,23 @@
 #include "rtweekend.h"
 #include "ONB.h"
 #include "texture.h"
+#include "stats.h"
 class hit_record;
+// 光锥在交点处的足迹。斜着看表面时足迹在表面上拉长为 1/cos 倍，这里各向同性地放大
+inline texture_footprint footprint(const Ray& r, const hit_record& rec){
+    texture_footprint fp;
+    if(r.cone_width() <= 0 && r.cone_spread() <= 0) return fp;
+    double cosine = std::fabs(dot(rec.normal, r.direction())) / r.direction().length();
+    fp.width = r.cone_width_at(rec.t) / std::max(cosine, 0.05);
+    fp.du = rec.dpdu > 0 ? fp.width / rec.dpdu : 0;
+    fp.dv = rec.dpdv > 0 ? fp.width / rec.dpdv : 0;
+    return fp;
+}
+// 镜面方向继承光锥：起点宽度取交点处的宽度，张角加上表面弯曲和其他因素带来的变化 extra_spread
+inline void propagate_cone(const Ray& r_in, const hit_record& rec, Ray& scattered, double extra_spread){
+    if(r_in.cone_width() <= 0 && r_in.cone_spread() <= 0) return;
+    scattered.set_cone(r_in.cone_width_at(rec.t), r_in.cone_spread() + extra_spread);
+}
 class material{
 public:
     virtual ~material() = default;
@@ -20,6 +36,10 @@ public:
     {
         return 0;
     }
+    // 平均辐射亮度的估计，用来按功率挑选光源
+    virtual color average_emitted() const{
+        return color(0,0,0);
+    }
 };
 class lambertian : public material{
 public:
@@ -34,7 +54,9 @@ public:
         pdf = dot(onb.w(), direction) / pi;
 
         scattered = Ray(rec.p, direction, r_in.time());
-        attenuation = tex->value(rec.u,rec.v,rec.p);
+        RTW_STAT_TIMER(Texture);
+        RTW_STAT_COUNT(TextureLookups);
+        attenuation = tex->filtered_value(rec.u, rec.v, rec.p, footprint(r_in, rec));
         return true;
     }
     double scattering_pdf(const Ray& r_in, const hit_record& rec, const Ray& scattered) 
@@ -44,6 +66,7 @@ public:
             return cosine < 0 ? 0 : cosine / pi;
         }
 private:
+    friend class scene_cache;
     color albedo;
     shared_ptr<texture> tex;
 };
@@ -56,10 +79,14 @@ public:
         reflected = reflected + fuzz_direction;
         reflected = unit_vector(reflected);
         scattered = Ray(rec.p,reflected,r_in.time());
+        // 曲面上法线在足迹内转过 width * curvature，反射方向转过两倍；fuzz 相当于再把反射方向散开 fuzz 弧度
+        propagate_cone(r_in, rec, scattered, 2 * r_in.cone_width_at(rec.t) * rec.curvature + fuzz);
         attenuation = albedo;
+        pdf = 0; // 镜面方向，不参与重要性采样
         return dot(rec.normal,scattered.direction()) > 0;
     }
 private:
+    friend class scene_cache;
     color albedo;
     double fuzz;
 };
@@ -75,16 +102,22 @@ public:
         double sin_theta = std::sqrt(1.0 - cos_theta*cos_theta);
         vec3 direction;
         bool connot_refract = ri*sin_theta > 1.0;
+        double bend;    // 法线转过单位角度时出射方向转过的角度
         if(connot_refract||reflectance(cos_theta,ri) > random_double()){
             direction=reflect(r_in.direction(),rec.normal);
+            bend = 2;
         }
         else{
             direction = refract(r_in.direction(),rec.normal,ri);
+            bend = std::fabs(1 - ri);
         }
         scattered = Ray(rec.p,direction,r_in.time());
+        propagate_cone(r_in, rec, scattered, bend * r_in.cone_width_at(rec.t) * rec.curvature);
+        pdf = 0; // 镜面方向，不参与重要性采样
         return true;
     }
-private:    
+private:
+    friend class scene_cache;
     double refraction_index; 
     static double reflectance(double cosine,double refraction_index){
         double r0 = (1-refraction_index) / (1+refraction_index);
@@ -101,9 +134,16 @@ public:
         {
             return color(0, 0, 0);
         }
-        return tex->value(u,v,p);
+        RTW_STAT_TIMER(Texture);
+        RTW_STAT_COUNT(TextureLookups);
+        return tex->filtered_value(u, v, p, footprint(r, rec));
+    }
+    // 纹理光源只取中心一点的值，够用来比较光源之间的强弱
+    color average_emitted() const override{
+        return tex->value(0.5, 0.5, Point3(0,0,0));
     }
 private:
+    friend class scene_cache;
     shared_ptr<texture> tex;
 };
 class isotropic : public material{
@@ -119,11 +159,14 @@ public:
         const Ray& r_in,const hit_record& rec,color& attenuation,Ray& scattered, double& pdf
     ) const  override{
         scattered = Ray(rec.p,random_unit_vector(),r_in.time());
+        RTW_STAT_TIMER(Texture);
+        RTW_STAT_COUNT(TextureLookups);
         attenuation = tex -> value(rec.u,rec.v,rec.p);
         pdf = 1.0 / (4 * pi);
         return true;
     }
 private:
+    friend class scene_cache;
     shared_ptr<texture> tex;
 };
 #endif
\ No newline at end of file
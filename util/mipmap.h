@@ -0,0 +1,391 @@
+#ifndef MIPMAP_H
+#define MIPMAP_H
+#include "rtweekend.h"
+#include "color.h"
+#include "rtw_image.h"
+#include "mapped_file.h"
+#include "parallel.h"
+#include <vector>
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+
+enum class mip_filter
+{
+    bilinear,
+    trilinear,
+    ewa
+};
+
+// 8-bit RGB 图像金字塔。level 0 是原图，之后每一级长宽减半，直到 1x1。
+// 纹理坐标 (s,t) 在 [0,1] 内，t 向下（与 rtw_image 的行顺序一致）。
+//
+// 每一级按 64x64 的 tile 存储，一个 tile 正好占 3 个 4KB 页，并且按页对齐。
+// 内存中的布局和 .rtwtex 文件完全一致，因此转换过一次之后可以直接 mmap
+// 文件使用，只有真正被访问到的 tile 才会被换入内存。
+class mipmap{
+public:
+    static constexpr int    tile_size = 64;
+    static constexpr size_t tile_bytes = size_t(tile_size) * tile_size * rtw_image::bytes_per_pixel;
+    static constexpr size_t page_align = 4096;
+
+    mipmap() = default;
+    mipmap(const mipmap&) = delete;
+    mipmap& operator=(const mipmap&) = delete;
+    explicit mipmap(const rtw_image& image, uint64_t source_size = 0, int64_t source_mtime = 0){
+        if(image.height() <= 0) return;
+        std::vector<linear_level> pyramid;
+        int w = image.width(), h = image.height();
+        pyramid.push_back(linear_level{w, h, std::vector<unsigned char>(
+            image.data(), image.data() + size_t(w) * h * rtw_image::bytes_per_pixel)});
+        while(w > 1 || h > 1){
+            pyramid.push_back(downsample(pyramid.back()));
+            w = pyramid.back().width;
+            h = pyramid.back().height;
+        }
+        build_tiled(pyramid, source_size, source_mtime);
+        attach(owned.data(), owned.size(), source_size, source_mtime);
+    }
+
+    // 加载图像文件对应的 tile 化缓存（缓存目录下的 <文件名>-<路径哈希>.rtwtex）。缓存不存在或已经过期时
+    // 用 stb_image 解码原图、生成金字塔并写出缓存，然后映射新写出的文件。
+    // 没有配置缓存目录时不读也不写缓存，金字塔只留在内存里。
+    static shared_ptr<const mipmap> load(const std::string& image_path){
+        uint64_t source_size = 0;
+        int64_t source_mtime = 0;
+        std::error_code ec;
+        source_size = std::filesystem::file_size(image_path, ec);
+        if(ec) source_size = 0;
+        auto mtime = std::filesystem::last_write_time(image_path, ec);
+        if(!ec) source_mtime = int64_t(mtime.time_since_epoch().count());
+
+        std::string tiled_path = cache_path(image_path);
+        if(!tiled_path.empty()){
+            if(auto mapped = open_mapped(tiled_path, source_size, source_mtime)) return mapped;
+        }
+
+        rtw_image image;
+        if(!image.load(image_path)) return make_shared<const mipmap>();
+        auto built = make_shared<mipmap>(image, source_size, source_mtime);
+        if(!tiled_path.empty() && built->write(tiled_path)){
+            if(auto mapped = open_mapped(tiled_path, source_size, source_mtime)) return mapped;
+        }
+        return built;
+    }
+
+    bool write(const std::string& path) const{
+        if(owned.empty()) return false;
+        std::error_code ec;
+        std::filesystem::create_directories(std::filesystem::path(path).parent_path(), ec);
+        std::string tmp = unique_temp_path(path);
+        FILE* f = fopen(tmp.c_str(), "wb");
+        if(!f) return false;
+        bool ok = fwrite(owned.data(), 1, owned.size(), f) == owned.size();
+        ok = (fclose(f) == 0) && ok;
+        if(ok) std::filesystem::rename(tmp, path, ec);
+        if(!ok || ec){
+            std::filesystem::remove(tmp, ec);
+            return false;
+        }
+        return true;
+    }
+
+    int  level_count() const { return int(levels.size()); }
+    bool empty() const { return levels.empty(); }
+    bool is_mapped() const { return file != nullptr; }
+    int  width(int l) const { return levels[l].width; }
+    int  height(int l) const { return levels[l].height; }
+
+    // 实际占用的物理内存：自有缓冲区 + 映射文件中已驻留的页
+    size_t memory_usage() const{
+        return owned.size() + (file ? file->resident_bytes() : 0);
+    }
+    size_t mapped_bytes() const { return file ? file->size() : 0; }
+
+    color texel(int l, int x, int y) const{
+        const level& lv = levels[l];
+        x = std::clamp(x, 0, lv.width - 1);
+        y = std::clamp(y, 0, lv.height - 1);
+        size_t tile = size_t(y / tile_size) * lv.tiles_x + x / tile_size;
+        size_t in_tile = size_t(y % tile_size) * tile_size + x % tile_size;
+        const unsigned char* px = base + lv.offset + tile * tile_bytes + in_tile * rtw_image::bytes_per_pixel;
+        double color_scale = 1.0 / 255.0;
+        return color(color_scale * px[0], color_scale * px[1], color_scale * px[2]);
+    }
+
+    color bilerp(int l, double s, double t) const{
+        double x = s * levels[l].width - 0.5;
+        double y = t * levels[l].height - 0.5;
+        int x0 = int(std::floor(x)), y0 = int(std::floor(y));
+        double dx = x - x0, dy = y - y0;
+        return (1 - dx) * (1 - dy) * texel(l, x0, y0)     + dx * (1 - dy) * texel(l, x0 + 1, y0) +
+               (1 - dx) * dy       * texel(l, x0, y0 + 1) + dx * dy       * texel(l, x0 + 1, y0 + 1);
+    }
+
+    // (ds0,dt0) 和 (ds1,dt1) 是像素足迹在纹理空间中的两条轴。足迹为 0 时退化为 level 0 的双线性插值。
+    color filter(mip_filter f, double s, double t, double ds0, double dt0, double ds1, double dt1) const{
+        if(levels.empty()) return color(0, 1, 1);
+        if(f != mip_filter::ewa){
+            double width = 2 * std::max({std::fabs(ds0), std::fabs(dt0), std::fabs(ds1), std::fabs(dt1)});
+            // 选择使足迹约为一个 texel 的层级
+            double lod = level_count() - 1 + std::log2(std::max(width, 1e-8));
+            if(f == mip_filter::bilinear || lod <= 0) return bilerp(lod <= 0 ? 0 : nearest_level(lod), s, t);
+            if(lod >= level_count() - 1) return texel(level_count() - 1, 0, 0);
+            int ilod = int(std::floor(lod));
+            double d = lod - ilod;
+            return (1 - d) * bilerp(ilod, s, t) + d * bilerp(ilod + 1, s, t);
+        }
+        // EWA: 以长轴为主，过度各向异性时拉长短轴以限制采样数
+        if(ds0 * ds0 + dt0 * dt0 < ds1 * ds1 + dt1 * dt1){
+            std::swap(ds0, ds1);
+            std::swap(dt0, dt1);
+        }
+        double longer = std::sqrt(ds0 * ds0 + dt0 * dt0);
+        double shorter = std::sqrt(ds1 * ds1 + dt1 * dt1);
+        if(shorter * max_anisotropy < longer && shorter > 0){
+            double scale = longer / (shorter * max_anisotropy);
+            ds1 *= scale;
+            dt1 *= scale;
+            shorter *= scale;
+        }
+        if(shorter == 0) return bilerp(0, s, t);
+        double lod = std::max(0.0, level_count() - 1 + std::log2(shorter));
+        int ilod = int(std::floor(lod));
+        double d = lod - ilod;
+        return (1 - d) * ewa(ilod, s, t, ds0, dt0, ds1, dt1) + d * ewa(ilod + 1, s, t, ds0, dt0, ds1, dt1);
+    }
+private:
+    struct level{
+        int width, height, tiles_x;
+        size_t offset;
+    };
+    struct linear_level{
+        int width, height;
+        std::vector<unsigned char> data;
+    };
+    // .rtwtex 文件头，后面紧跟 level_count 个 file_level，然后是按页对齐的 tile 数据
+    struct file_header{
+        char     magic[8];
+        uint32_t version;
+        uint32_t tile_size;
+        uint32_t level_count;
+        uint32_t reserved;
+        uint64_t source_size;
+        int64_t  source_mtime;
+    };
+    struct file_level{
+        uint32_t width, height, tiles_x, tiles_y;
+        uint64_t offset;
+    };
+    static constexpr char file_magic[8] = {'R','T','W','T','E','X','\0','\0'};
+    static constexpr uint32_t file_version = 2;   // 2: 奇数尺寸的层级用 3 个 texel 的滤波
+
+    std::vector<level> levels;
+    std::vector<unsigned char> owned;
+    shared_ptr<mapped_file> file;
+    const unsigned char* base = nullptr;
+    static constexpr double max_anisotropy = 8;
+    static constexpr int filter_lut_size = 128;
+
+    static std::string& cache_directory(){
+        static std::string dir;
+        return dir;
+    }
+public:
+    // .rtwtex 缓存放在这个目录下，没设置时用 $RTW_TEXTURE_CACHE，两者都没有时不缓存
+    static void set_cache_directory(const std::string& dir){
+        cache_directory() = dir;
+    }
+private:
+    // 文件名带上原图完整路径的哈希（FNV-1a），不同目录下的同名图片不会互相覆盖
+    static std::string cache_path(const std::string& image_path){
+        std::string dir = cache_directory();
+        if(dir.empty()){
+            auto env = getenv("RTW_TEXTURE_CACHE");
+            if(!env) return {};
+            dir = env;
+        }
+        std::error_code ec;
+        std::string full = std::filesystem::absolute(image_path, ec).lexically_normal().string();
+        if(ec) full = image_path;
+        uint64_t h = 0xcbf29ce484222325ull;
+        for(unsigned char c : full){
+            h ^= c;
+            h *= 0x100000001b3ull;
+        }
+        char hex[17];
+        snprintf(hex, sizeof(hex), "%016llx", (unsigned long long)h);
+        return (std::filesystem::path(dir) / (std::filesystem::path(image_path).filename().string() + "-" + hex + ".rtwtex")).string();
+    }
+
+    static shared_ptr<const mipmap> open_mapped(const std::string& path, uint64_t source_size, int64_t source_mtime){
+        auto f = mapped_file::open(path);
+        if(!f) return nullptr;
+        auto m = make_shared<mipmap>();
+        if(!m->attach(f->data(), f->size(), source_size, source_mtime)) return nullptr;
+        f->advise_random();
+        m->file = f;
+        return m;
+    }
+
+    static size_t align_up(size_t x){
+        return (x + page_align - 1) / page_align * page_align;
+    }
+
+    void build_tiled(const std::vector<linear_level>& pyramid, uint64_t source_size, int64_t source_mtime){
+        size_t offset = align_up(sizeof(file_header) + pyramid.size() * sizeof(file_level));
+        std::vector<file_level> table;
+        for(const linear_level& lv : pyramid){
+            uint32_t tx = (lv.width + tile_size - 1) / tile_size;
+            uint32_t ty = (lv.height + tile_size - 1) / tile_size;
+            table.push_back(file_level{uint32_t(lv.width), uint32_t(lv.height), tx, ty, offset});
+            offset = align_up(offset + size_t(tx) * ty * tile_bytes);
+        }
+        owned.assign(offset, 0);
+
+        file_header header{};
+        std::memcpy(header.magic, file_magic, sizeof(file_magic));
+        header.version = file_version;
+        header.tile_size = tile_size;
+        header.level_count = uint32_t(pyramid.size());
+        header.source_size = source_size;
+        header.source_mtime = source_mtime;
+        std::memcpy(owned.data(), &header, sizeof(header));
+        std::memcpy(owned.data() + sizeof(header), table.data(), table.size() * sizeof(file_level));
+
+        for(size_t l = 0; l < pyramid.size(); l++){
+            const linear_level& lv = pyramid[l];
+            unsigned char* dst = owned.data() + table[l].offset;
+            ParallelFor(0, lv.height, [&](int64_t y){
+                for(int x = 0; x < lv.width; x++){
+                    size_t tile = size_t(y / tile_size) * table[l].tiles_x + x / tile_size;
+                    size_t in_tile = size_t(y % tile_size) * tile_size + x % tile_size;
+                    std::memcpy(dst + tile * tile_bytes + in_tile * rtw_image::bytes_per_pixel,
+                                lv.data.data() + (size_t(y) * lv.width + x) * rtw_image::bytes_per_pixel,
+                                rtw_image::bytes_per_pixel);
+                }
+            });
+        }
+    }
+
+    // 解析 tile 化数据的文件头；数据直接在原处使用，不做任何拷贝或指针修正
+    bool attach(const unsigned char* blob, size_t size, uint64_t source_size, int64_t source_mtime){
+        if(size < sizeof(file_header)) return false;
+        file_header header;
+        std::memcpy(&header, blob, sizeof(header));
+        if(std::memcmp(header.magic, file_magic, sizeof(file_magic)) != 0 ||
+           header.version != file_version || header.tile_size != tile_size ||
+           header.source_size != source_size || header.source_mtime != source_mtime){
+            return false;
+        }
+        if(size < sizeof(file_header) + size_t(header.level_count) * sizeof(file_level)) return false;
+        std::vector<level> parsed;
+        for(uint32_t l = 0; l < header.level_count; l++){
+            file_level fl;
+            std::memcpy(&fl, blob + sizeof(file_header) + l * sizeof(file_level), sizeof(fl));
+            if(fl.offset + size_t(fl.tiles_x) * fl.tiles_y * tile_bytes > size) return false;
+            parsed.push_back(level{int(fl.width), int(fl.height), int(fl.tiles_x), size_t(fl.offset)});
+        }
+        levels = std::move(parsed);
+        base = blob;
+        return true;
+    }
+
+    int nearest_level(double lod) const{
+        return std::min(level_count() - 1, int(std::lround(lod)));
+    }
+
+    // 下一级第 i 个 texel 在这一维上取哪几个源 texel、各占多少权重。
+    // 偶数长度是 2 个一组的盒式滤波；奇数长度 2n+1 缩成 n 时用 3 个 texel，权重 (n-i, n, i+1)/(2n+1)，
+    // 正好把源 texel 均匀分到 n 个目标 texel 上，最后一行、一列不会被丢掉，也不会偏移
+    struct downsample_taps{
+        int count;
+        int index[3];
+        double weight[3];
+    };
+    static downsample_taps taps(int size, int i){
+        if(size == 1) return {1, {0}, {1}};
+        if(size % 2 == 0) return {2, {2 * i, 2 * i + 1}, {0.5, 0.5}};
+        int n = size / 2;
+        return {3, {2 * i, 2 * i + 1, 2 * i + 2}, {double(n - i) / size, double(n) / size, double(i + 1) / size}};
+    }
+
+    static linear_level downsample(const linear_level& src){
+        linear_level dst{std::max(1, src.width / 2), std::max(1, src.height / 2), {}};
+        dst.data.resize(size_t(dst.width) * dst.height * rtw_image::bytes_per_pixel);
+        ParallelFor(0, dst.height, [&](int64_t row){
+            int y = int(row);
+            downsample_taps ty = taps(src.height, y);
+            for(int x = 0; x < dst.width; x++){
+                downsample_taps tx = taps(src.width, x);
+                for(int c = 0; c < rtw_image::bytes_per_pixel; c++){
+                    double sum = 0;
+                    for(int j = 0; j < ty.count; j++){
+                        for(int i = 0; i < tx.count; i++){
+                            sum += tx.weight[i] * ty.weight[j] *
+                                   src.data[(size_t(ty.index[j]) * src.width + tx.index[i]) * rtw_image::bytes_per_pixel + c];
+                        }
+                    }
+                    dst.data[(size_t(y) * dst.width + x) * rtw_image::bytes_per_pixel + c] =
+                        (unsigned char)std::clamp(int(sum + 0.5), 0, 255);
+                }
+            }
+        });
+        return dst;
+    }
+
+    static const std::array<double, filter_lut_size>& gaussian_lut(){
+        static const std::array<double, filter_lut_size> lut = []{
+            std::array<double, filter_lut_size> t;
+            const double alpha = 2;
+            for(int i = 0; i < filter_lut_size; i++){
+                double r2 = double(i) / (filter_lut_size - 1);
+                t[i] = std::exp(-alpha * r2) - std::exp(-alpha);
+            }
+            return t;
+        }();
+        return lut;
+    }
+
+    color ewa(int l, double s, double t, double ds0, double dt0, double ds1, double dt1) const{
+        if(l >= level_count()) return texel(level_count() - 1, 0, 0);
+        int w = levels[l].width, h = levels[l].height;
+        s = s * w - 0.5;
+        t = t * h - 0.5;
+        ds0 *= w; dt0 *= h;
+        ds1 *= w; dt1 *= h;
+        // 椭圆的隐式方程系数 A s^2 + B st + C t^2 < 1
+        double A = dt0 * dt0 + dt1 * dt1 + 1;
+        double B = -2 * (ds0 * dt0 + ds1 * dt1);
+        double C = ds0 * ds0 + ds1 * ds1 + 1;
+        double invF = 1 / (A * C - B * B * 0.25);
+        A *= invF;
+        B *= invF;
+        C *= invF;
+        double det = -B * B + 4 * A * C;
+        double invDet = 1 / det;
+        double uSqrt = std::sqrt(std::max(0.0, det * C)), vSqrt = std::sqrt(std::max(0.0, A * det));
+        int s0 = int(std::ceil(s - 2 * invDet * uSqrt)), s1 = int(std::floor(s + 2 * invDet * uSqrt));
+        int t0 = int(std::ceil(t - 2 * invDet * vSqrt)), t1 = int(std::floor(t + 2 * invDet * vSqrt));
+
+        const auto& lut = gaussian_lut();
+        color sum(0, 0, 0);
+        double sumWts = 0;
+        for(int it = t0; it <= t1; ++it){
+            double tt = it - t;
+            for(int is = s0; is <= s1; ++is){
+                double ss = is - s;
+                double r2 = A * ss * ss + B * ss * tt + C * tt * tt;
+                if(r2 < 1){
+                    int index = std::min(int(r2 * filter_lut_size), filter_lut_size - 1);
+                    double weight = lut[index];
+                    sum += weight * texel(l, is, it);
+                    sumWts += weight;
+                }
+            }
+        }
+        return sumWts > 0 ? sum / sumWts : bilerp(l, (s + 0.5) / w, (t + 0.5) / h);
+    }
+};
+#endif
@@ -1,16 +1,192 @@
 #include "parallel.h"
+#include <filesystem>
+#include <map>
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
 
-ThreadPool::ThreadPool(int nThreads)
+std::vector<int> AvailableCoreIds()
+{
+    std::vector<int> cores;
+#ifdef __linux__
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    if(sched_getaffinity(0, sizeof(set), &set) == 0)
+    {
+        for(int i = 0; i < CPU_SETSIZE; i++)
+        {
+            if(CPU_ISSET(i, &set))
+            {
+                cores.push_back(i);
+            }
+        }
+    }
+#endif
+    if(cores.empty())
+    {
+        int n = std::max<int>(1, std::thread::hardware_concurrency());
+        for(int i = 0; i < n; i++)
+        {
+            cores.push_back(i);
+        }
+    }
+    return cores;
+}
+
+namespace
+{
+struct NumaTopology
+{
+    std::vector<int> coreNode;   // 核心编号 -> 压缩后的节点编号
+    int nodes = 1;
+};
+
+// 从 /sys/devices/system/cpu/cpuN/nodeK 读出每个可用核心的节点，节点编号压缩成从 0 开始连续的
+const NumaTopology& Topology()
+{
+    static const NumaTopology topology = []
+    {
+        NumaTopology t;
+#ifdef __linux__
+        std::map<int, int> dense;
+        std::vector<std::pair<int, int>> found;
+        for(int core : AvailableCoreIds())
+        {
+            std::error_code ec;
+            std::filesystem::directory_iterator it("/sys/devices/system/cpu/cpu" + std::to_string(core), ec);
+            for(; !ec && it != std::filesystem::directory_iterator(); it.increment(ec))
+            {
+                std::string name = it->path().filename().string();
+                if(name.size() > 4 && name.compare(0, 4, "node") == 0 && isdigit((unsigned char)name[4]))
+                {
+                    int node = std::atoi(name.c_str() + 4);
+                    dense.emplace(node, 0);
+                    found.push_back({core, node});
+                    break;
+                }
+            }
+        }
+        int next = 0;
+        for(auto& [node, index] : dense)
+        {
+            index = next++;
+        }
+        for(auto [core, node] : found)
+        {
+            if(core >= (int)t.coreNode.size())
+            {
+                t.coreNode.resize(core + 1, 0);
+            }
+            t.coreNode[core] = dense[node];
+        }
+        t.nodes = std::max(1, next);
+#endif
+        return t;
+    }();
+    return topology;
+}
+}
+
+int NumaNodeCount()
+{
+    return Topology().nodes;
+}
+
+int CurrentNumaNode()
+{
+    const NumaTopology& t = Topology();
+    if(t.nodes == 1)
+    {
+        return 0;
+    }
+#ifdef __linux__
+    int cpu = sched_getcpu();
+    if(cpu >= 0 && cpu < (int)t.coreNode.size())
+    {
+        return t.coreNode[cpu];
+    }
+#endif
+    return 0;
+}
+
+// 把当前线程绑定到 core 上，失败或平台不支持时返回 false
+static bool PinCurrentThread(int core)
+{
+#ifdef __linux__
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(core, &set);
+    return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+#else
+    (void)core;
+    return false;
+#endif
+}
+
+ThreadPool::ThreadPool(int nThreads, std::vector<int> cores)
 {
     for(int i = 0; i < nThreads - 1; i++)
     {
-        threads.push_back(std::thread(&ThreadPool::Worker, this));
+        int core = cores.empty() ? -1 : cores[i % cores.size()];
+        threads.push_back(std::thread(&ThreadPool::Worker, this, core));
     }
 }
 
-ThreadPool *ParallelJob::threadPool = new ThreadPool(AvaliableCores());
-void ThreadPool::Worker()
+ThreadPool *ParallelJob::threadPool = nullptr;
+
+void ParallelInit(const ParallelOptions& options)
 {
+    if(ParallelJob::threadPool)
+    {
+        ParallelJob::threadPool->Drain();
+    }
+    delete ParallelJob::threadPool;
+    std::vector<int> cores = AvailableCoreIds();
+    int reserved = std::clamp(options.reservedCores, 0, (int)cores.size() - 1);
+    int nThreads = options.nThreads > 0 ? options.nThreads : (int)cores.size() - reserved;
+
+    // 前 reserved 个核心留出来，紧接着的一个留给调用线程，工作线程依次绑定到后面的核心上
+    std::vector<int> workerCores;
+    if(options.pinThreads)
+    {
+#ifndef __linux__
+        fprintf(stderr, "thread pinning is not supported on this platform, ignored\n");
+#else
+        for(size_t i = reserved + 1; i < cores.size(); i++)
+        {
+            workerCores.push_back(cores[i]);
+        }
+        if(workerCores.empty())
+        {
+            workerCores.push_back(cores.back());
+        }
+#endif
+    }
+    ParallelJob::threadPool = new ThreadPool(nThreads, std::move(workerCores));
+    if(options.disabled)
+    {
+        ParallelJob::threadPool->Disable();
+    }
+    ParallelForLoop2D::tileOrder = options.tileOrder;
+}
+
+void ParallelCleanup()
+{
+    if(ParallelJob::threadPool)
+    {
+        ParallelJob::threadPool->Drain();
+    }
+    delete ParallelJob::threadPool;
+    ParallelJob::threadPool = nullptr;
+}
+
+void ThreadPool::Worker(int core)
+{
+    if(core >= 0 && !PinCurrentThread(core))
+    {
+        fprintf(stderr, "failed to pin worker thread to core %d\n", core);
+    }
     std::unique_lock<std::mutex> lock(mutex);
     while(!shutdownThreads)
     {
@@ -73,6 +249,34 @@ void ThreadPool::WorkOrWait(std::unique_lock<std::mutex>* lock, bool isEnqueuing
     }
 }
 
+void ThreadPool::Drain()
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    while(jobLists)
+    {
+        WorkOrWait(&lock, true);
+    }
+}
+
+void ThreadPool::Disable()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    disabled = true;
+}
+
+void ThreadPool::Reenable()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    disabled = false;
+    condition.notify_all();
+}
+
+bool ThreadPool::IsDisabled() const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return disabled;
+}
+
 ThreadPool::~ThreadPool()
 {
     if(threads.empty())
@@ -106,26 +310,183 @@ void ThreadPool::RemoveFromJobList(ParallelJob* job)
     job->removed = true;
 }
 
-void ParallelForLoop2D::RunStep(std::unique_lock<std::mutex>* lock)
+TileOrder ParallelForLoop2D::tileOrder = TileOrder::Hilbert;
+
+// Hilbert 曲线上第 index 个点在 side x side 网格（side 为 2 的幂）中的坐标
+static Point2i HilbertToXY(int side, int64_t index)
 {
-    Point2i end = nextStart + Vector2i(chunkSize, chunkSize);
+    int x = 0, y = 0;
+    for(int s = 1; s < side; s *= 2)
+    {
+        int rx = 1 & int(index / 2);
+        int ry = 1 & int(index ^ rx);
+        if(ry == 0)
+        {
+            if(rx == 1)
+            {
+                x = s - 1 - x;
+                y = s - 1 - y;
+            }
+            std::swap(x, y);
+        }
+        x += s * rx;
+        y += s * ry;
+        index /= 4;
+    }
+    return Point2i(x, y);
+}
+
+ParallelForLoop2D::ParallelForLoop2D(const Bounds2i& extent, int chunkSize,
+    std::function<void(Bounds2i)> func, int nBands)
+    : func(std::move(func)),
+      extent(extent),
+      chunkSize(chunkSize)
+{
+    Vector2i d = extent.Diagonal();
+    int tilesX = (d.x + chunkSize - 1) / chunkSize;
+    int tilesY = (d.y + chunkSize - 1) / chunkSize;
+    nBands = std::clamp(nBands, 1, std::max(tilesY, 1));
+    order.reserve(size_t(tilesX) * tilesY);
+    // 条带边界对齐到 tile 行
+    for(int i = 0; i < nBands; i++)
+    {
+        int row0 = tilesY * i / nBands, row1 = tilesY * (i + 1) / nBands;
+        Band band;
+        band.first = (int)order.size();
+        auto add = [&](int tx, int ty)
+        {
+            order.push_back(Point2i(extent.pMin.x + tx * chunkSize, extent.pMin.y + (row0 + ty) * chunkSize));
+        };
+        if(tileOrder == TileOrder::Hilbert)
+        {
+            // 在覆盖条带的 2^k x 2^k 网格上沿 Hilbert 曲线走一遍，跳过条带外的格子
+            int rows = row1 - row0, side = 1;
+            while(side < tilesX || side < rows)
+            {
+                side *= 2;
+            }
+            for(int64_t index = 0; index < int64_t(side) * side; index++)
+            {
+                Point2i t = HilbertToXY(side, index);
+                if(t.x < tilesX && t.y < rows)
+                {
+                    add(t.x, t.y);
+                }
+            }
+        }
+        else
+        {
+            for(int ty = 0; ty < row1 - row0; ty++)
+            {
+                for(int tx = 0; tx < tilesX; tx++)
+                {
+                    add(tx, ty);
+                }
+            }
+        }
+        band.nTiles = (int)order.size() - band.first;
+        bands.push_back(band);
+    }
+}
 
-    Bounds2i b = Intersect(Bounds2i(nextStart, end), extent);
+void ParallelForLoop2D::RunStep(std::unique_lock<std::mutex>* lock)
+{
+    Band* band = &bands[CurrentNumaNode() % bands.size()];
+    if(band->nextTile >= band->nTiles)
+    {
+        for(Band& other : bands)
+        {
+            if(other.nextTile < other.nTiles)
+            {
+                band = &other;
+                break;
+            }
+        }
+    }
+    Point2i start = order[band->first + band->nextTile++];
+    Bounds2i b = Intersect(Bounds2i(start, start + Vector2i(chunkSize, chunkSize)), extent);
     if(b.IsEmpty())
     {
         assert("bounds is empty");
         return;
     }
-    nextStart.x += chunkSize;
-    if(nextStart.x >= extent.pMax.x)
+    if(!HaveWork())
+    {
+        threadPool->RemoveFromJobList(this);
+    }
+    lock->unlock();
+    if(TileTrace::Enabled())
+    {
+        auto begin = std::chrono::steady_clock::now();
+        func(b);
+        TileTrace::Record(b, begin, std::chrono::steady_clock::now());
+    }
+    else
     {
-        nextStart.x = extent.pMin.x;
-        nextStart.y += chunkSize;
+        func(b);
     }
+}
+
+void ParallelForLoop1D::RunStep(std::unique_lock<std::mutex>* lock)
+{
+    int64_t start = nextIndex;
+    int64_t stop = std::min(start + chunkSize, endIndex);
+    nextIndex = stop;
     if(!HaveWork())
     {
         threadPool->RemoveFromJobList(this);
     }
     lock->unlock();
-    func(b);
+    func(start, stop);
+}
+
+std::atomic<bool> TileTrace::enabled = false;
+std::mutex TileTrace::mutex;
+std::vector<TileTrace::Event> TileTrace::events;
+std::chrono::steady_clock::time_point TileTrace::origin;
+
+void TileTrace::Start()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    events.clear();
+    origin = std::chrono::steady_clock::now();
+    enabled = true;
+}
+
+void TileTrace::Record(const Bounds2i& tile, std::chrono::steady_clock::time_point begin,
+                       std::chrono::steady_clock::time_point end)
+{
+    // 每个线程第一次记录时分到一个编号，作为 trace 里的 tid
+    static std::atomic<int> nextThread = 0;
+    static thread_local int thread = nextThread++;
+    using us = std::chrono::microseconds;
+    std::lock_guard<std::mutex> lock(mutex);
+    events.push_back({tile, thread, std::chrono::duration_cast<us>(begin - origin).count(),
+                      std::chrono::duration_cast<us>(end - begin).count()});
+}
+
+bool TileTrace::Stop(const std::string& filename)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    enabled = false;
+    FILE* f = fopen(filename.c_str(), "w");
+    if(!f)
+    {
+        return false;
+    }
+    fprintf(f, "{\"traceEvents\": [\n");
+    for(size_t i = 0; i < events.size(); i++)
+    {
+        const Event& e = events[i];
+        fprintf(f, "  {\"name\": \"tile\", \"ph\": \"X\", \"pid\": 0, \"tid\": %d, \"ts\": %lld, \"dur\": %lld, "
+                   "\"args\": {\"x0\": %d, \"y0\": %d, \"x1\": %d, \"y1\": %d, \"pixels\": %d}}%s\n",
+                e.thread, (long long)e.beginUs, (long long)e.durationUs,
+                e.tile.pMin.x, e.tile.pMin.y, e.tile.pMax.x, e.tile.pMax.y, e.tile.Area(),
+                i + 1 < events.size() ? "," : "");
+    }
+    fprintf(f, "]}\n");
+    bool ok = !ferror(f);
+    fclose(f);
+    events.clear();
+    return ok;
 }
\ No newline at end of file
@@ -3,13 +3,22 @@
 #include <thread>
 #include <mutex>
 #include <condition_variable>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <optional>
+#include <type_traits>
+#include <vector>
 #include "rtweekend.h"
 #include "vecmath.h"
 #include <stdio.h>
 #include <cassert>
+// 本进程可以使用的核心编号；Linux 上会考虑 taskset / cgroup 设置的亲和性
+std::vector<int> AvailableCoreIds();
 inline int AvaliableCores()
 {
-    return std::max<int>(1, std::thread::hardware_concurrency());
+    return std::max<int>(1, (int)AvailableCoreIds().size());
 }
 
 class ParallelJob;
@@ -17,16 +26,25 @@ class ParallelJob;
 class ThreadPool
 {
 public:
-    explicit ThreadPool(int nThreads);
+    // cores 非空时第 i 个工作线程绑定到 cores[i % cores.size()] 上
+    explicit ThreadPool(int nThreads, std::vector<int> cores = {});
     ~ThreadPool();
     size_t size() const { return threads.size(); }
+
+    // 禁用后工作线程不再领任务，所有工作由调用 ParallelFor2D 的线程完成
+    void Disable();
+    void Reenable();
+    bool IsDisabled() const;
     
     std::unique_lock<std::mutex> AddToJobList(ParallelJob* job);
     void RemoveFromJobList(ParallelJob* job);
+    std::unique_lock<std::mutex> Lock() { return std::unique_lock<std::mutex>(mutex); }
+    // 在调用线程上帮忙，直到队列里所有任务都被领走；销毁线程池之前调用，保证提交的 AsyncJob 都会执行
+    void Drain();
 
     void WorkOrWait(std::unique_lock<std::mutex>* lock, bool isEnqueuingThread);
 private:
-    void Worker();
+    void Worker(int core);
 private:
     std::vector<std::thread> threads;
     ParallelJob* jobLists = nullptr;
@@ -61,35 +79,164 @@ private:
     ParallelJob* prev = nullptr, *next = nullptr;
 };
 
+// NUMA 节点数（只统计本进程可用的核心），不是 Linux 或读不到拓扑时为 1
+int NumaNodeCount();
+// 当前线程正在运行的核心所属的 NUMA 节点，编号在 [0, NumaNodeCount()) 内
+int CurrentNumaNode();
+
+// tile 的发放顺序。Hilbert 曲线上相邻的 tile 在图像上也相邻，同一线程先后渲染的 tile 更可能用到同一批 BVH 节点和纹理
+enum class TileOrder
+{
+    RowMajor,
+    Hilbert
+};
+
+// 把 extent 按行切成 nBands 个条带，每个 NUMA 节点一个。线程优先领取自己节点的条带里的 tile，
+// 这样同一条带的帧缓冲页面由同一个节点首次写入；自己的条带领完后再去帮其它条带。
+// 条带内按 tileOrder 的顺序发放 tile。
 class ParallelForLoop2D : public ParallelJob
 {
 public:
-    ParallelForLoop2D(const Bounds2i& extent, int chunkSize, 
-    std::function<void(Bounds2i)> func) 
-    : extent(extent) ,
-      nextStart(extent.pMin),
-      chunkSize(chunkSize),
-      func(std::move(func))
-    {}
+    static TileOrder tileOrder;
+
+    ParallelForLoop2D(const Bounds2i& extent, int chunkSize,
+    std::function<void(Bounds2i)> func, int nBands = 1);
     virtual std::string ToString() const override
     {
         return BasicToString();
     }
-    virtual bool HaveWork() const override { return nextStart.y < extent.pMax.y; }
+    virtual bool HaveWork() const override
+    {
+        for(const Band& band : bands)
+        {
+            if(band.nextTile < band.nTiles)
+            {
+                return true;
+            }
+        }
+        return false;
+    }
     virtual void RunStep(std::unique_lock<std::mutex>* lock) override;
 private:
+    struct Band
+    {
+        int first = 0;          // 在 order 中的起始位置
+        int nextTile = 0, nTiles = 0;
+    };
     std::function<void(Bounds2i)> func;
     const Bounds2i extent;
-    Point2i nextStart;
     int chunkSize;
+    std::vector<Point2i> order;   // 所有 tile 的左上角，按条带依次排列
+    std::vector<Band> bands;
+};
+
+// 只分配不初始化的分配器：resize 时不在调用线程上清零，页面在第一次被写入时才落到写入线程所在的 NUMA 节点上。
+// 只适合每个元素在读之前一定会被写一遍的缓冲区。
+template<typename T>
+struct FirstTouchAllocator : std::allocator<T>
+{
+    using value_type = T;
+    FirstTouchAllocator() = default;
+    template<typename U>
+    FirstTouchAllocator(const FirstTouchAllocator<U>&) noexcept {}
+    template<typename U>
+    struct rebind { using other = FirstTouchAllocator<U>; };
+
+    template<typename U>
+    void construct(U*) noexcept {}
+    template<typename U, typename... Args>
+    void construct(U* p, Args&&... args)
+    {
+        ::new((void*)p) U(std::forward<Args>(args)...);
+    }
+};
+
+// 把 [startIndex, endIndex) 按 chunkSize 切块依次发放，func 收到的是一个块的 [start, end)
+class ParallelForLoop1D : public ParallelJob
+{
+public:
+    ParallelForLoop1D(int64_t startIndex, int64_t endIndex, int64_t chunkSize,
+    std::function<void(int64_t, int64_t)> func)
+    : func(std::move(func)),
+      nextIndex(startIndex),
+      endIndex(endIndex),
+      chunkSize(chunkSize)
+    {}
+    virtual std::string ToString() const override
+    {
+        return BasicToString();
+    }
+    virtual bool HaveWork() const override { return nextIndex < endIndex; }
+    virtual void RunStep(std::unique_lock<std::mutex>* lock) override;
+private:
+    std::function<void(int64_t, int64_t)> func;
+    int64_t nextIndex;
+    int64_t endIndex;
+    int64_t chunkSize;
+};
+
+// 记录 ParallelFor2D 每个 tile 在哪个线程上、从何时跑到何时，导出成 chrome://tracing (Perfetto) 能读的 JSON，
+// 用来观察各线程负载是否均衡。Start 之后才记录，未开启时每个 tile 只多一次原子读。
+class TileTrace
+{
+public:
+    static void Start();
+    // 停止记录并写出文件，返回是否写成功
+    static bool Stop(const std::string& filename);
+    static bool Enabled() { return enabled.load(std::memory_order_relaxed); }
+    static void Record(const Bounds2i& tile, std::chrono::steady_clock::time_point begin,
+                       std::chrono::steady_clock::time_point end);
+private:
+    struct Event
+    {
+        Bounds2i tile;
+        int thread;
+        int64_t beginUs, durationUs;
+    };
+    static std::atomic<bool> enabled;
+    static std::mutex mutex;
+    static std::vector<Event> events;
+    static std::chrono::steady_clock::time_point origin;
 };
 
+struct ParallelOptions
+{
+    int nThreads = 0;          // 包括调用线程在内的线程数，<= 0 时用可用核心数减去 reservedCores
+    int reservedCores = 0;     // 留给 I/O 等其它工作的核心，工作线程不会绑定到这些核心上
+    bool pinThreads = false;   // 每个工作线程绑定到一个核心上（目前只在 Linux 上生效）
+    bool disabled = false;     // 线程池创建后立即禁用，方便单线程 profile
+    TileOrder tileOrder = TileOrder::Hilbert;
+};
+
+// 按 options 重建线程池，nThreads 为 1 时所有工作都在调用线程上完成。
+// 旧线程池里排队的 AsyncJob 会先在调用线程上做完。不能在并行任务执行期间调用；没有显式调用时第一次 ParallelFor2D 会按默认选项创建。
+void ParallelInit(const ParallelOptions& options);
+inline void ParallelInit(int nThreads = 0)
+{
+    ParallelOptions options;
+    options.nThreads = nThreads;
+    ParallelInit(options);
+}
+// 等工作线程退出并销毁线程池，之后的 ParallelFor2D 会重新按默认选项创建
+void ParallelCleanup();
+
+inline ThreadPool* GetThreadPool()
+{
+    if(!ParallelJob::threadPool)
+    {
+        ParallelInit();
+    }
+    return ParallelJob::threadPool;
+}
+
 inline int RunningThreads()
 {
-    return ParallelJob::threadPool ? (1 + ParallelJob::threadPool->size()) : 1;
+    ThreadPool* pool = GetThreadPool();
+    return pool->IsDisabled() ? 1 : (1 + pool->size());
 }
 
-inline void ParallelFor2D(const Bounds2i& extent, const std::function<void(const Bounds2i)>& func)
+// 每个 tile 边长取 tileSize，<= 0 时按面积和线程数估计
+inline void ParallelFor2D(const Bounds2i& extent, const std::function<void(const Bounds2i)>& func, int tileSize = 0)
 {
     if(extent.IsEmpty())
     {
@@ -98,21 +245,26 @@ inline void ParallelFor2D(const Bounds2i& extent, const std::function<void(const
     else if(extent.Area() == 1)
     {
         func(extent);
+        return;
     }
 
-    int tileSize = std::clamp((int)(
-        extent.Diagonal().x * extent.Diagonal().y / (8 * RunningThreads())), 1, 32
-    );
-    ParallelForLoop2D loop(extent, tileSize, std::move(func));
-    std::unique_lock<std::mutex> lock = ParallelJob::threadPool->AddToJobList(&loop);
+    if(tileSize <= 0)
+    {
+        tileSize = std::clamp((int)(
+            extent.Diagonal().x * extent.Diagonal().y / (8 * RunningThreads())), 1, 32
+        );
+    }
+    ThreadPool* pool = GetThreadPool();
+    ParallelForLoop2D loop(extent, tileSize, std::move(func), NumaNodeCount());
+    std::unique_lock<std::mutex> lock = pool->AddToJobList(&loop);
 
     while(!loop.Finished())
     {
-        ParallelJob::threadPool->WorkOrWait(&lock, true);
+        pool->WorkOrWait(&lock, true);
     }
 } 
 
-inline void ParallelFor2D(const Bounds2i& extent, const std::function<void(Point2i)>& func)
+inline void ParallelFor2D(const Bounds2i& extent, const std::function<void(Point2i)>& func, int tileSize = 0)
 {
     ParallelFor2D(extent, [&](const Bounds2i& b)
     {
@@ -120,6 +272,211 @@ inline void ParallelFor2D(const Bounds2i& extent, const std::function<void(Point
         {
             func(p);
         }
+    }, tileSize);
+}
+
+// 在 [begin, end) 上并行执行 func(start, end)，每次处理 chunkSize 个下标，chunkSize <= 0 时按线程数估计。
+// 可以在 ParallelFor / ParallelFor2D 的回调里嵌套调用，调用线程会一起干活直到这一层做完。
+inline void ParallelFor(int64_t begin, int64_t end, int64_t chunkSize, const std::function<void(int64_t, int64_t)>& func)
+{
+    if(begin >= end)
+    {
+        return;
+    }
+    if(chunkSize <= 0)
+    {
+        chunkSize = std::max<int64_t>(1, (end - begin) / (8 * RunningThreads()));
+    }
+    if(end - begin <= chunkSize)
+    {
+        func(begin, end);
+        return;
+    }
+    ThreadPool* pool = GetThreadPool();
+    ParallelForLoop1D loop(begin, end, chunkSize, func);
+    std::unique_lock<std::mutex> lock = pool->AddToJobList(&loop);
+
+    while(!loop.Finished())
+    {
+        pool->WorkOrWait(&lock, true);
+    }
+}
+
+inline void ParallelFor(int64_t begin, int64_t end, const std::function<void(int64_t)>& func)
+{
+    ParallelFor(begin, end, 0, [&](int64_t start, int64_t stop)
+    {
+        for(int64_t i = start; i < stop; i++)
+        {
+            func(i);
+        }
+    });
+}
+
+// 把 [begin, end) 按 chunkSize 切块，每块用 map(start, end) 得到部分结果，再按块的顺序用 combine 从左到右合并。
+// 切块与线程数无关（chunkSize <= 0 时固定切成最多 256 块），所以浮点求和这类不满足结合律的运算结果也是确定的。
+template<typename T, typename Map, typename Combine>
+T ParallelReduce(int64_t begin, int64_t end, int64_t chunkSize, T identity, Map map, Combine combine)
+{
+    if(begin >= end)
+    {
+        return identity;
+    }
+    if(chunkSize <= 0)
+    {
+        chunkSize = std::max<int64_t>(1, (end - begin + 255) / 256);
+    }
+    int64_t nChunks = (end - begin + chunkSize - 1) / chunkSize;
+    std::vector<T> partial(nChunks, identity);
+    ParallelFor(0, nChunks, 1, [&](int64_t first, int64_t last)
+    {
+        for(int64_t c = first; c < last; c++)
+        {
+            partial[c] = map(begin + c * chunkSize, std::min(end, begin + (c + 1) * chunkSize));
+        }
+    });
+    T result = std::move(identity);
+    for(T& p : partial)
+    {
+        result = combine(std::move(result), std::move(p));
+    }
+    return result;
+}
+
+// 对 data[0, n) 原地做排他前缀扫描（data[i] 变为 op(identity, data[0], ..., data[i-1])），返回所有元素的总和。
+// 先并行求每块的和，串行扫描块和得到每块的起始值，再并行扫描各块。op 需要满足结合律。
+template<typename T, typename Op>
+T ParallelScan(T* data, int64_t n, T identity, Op op, int64_t chunkSize = 0)
+{
+    if(n <= 0)
+    {
+        return identity;
+    }
+    if(chunkSize <= 0)
+    {
+        chunkSize = std::max<int64_t>(1024, (n + 255) / 256);
+    }
+    int64_t nChunks = (n + chunkSize - 1) / chunkSize;
+    std::vector<T> offsets(nChunks, identity);
+    ParallelFor(0, nChunks, 1, [&](int64_t first, int64_t last)
+    {
+        for(int64_t c = first; c < last; c++)
+        {
+            T sum = identity;
+            for(int64_t i = c * chunkSize; i < std::min(n, (c + 1) * chunkSize); i++)
+            {
+                sum = op(sum, data[i]);
+            }
+            offsets[c] = sum;
+        }
     });
+    T total = identity;
+    for(T& o : offsets)
+    {
+        T sum = o;
+        o = total;
+        total = op(total, sum);
+    }
+    ParallelFor(0, nChunks, 1, [&](int64_t first, int64_t last)
+    {
+        for(int64_t c = first; c < last; c++)
+        {
+            T running = offsets[c];
+            for(int64_t i = c * chunkSize; i < std::min(n, (c + 1) * chunkSize); i++)
+            {
+                T value = data[i];
+                data[i] = running;
+                running = op(running, value);
+            }
+        }
+    });
+    return total;
+}
+
+// 在线程池上异步执行的一个任务，由 RunAsync 创建。Wait 时如果还没有线程领走它，就在等待的线程上直接执行；
+// 等待期间调用线程也会帮忙做线程池里的其它工作，所以在没有工作线程（nThreads 为 1 或线程池被禁用）时也不会死锁。
+// 析构前会等任务做完。ParallelInit / ParallelCleanup 会先把排队的任务做完，之后只能析构，不能再 Wait。
+template<typename T>
+class AsyncJob : public ParallelJob
+{
+public:
+    explicit AsyncJob(std::function<T()> work) : work(std::move(work)) {}
+    ~AsyncJob()
+    {
+        // 提交时的线程池已经销毁说明任务在销毁前已被做完
+        if(!done && owner == threadPool)
+        {
+            Wait();
+        }
+    }
+    virtual std::string ToString() const override
+    {
+        return BasicToString();
+    }
+    virtual bool HaveWork() const override { return !started; }
+    virtual void RunStep(std::unique_lock<std::mutex>* lock) override
+    {
+        started = true;
+        threadPool->RemoveFromJobList(this);
+        lock->unlock();
+        // 结果在线程池的锁外写入；Wait 在锁内看到 Finished 之后才读，此前 WorkOrWait 已经重新加锁
+        if constexpr (std::is_void_v<T>)
+        {
+            work();
+        }
+        else
+        {
+            result = work();
+        }
+    }
+
+    bool IsReady() const
+    {
+        if(done)
+        {
+            return true;
+        }
+        std::unique_lock<std::mutex> lock = owner->Lock();
+        return Finished();
+    }
+    void Wait()
+    {
+        if(done)
+        {
+            return;
+        }
+        std::unique_lock<std::mutex> lock = owner->Lock();
+        while(!Finished())
+        {
+            owner->WorkOrWait(&lock, true);
+        }
+        done = true;
+    }
+    template<typename U = T> requires (!std::is_void_v<U>)
+    U& GetResult()
+    {
+        Wait();
+        return *result;
+    }
+private:
+    template<typename F> friend auto RunAsync(F&& func);
+    std::function<T()> work;
+    ThreadPool* owner = nullptr;    // 提交时的线程池；任务做完之前不能 ParallelCleanup / ParallelInit
+    bool started = false;
+    std::atomic<bool> done = false;  // 某次 Wait 已经在锁内看到任务做完，之后不再碰线程池
+    struct Empty {};
+    std::conditional_t<std::is_void_v<T>, Empty, std::optional<T>> result;
+};
+
+// 把 func 放进线程池异步执行，返回的句柄可以 Wait / GetResult
+template<typename F>
+auto RunAsync(F&& func)
+{
+    using T = std::invoke_result_t<std::decay_t<F>>;
+    ThreadPool* pool = GetThreadPool();
+    auto job = std::make_shared<AsyncJob<T>>(std::function<T()>(std::forward<F>(func)));
+    job->owner = pool;
+    std::unique_lock<std::mutex> lock = pool->AddToJobList(job.get());
+    return job;
 }
 #endif
\ No newline at end of file
@@ -2,6 +2,7 @@
 #define PDF_H
 #include "vec3.h"
 #include "ONB.h"
+#include "stats.h"
 class pdf
 {
 public:
@@ -45,10 +46,14 @@ public:
         : obj(obj), origin(origin){}
     double value(const vec3& direction) const override
     {
+        RTW_STAT_TIMER(LightPdf);
+        RTW_STAT_COUNT(LightPdfEvals);
         return obj.pdf_value(origin, direction);
     }
     vec3 generate() const override
     {
+        RTW_STAT_TIMER(LightPdf);
+        RTW_STAT_COUNT(LightPdfSamples);
         return obj.random(origin);
     }
 private:
@@ -56,4 +61,25 @@ private:
     Point3 origin;
 };
 
+// 两个分布按权重混合：以 weight 的概率从 p0 采样，pdf 是两者的加权和。
+// 只保存引用，生命周期由调用方保证，多于两个分布时可以嵌套
+class mixture_pdf : public pdf
+{
+public:
+    mixture_pdf(const pdf& p0, const pdf& p1, double weight = 0.5)
+        : p0(p0), p1(p1), weight(weight){}
+    double value(const vec3& direction) const override
+    {
+        return weight * p0.value(direction) + (1 - weight) * p1.value(direction);
+    }
+    vec3 generate() const override
+    {
+        return random_double() < weight ? p0.generate() : p1.generate();
+    }
+private:
+    const pdf& p0;
+    const pdf& p1;
+    double weight;
+};
+
 #endif
\ No newline at end of file
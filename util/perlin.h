@@ -1,37 +1,47 @@
 #ifndef PERLIN_H
 #define PERLIN_H
 #include "rtweekend.h"
+#include "simd.h"
 class perlin{
 public:
     perlin(){
         for(int i=0;i<point_count;i++){
-            randvec[i] = unit_vector(vec3::random(-1,1));
+            vec3 g = unit_vector(vec3::random(-1,1));
+            grad[i][0] = float(g.x());
+            grad[i][1] = float(g.y());
+            grad[i][2] = float(g.z());
+            grad[i][3] = 0.f;
         }
         perlin_generate_perm(perm_x);
         perlin_generate_perm(perm_y);
         perlin_generate_perm(perm_z);
     }
     double noise(const Point3& p) const{
-        auto u = p.x() - std::floor(p.x());
-        auto v = p.y() - std::floor(p.y());
-        auto w = p.z() - std::floor(p.z());
-        
+        float u = float(p.x() - std::floor(p.x()));
+        float v = float(p.y() - std::floor(p.y()));
+        float w = float(p.z() - std::floor(p.z()));
+
         auto i = int(std::floor(p.x()));
         auto j = int(std::floor(p.y()));
         auto k = int(std::floor(p.z()));
-        vec3 c[2][2][2];
-        for(int di=0;di<2;di++){
-            for(int dj=0;dj<2;dj++){
-                for(int dk=0;dk<2;dk++){
-                    c[di][dj][dk] = randvec[
-                        perm_x[(i+di) & 255] ^
-                        perm_y[(j+dj) & 255] ^
-                        perm_z[(k+dk) & 255]
-                    ];
-                }
-            }
-        }
-        return perlin_interp(c,u,v,w);
+        // 8 个格点的梯度一次取出：通道 (di,dj) = (0,0),(0,1),(1,0),(1,1)，lo 是 dk=0，hi 是 dk=1
+        int x0 = perm_x[i & 255], x1 = perm_x[(i + 1) & 255];
+        int y0 = perm_y[j & 255], y1 = perm_y[(j + 1) & 255];
+        int z0 = perm_z[k & 255], z1 = perm_z[(k + 1) & 255];
+        float4 gx = gradient(x0 ^ y0 ^ z0), gy = gradient(x0 ^ y1 ^ z0);
+        float4 gz = gradient(x1 ^ y0 ^ z0), gw = gradient(x1 ^ y1 ^ z0);
+        transpose4(gx, gy, gz, gw);
+        float4 hx = gradient(x0 ^ y0 ^ z1), hy = gradient(x0 ^ y1 ^ z1);
+        float4 hz = gradient(x1 ^ y0 ^ z1), hw = gradient(x1 ^ y1 ^ z1);
+        transpose4(hx, hy, hz, hw);
+        const float4 di(0, 0, 1, 1), dj(0, 1, 0, 1), one(1.f);
+        float4 fu(u), fv(v);
+        // 与原来的 perlin_interp 保持一致：x 方向的格点用 v 作权重，y 方向用 u
+        float4 wx = fv - di, wy = fu - dj;
+        float4 weight = (di * fv + (one - di) * (one - fv)) * (dj * fu + (one - dj) * (one - fu));
+        float4 lo = gx * wx + gy * wy + gz * float4(w);
+        float4 hi = hx * wx + hy * wy + hz * float4(w - 1);
+        return (weight * (lo * float4(1 - w) + hi * float4(w))).hsum();
     }
     double turb(const Point3& p, int depth) const{
         double accum = 0.0;
@@ -44,13 +54,76 @@ public:
         }
         return std::fabs(accum);
     }
+    // 同时计算 4 个点的噪声，每个通道一个点
+    void noise4(const double* x, const double* y, const double* z, float* out) const{
+        alignas(16) float u[4], v[4], w[4];
+        int i[4], j[4], k[4];
+        for(int l=0;l<4;l++){
+            double fx = std::floor(x[l]), fy = std::floor(y[l]), fz = std::floor(z[l]);
+            u[l] = float(x[l] - fx);
+            v[l] = float(y[l] - fy);
+            w[l] = float(z[l] - fz);
+            i[l] = int(fx);
+            j[l] = int(fy);
+            k[l] = int(fz);
+        }
+        const float4 one(1.f);
+        float4 fu = float4::load(u), fv = float4::load(v), fw = float4::load(w);
+        float4 accum(0.f);
+        for(int c=0;c<8;c++){
+            int di = (c >> 1) & 1, dj = c & 1, dk = c >> 2;
+            auto corner = [&](int l){
+                return gradient(perm_x[(i[l] + di) & 255] ^ perm_y[(j[l] + dj) & 255] ^ perm_z[(k[l] + dk) & 255]);
+            };
+            float4 gx = corner(0), gy = corner(1), gz = corner(2), gw = corner(3);
+            transpose4(gx, gy, gz, gw);
+            float4 weight = (di ? fv : one - fv) * (dj ? fu : one - fu) * (dk ? fw : one - fw);
+            float4 d = gx * (fv - float4(float(di))) +
+                       gy * (fu - float4(float(dj))) +
+                       gz * (fw - float4(float(dk)));
+            accum += weight * d;
+        }
+        accum.store(out);
+    }
+    // 批量计算 n 个点的 turb
+    void turb_batch(const Point3* p, size_t n, double* out, int depth) const{
+        for(size_t base=0;base<n;base+=4){
+            size_t count = std::min<size_t>(4, n - base);
+            double x[4], y[4], z[4];
+            alignas(16) float r[4];
+            double accum[4] = {0, 0, 0, 0};
+            for(size_t l=0;l<4;l++){
+                const Point3& q = p[base + std::min(l, count - 1)];
+                x[l] = q.x();
+                y[l] = q.y();
+                z[l] = q.z();
+            }
+            double weight = 1.0;
+            for(int d=0;d<depth;d++){
+                noise4(x, y, z, r);
+                for(int l=0;l<4;l++){
+                    accum[l] += weight * r[l];
+                    x[l] *= 2;
+                    y[l] *= 2;
+                    z[l] *= 2;
+                }
+                weight *= 0.5;
+            }
+            for(size_t l=0;l<count;l++){
+                out[base + l] = std::fabs(accum[l]);
+            }
+        }
+    }
 private:
+    friend class scene_cache;
     static const int point_count = 256;
-    vec3 randvec[point_count];
+    alignas(16) float grad[point_count][4]; // 单位梯度向量，第 4 个分量补 0 以便一次载入
     int perm_x[point_count];
     int perm_y[point_count];
     int perm_z[point_count];
-    
+
+    float4 gradient(int idx) const { return float4::load(grad[idx]); }
+
     static void perlin_generate_perm(int* p){
         for(int i=0;i<point_count;i++){
             p[i] = i;
@@ -65,23 +138,60 @@ private:
             p[target] = temp;
         }
     }
-    static double perlin_interp(const vec3 c[2][2][2],double v,double u,double w){
-        double uu = u * u * (3 - 2 * u);
-        double vv = v * v * (3 - 2 * v);
-        double ww = w * w * (3 - 2 * w);
-        double accum = 0.0;
-        for(int i=0;i<2;i++){
-            for(int j=0;j<2;j++){
-                for(int k=0;k<2;k++){
-                    vec3 weight(u-i,v-j,w-k);//相对位置
-                    accum += (i*u + (1-i)*(1-u)) *
-                             (j*v + (1-j)*(1-v)) *
-                             (k*w + (1-k)*(1-w)) *
-                             dot(c[i][j][k],weight);
+};
+
+// 在一个包围盒内预先计算好的 turb 体素网格，查询时做三线性插值。
+class perlin_volume{
+public:
+    perlin_volume(const perlin& noise, const Point3& min, const Point3& max, int resolution, int depth)
+     : min(min), res(std::max(2, resolution))
+    {
+        vec3 extent = max - min;
+        cell = vec3(extent.x() / (res - 1), extent.y() / (res - 1), extent.z() / (res - 1));
+        data.resize(size_t(res) * res * res);
+        std::vector<Point3> row(res);
+        std::vector<double> out(res);
+        for(int z=0;z<res;z++){
+            for(int y=0;y<res;y++){
+                for(int x=0;x<res;x++){
+                    row[x] = min + vec3(x * cell.x(), y * cell.y(), z * cell.z());
+                }
+                noise.turb_batch(row.data(), res, out.data(), depth);
+                for(int x=0;x<res;x++){
+                    data[(size_t(z) * res + y) * res + x] = float(out[x]);
                 }
             }
         }
-        return accum;
     }
+    bool contains(const Point3& p) const{
+        for(int a=0;a<3;a++){
+            double t = (p[a] - min[a]) / cell[a];
+            if(!(t >= 0 && t <= res - 1)) return false;
+        }
+        return true;
+    }
+    double lookup(const Point3& p) const{
+        double fx = (p.x() - min.x()) / cell.x();
+        double fy = (p.y() - min.y()) / cell.y();
+        double fz = (p.z() - min.z()) / cell.z();
+        int x0 = std::clamp(int(fx), 0, res - 2);
+        int y0 = std::clamp(int(fy), 0, res - 2);
+        int z0 = std::clamp(int(fz), 0, res - 2);
+        double dx = fx - x0, dy = fy - y0, dz = fz - z0;
+        auto at = [&](int x, int y, int z){ return double(data[(size_t(z) * res + y) * res + x]); };
+        double c00 = at(x0, y0, z0)     * (1 - dx) + at(x0 + 1, y0, z0)     * dx;
+        double c10 = at(x0, y0 + 1, z0) * (1 - dx) + at(x0 + 1, y0 + 1, z0) * dx;
+        double c01 = at(x0, y0, z0 + 1) * (1 - dx) + at(x0 + 1, y0, z0 + 1) * dx;
+        double c11 = at(x0, y0 + 1, z0 + 1) * (1 - dx) + at(x0 + 1, y0 + 1, z0 + 1) * dx;
+        return (c00 * (1 - dy) + c10 * dy) * (1 - dz) + (c01 * (1 - dy) + c11 * dy) * dz;
+    }
+    size_t memory_usage() const { return data.size() * sizeof(float); }
+private:
+    friend class scene_cache;
+    perlin_volume() = default;
+    Point3 min;
+    vec3 cell;
+    int res;
+    std::vector<float> data;
 };
-#endif
\ No newline at end of file
+#endif
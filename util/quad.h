@@ -2,6 +2,8 @@
 #define QUAD_H
 #include "rtweekend.h"
 #include "hittable.h"
+#include "material.h"
+#include "stats.h"
 class quad : public hittable{
 public:
     quad(const Point3& Q,const vec3& u,const vec3& v,shared_ptr<material> mat) : Q(Q),u(u),v(v),mat(mat) {
@@ -10,6 +12,8 @@ public:
         normal = unit_vector(n);
         D = dot(Q,normal);
         w = n/ dot(n,n);
+        u_length = u.length();
+        v_length = v.length();
         set_bounding_box();
     }
     virtual void set_bounding_box(){
@@ -18,6 +22,8 @@ public:
         bbox = aabb(box_diagonal1,box_diagonal2);
     }
     bool hit(const Ray& r,interval ray_t,hit_record& rec) const override{
+        RTW_STAT_TIMER(Quad);
+        RTW_STAT_COUNT(QuadTests);
         double denom = dot(normal,r.direction());
         if(std::fabs(denom) < 1e-8){
             return false;
@@ -37,7 +43,11 @@ public:
         rec.p = intersection;
         rec.t = t;
         rec.mat = mat;
+        rec.dpdu = u_length;
+        rec.dpdv = v_length;
+        rec.curvature = 0;
         rec.set_face_normal(r,normal);
+        RTW_STAT_COUNT(QuadHits);
         return true;
     }
     virtual bool is_interior(double alpha,double beta,hit_record& rec) const{
@@ -65,15 +75,24 @@ public:
     }
     vec3 random(const vec3& origin) const override
     {
-        vec3 p = Q + u * random_double() + v * random_double();
+        auto [s, t] = random_double2();
+        vec3 p = Q + u * s + v * t;
         return p - origin;
     }
+    void collect_lights(const shared_ptr<hittable>& self, std::vector<shared_ptr<hittable>>& lights) const override{
+        if(light_power() > 0) lights.push_back(self);
+    }
+    double light_power() const override{
+        return luminance(mat->average_emitted()) * area;
+    }
 private:
+    friend class scene_cache;
     Point3 Q;
     vec3 u,v;
     vec3 normal;
     vec3 w;
     double D;
+    double u_length, v_length;
     shared_ptr<material> mat;
     aabb bbox;
     double area;
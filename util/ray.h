@@ -13,9 +13,30 @@ public:
         return orig+t*dir;
     }
     double time() const {return tm;}
+
+    // 光锥：起点处的宽度和张角（弧度），都为 0 时表示不带光锥
+    void set_cone(double width, double spread){
+        cone_w = width;
+        cone_s = spread;
+    }
+    double cone_width() const {return cone_w;}
+    double cone_spread() const {return cone_s;}
+    // 沿光线走到参数 t 处时光锥的宽度
+    double cone_width_at(double t) const {
+        return cone_w + cone_s * t * dir.length();
+    }
 private:
     Point3 orig;
     vec3 dir;
     double tm;
+    double cone_w = 0;
+    double cone_s = 0;
+};
+
+// 纹理查询的足迹：width 是世界空间中的宽度，du、dv 是换算到纹理坐标后的宽度，全为 0 时按最精细的层级查询
+struct texture_footprint{
+    double width = 0;
+    double du = 0;
+    double dv = 0;
 };
 #endif
\ No newline at end of file
@@ -0,0 +1,386 @@
+#include "rgb2spec.h"
+#include "parallel.h"
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+
+namespace
+{
+    constexpr int FineSamples = 3 * 32 + 1; // Simpson 3/8 积分需要 3k+1 个点
+    constexpr double Epsilon = 1e-4;
+
+    // 拟合时用到的积分表，都以颜色空间的光源为白点
+    struct FitTables
+    {
+        double lambda[FineSamples];      // 归一化到 [0, 1] 的波长
+        double rgb[3][FineSamples];      // 配色函数 * 光源 * 积分权重，已转换到目标 RGB
+        double whitepoint[3];
+        double xyzFromRGB[3][3];
+    };
+
+    double Smoothstep(double x) { return x * x * (3.0 - 2.0 * x); }
+
+    void InitTables(FitTables& t, const SquareMatrix<3>& XYZFromRGB,
+                    const SquareMatrix<3>& RGBFromXYZ, Spectrum illuminant)
+    {
+        const double h = double(Lambda_max - Lambda_min) / (FineSamples - 1);
+        double xyz[3][FineSamples], weight[FineSamples], illum[FineSamples];
+        double norm = 0.0;
+        for(int i = 0; i < FineSamples; ++i)
+        {
+            double lambda = Lambda_min + i * h;
+            double w = 3.0 / 8.0 * h;
+            if(i != 0 && i != FineSamples - 1)
+            {
+                w *= ((i - 1) % 3 == 2) ? 2.0 : 3.0;
+            }
+            weight[i] = w;
+            xyz[0][i] = Spectra::X()(lambda);
+            xyz[1][i] = Spectra::Y()(lambda);
+            xyz[2][i] = Spectra::Z()(lambda);
+            illum[i] = illuminant(lambda);
+            norm += xyz[1][i] * illum[i] * w;
+        }
+        // 光源归一化到 Y = 1，这样反射率 1 对应 RGB (1, 1, 1)
+        for(int k = 0; k < 3; ++k)
+        {
+            t.whitepoint[k] = 0.0;
+            for(int i = 0; i < FineSamples; ++i) t.rgb[k][i] = 0.0;
+            for(int j = 0; j < 3; ++j) t.xyzFromRGB[k][j] = XYZFromRGB[k][j];
+        }
+        for(int i = 0; i < FineSamples; ++i)
+        {
+            t.lambda[i] = double(i) / (FineSamples - 1);
+            double I = illum[i] / norm * weight[i];
+            for(int k = 0; k < 3; ++k)
+            {
+                for(int j = 0; j < 3; ++j)
+                {
+                    t.rgb[k][i] += RGBFromXYZ[k][j] * xyz[j][i] * I;
+                }
+                t.whitepoint[k] += xyz[k][i] * I;
+            }
+        }
+    }
+
+    // RGB -> CIELAB，残差在感知均匀的空间里计算
+    void CIELab(const FitTables& t, double* p)
+    {
+        double X = 0.0, Y = 0.0, Z = 0.0;
+        for(int j = 0; j < 3; ++j)
+        {
+            X += p[j] * t.xyzFromRGB[0][j];
+            Y += p[j] * t.xyzFromRGB[1][j];
+            Z += p[j] * t.xyzFromRGB[2][j];
+        }
+        auto f = [](double v)
+        {
+            const double delta = 6.0 / 29.0;
+            if(v > delta * delta * delta) return std::cbrt(v);
+            return v / (delta * delta * 3.0) + (4.0 / 29.0);
+        };
+        double fy = f(Y / t.whitepoint[1]);
+        p[0] = 116.0 * fy - 16.0;
+        p[1] = 500.0 * (f(X / t.whitepoint[0]) - fy);
+        p[2] = 200.0 * (fy - f(Z / t.whitepoint[2]));
+    }
+
+    void EvalResidual(const FitTables& t, const double* coeffs, const double* rgb, double* residual)
+    {
+        double out[3] = {0.0, 0.0, 0.0};
+        for(int i = 0; i < FineSamples; ++i)
+        {
+            double x = (coeffs[0] * t.lambda[i] + coeffs[1]) * t.lambda[i] + coeffs[2];
+            double s = 0.5 * x / std::sqrt(1.0 + x * x) + 0.5;
+            for(int j = 0; j < 3; ++j) out[j] += t.rgb[j][i] * s;
+        }
+        CIELab(t, out);
+        for(int j = 0; j < 3; ++j) residual[j] = rgb[j];
+        CIELab(t, residual);
+        for(int j = 0; j < 3; ++j) residual[j] -= out[j];
+    }
+
+    void EvalJacobian(const FitTables& t, const double* coeffs, const double* rgb, double jac[3][3])
+    {
+        double r0[3], r1[3], tmp[3];
+        for(int i = 0; i < 3; ++i)
+        {
+            for(int j = 0; j < 3; ++j) tmp[j] = coeffs[j];
+            tmp[i] -= Epsilon;
+            EvalResidual(t, tmp, rgb, r0);
+            tmp[i] += 2 * Epsilon;
+            EvalResidual(t, tmp, rgb, r1);
+            for(int j = 0; j < 3; ++j) jac[j][i] = (r1[j] - r0[j]) / (2 * Epsilon);
+        }
+    }
+
+    // 3x3 线性方程组，列主元消元；奇异时返回 false
+    bool Solve3(double a[3][3], double b[3], double x[3])
+    {
+        for(int c = 0; c < 3; ++c)
+        {
+            int pivot = c;
+            for(int r = c + 1; r < 3; ++r)
+            {
+                if(std::abs(a[r][c]) > std::abs(a[pivot][c])) pivot = r;
+            }
+            if(std::abs(a[pivot][c]) < 1e-15) return false;
+            std::swap(a[c], a[pivot]);
+            std::swap(b[c], b[pivot]);
+            for(int r = c + 1; r < 3; ++r)
+            {
+                double f = a[r][c] / a[c][c];
+                for(int k = c; k < 3; ++k) a[r][k] -= f * a[c][k];
+                b[r] -= f * b[c];
+            }
+        }
+        for(int r = 2; r >= 0; --r)
+        {
+            double s = b[r];
+            for(int k = r + 1; k < 3; ++k) s -= a[r][k] * x[k];
+            x[r] = s / a[r][r];
+        }
+        return true;
+    }
+
+    void GaussNewton(const FitTables& t, const double rgb[3], double coeffs[3], int iterations = 15)
+    {
+        for(int it = 0; it < iterations; ++it)
+        {
+            double jac[3][3], residual[3], x[3];
+            EvalResidual(t, coeffs, rgb, residual);
+            double r = residual[0] * residual[0] + residual[1] * residual[1] + residual[2] * residual[2];
+            // 已经收敛就不必再算雅可比矩阵
+            if(r < 1e-6) break;
+            EvalJacobian(t, coeffs, rgb, jac);
+            if(!Solve3(jac, residual, x)) break;
+            for(int j = 0; j < 3; ++j) coeffs[j] -= x[j];
+            double m = std::max({coeffs[0], coeffs[1], coeffs[2]});
+            if(m > 200)
+            {
+                for(int j = 0; j < 3; ++j) coeffs[j] *= 200 / m;
+            }
+        }
+    }
+}
+
+std::unique_ptr<RGBToSpectrumTableData> ComputeRGBToSpectrumTable(
+    const SquareMatrix<3>& XYZFromRGB, const SquareMatrix<3>& RGBFromXYZ, Spectrum illuminant)
+{
+    constexpr int res = RGBToSpectrumTable::res;
+    Spectra::Init();
+    FitTables tables;
+    InitTables(tables, XYZFromRGB, RGBFromXYZ, illuminant);
+
+    auto data = std::make_unique<RGBToSpectrumTableData>();
+    data->zNodes.resize(res);
+    data->coeffs.resize(size_t(3) * res * res * res * 3);
+    for(int k = 0; k < res; ++k)
+    {
+        data->zNodes[k] = float(Smoothstep(Smoothstep(k / double(res - 1))));
+    }
+
+    // 每一行 (l, j) 从中间亮度出发向两侧扫描，用相邻格点的解作为初值
+    ParallelFor2D(Bounds2i(Point2i(0, 0), Point2i(res, 3)), [&](Bounds2i b)
+    {
+        for(int l = b.pMin.y; l < b.pMax.y; ++l)
+        {
+            for(int j = b.pMin.x; j < b.pMax.x; ++j)
+            {
+                const double y = j / double(res - 1);
+                for(int i = 0; i < res; ++i)
+                {
+                    const double x = i / double(res - 1);
+                    const int start = res / 5;
+                    auto fit = [&](int k, double coeffs[3])
+                    {
+                        double z = data->zNodes[k];
+                        double rgb[3];
+                        rgb[l] = z;
+                        rgb[(l + 1) % 3] = x * z;
+                        rgb[(l + 2) % 3] = y * z;
+                        GaussNewton(tables, rgb, coeffs);
+
+                        // 把归一化波长上的多项式换回以 nm 为单位
+                        const double c0 = Lambda_min, c1 = 1.0 / (Lambda_max - Lambda_min);
+                        const double A = coeffs[0], B = coeffs[1], C = coeffs[2];
+                        size_t idx = ((size_t(l) * res + k) * res + j) * res + i;
+                        data->coeffs[3 * idx + 0] = float(A * c1 * c1);
+                        data->coeffs[3 * idx + 1] = float(B * c1 - 2 * A * c0 * c1 * c1);
+                        data->coeffs[3 * idx + 2] = float(C - B * c0 * c1 + A * c0 * c0 * c1 * c1);
+                    };
+                    double coeffs[3] = {0.0, 0.0, 0.0};
+                    for(int k = start; k < res; ++k) fit(k, coeffs);
+                    coeffs[0] = coeffs[1] = coeffs[2] = 0.0;
+                    for(int k = start; k >= 0; --k) fit(k, coeffs);
+                }
+            }
+        }
+    });
+    return data;
+}
+
+namespace
+{
+    constexpr char SpectrumFileMagic[8] = {'R', 'T', 'W', 'S', 'P', 'E', 'C', '\0'};
+    constexpr uint32_t SpectrumFileVersion = 1;
+    constexpr size_t SpectrumFileAlign = 4096;
+
+    struct SpectrumFileHeader
+    {
+        char magic[8];
+        uint32_t version;
+        uint32_t res;
+        uint32_t count;
+        uint32_t pad;
+    };
+
+    struct SpectrumFileEntry
+    {
+        char name[32];
+        float RGBFromXYZ[9];
+        uint32_t pad;
+        uint64_t zNodesOffset;
+        uint64_t coeffsOffset;
+    };
+
+    constexpr size_t ZNodesBytes = sizeof(float) * RGBToSpectrumTable::res;
+    constexpr size_t CoeffsBytes = sizeof(RGBToSpectrumTable::CoefficientArray);
+
+    size_t AlignUp(size_t x) { return (x + SpectrumFileAlign - 1) / SpectrumFileAlign * SpectrumFileAlign; }
+}
+
+bool WriteRGBToSpectrumTables(const std::string& filename, std::span<const RGBToSpectrumTableEntry> entries)
+{
+    SpectrumFileHeader header{};
+    std::memcpy(header.magic, SpectrumFileMagic, sizeof(SpectrumFileMagic));
+    header.version = SpectrumFileVersion;
+    header.res = RGBToSpectrumTable::res;
+    header.count = uint32_t(entries.size());
+
+    std::vector<SpectrumFileEntry> table(entries.size());
+    size_t offset = AlignUp(sizeof(header) + table.size() * sizeof(SpectrumFileEntry));
+    for(size_t i = 0; i < entries.size(); ++i)
+    {
+        SpectrumFileEntry& e = table[i];
+        e = SpectrumFileEntry{};
+        std::strncpy(e.name, entries[i].name.c_str(), sizeof(e.name) - 1);
+        for(int j = 0; j < 9; ++j) e.RGBFromXYZ[j] = entries[i].RGBFromXYZ[j / 3][j % 3];
+        e.zNodesOffset = offset;
+        e.coeffsOffset = offset + ZNodesBytes;
+        offset = AlignUp(e.coeffsOffset + CoeffsBytes);
+    }
+
+    // 先写临时文件再改名，避免别的进程映射到写了一半的文件
+    std::string tmp = unique_temp_path(filename);
+    FILE* f = fopen(tmp.c_str(), "wb");
+    if(!f) return false;
+    bool ok = fwrite(&header, sizeof(header), 1, f) == 1 &&
+              fwrite(table.data(), sizeof(SpectrumFileEntry), table.size(), f) == table.size();
+    auto pad_to = [&](size_t pos)
+    {
+        static const char zeros[4096] = {};
+        long cur = ftell(f);
+        if(cur < 0 || size_t(cur) > pos) return false;
+        for(size_t left = pos - size_t(cur); left > 0;)
+        {
+            size_t n = std::min(left, sizeof(zeros));
+            if(fwrite(zeros, 1, n, f) != n) return false;
+            left -= n;
+        }
+        return true;
+    };
+    for(size_t i = 0; ok && i < entries.size(); ++i)
+    {
+        ok = pad_to(table[i].zNodesOffset) &&
+             fwrite(entries[i].zNodes, 1, ZNodesBytes, f) == ZNodesBytes &&
+             fwrite(entries[i].coeffs, 1, CoeffsBytes, f) == CoeffsBytes;
+    }
+    ok = ok && pad_to(offset);
+    ok = (fclose(f) == 0) && ok;
+    std::error_code ec;
+    if(ok) std::filesystem::rename(tmp, filename, ec);
+    if(!ok || ec)
+    {
+        std::filesystem::remove(tmp, ec);
+        return false;
+    }
+    return true;
+}
+
+shared_ptr<RGBToSpectrumTableFile> RGBToSpectrumTableFile::Open(const std::string& filename)
+{
+    auto f = mapped_file::open(filename);
+    if(!f || f->size() < sizeof(SpectrumFileHeader)) return nullptr;
+    SpectrumFileHeader header;
+    std::memcpy(&header, f->data(), sizeof(header));
+    if(std::memcmp(header.magic, SpectrumFileMagic, sizeof(SpectrumFileMagic)) != 0 ||
+       header.version != SpectrumFileVersion || header.res != RGBToSpectrumTable::res ||
+       f->size() < sizeof(header) + size_t(header.count) * sizeof(SpectrumFileEntry))
+    {
+        return nullptr;
+    }
+    shared_ptr<RGBToSpectrumTableFile> table(new RGBToSpectrumTableFile());
+    table->file = f;
+    return table;
+}
+
+bool RGBToSpectrumTableFile::Find(const std::string& name, const SquareMatrix<3>& RGBFromXYZ,
+                                  const float** zNodes, const RGBToSpectrumTable::CoefficientArray** coeffs) const
+{
+    SpectrumFileHeader header;
+    std::memcpy(&header, file->data(), sizeof(header));
+    for(uint32_t i = 0; i < header.count; ++i)
+    {
+        SpectrumFileEntry e;
+        std::memcpy(&e, file->data() + sizeof(header) + i * sizeof(SpectrumFileEntry), sizeof(e));
+        e.name[sizeof(e.name) - 1] = '\0';
+        if(name != e.name) continue;
+        bool same = true;
+        for(int j = 0; j < 9; ++j)
+        {
+            float m = RGBFromXYZ[j / 3][j % 3];
+            same = same && std::abs(e.RGBFromXYZ[j] - m) <= 1e-4f * std::max(1.f, std::abs(m));
+        }
+        if(!same || e.zNodesOffset % alignof(float) != 0 || e.coeffsOffset % alignof(float) != 0 ||
+           e.zNodesOffset + ZNodesBytes > file->size() || e.coeffsOffset + CoeffsBytes > file->size())
+        {
+            return false;
+        }
+        *zNodes = reinterpret_cast<const float*>(file->data() + e.zNodesOffset);
+        *coeffs = reinterpret_cast<const RGBToSpectrumTable::CoefficientArray*>(file->data() + e.coeffsOffset);
+        return true;
+    }
+    return false;
+}
+
+std::string RGBToSpectrumTableFile::DefaultPath()
+{
+    auto path = getenv("RTW_SPECTRUM_TABLES");
+    if(path) return path;
+    return "rgbspectrum.rtwspec";
+}
+
+static std::string& SpectrumCacheDirectory()
+{
+    static std::string dir;
+    return dir;
+}
+
+void RGBToSpectrumTableFile::SetCacheDirectory(const std::string& dir)
+{
+    SpectrumCacheDirectory() = dir;
+}
+
+std::string RGBToSpectrumTableFile::CachePath(const std::string& name)
+{
+    std::string dir = SpectrumCacheDirectory();
+    if(dir.empty())
+    {
+        auto env = getenv("RTW_SPECTRUM_CACHE");
+        if(!env) return {};
+        dir = env;
+    }
+    std::filesystem::path path(DefaultPath());
+    return (std::filesystem::path(dir) / (path.stem().string() + "-" + name + path.extension().string())).string();
+}
@@ -0,0 +1,62 @@
+#ifndef RGB2SPEC_H
+#define RGB2SPEC_H
+#include "rtweekend.h"
+#include "vecmath.h"
+#include "color.h"
+#include "spectrum.h"
+#include "mapped_file.h"
+#include <span>
+#include <string>
+#include <vector>
+
+// RGB -> sigmoid 多项式系数表的数据部分，布局与 RGBToSpectrumTable::CoefficientArray 一致
+struct RGBToSpectrumTableData
+{
+    std::vector<float> zNodes;
+    std::vector<float> coeffs;
+
+    const RGBToSpectrumTable::CoefficientArray* Coefficients() const
+    {
+        return reinterpret_cast<const RGBToSpectrumTable::CoefficientArray*>(coeffs.data());
+    }
+};
+
+// 对给定颜色空间逐格点用 Gauss-Newton 求解系数 (Jakob & Hanika 2019, rgb2spec_opt)
+std::unique_ptr<RGBToSpectrumTableData> ComputeRGBToSpectrumTable(
+    const SquareMatrix<3>& XYZFromRGB, const SquareMatrix<3>& RGBFromXYZ, Spectrum illuminant);
+
+// .rtwspec 文件：文件头 + 每个颜色空间一个目录项，系数表按页对齐紧随其后。
+// 文件整体 mmap，只有真正被用到的颜色空间的页面才会被换入内存。
+struct RGBToSpectrumTableEntry
+{
+    std::string name;
+    SquareMatrix<3> RGBFromXYZ;   // 用来确认表和颜色空间是匹配的
+    const float* zNodes;
+    const float* coeffs;
+};
+
+bool WriteRGBToSpectrumTables(const std::string& filename, std::span<const RGBToSpectrumTableEntry> entries);
+
+class RGBToSpectrumTableFile
+{
+public:
+    static shared_ptr<RGBToSpectrumTableFile> Open(const std::string& filename);
+
+    // 找到名字和矩阵都一致的表，返回的指针指向映射内存，生命周期与本对象相同
+    bool Find(const std::string& name, const SquareMatrix<3>& RGBFromXYZ, const float** zNodes,
+              const RGBToSpectrumTable::CoefficientArray** coeffs) const;
+
+    size_t size() const { return file->size(); }
+    size_t ResidentBytes() const { return file->resident_bytes(); }
+
+    // 所有颜色空间共用的表文件：$RTW_SPECTRUM_TABLES，默认是当前目录下的 rgbspectrum.rtwspec
+    static std::string DefaultPath();
+    // 只包含一个颜色空间、运行时现场拟合后写出的缓存文件，放在 SetCacheDirectory 设置的目录
+    // （没设置时用 $RTW_SPECTRUM_CACHE）下；两者都没有时返回空串，拟合结果不写到磁盘
+    static std::string CachePath(const std::string& name);
+    static void SetCacheDirectory(const std::string& dir);
+
+private:
+    shared_ptr<mapped_file> file;
+};
+#endif
@@ -9,30 +9,36 @@
 #include "extern/stb_image.h"
 #include <cstdlib>
 #include <iostream>
+#include <vector>
+#include <cstdio>
+#include <string>
+#include "parallel.h"
 class rtw_image{
 public:
     rtw_image(){}
     rtw_image(const char* image_filename){
-        // 从指定的文件加载图像数据。如果定义了 RTW_IMAGES 环境变量，
-        // 则只在该目录中查找图像文件。如果找不到图像，
+        std::string filename = find_image_file(image_filename);
+        if(!filename.empty() && load(filename)) return;
+
+        std::cerr<<"ERROR: Could not load image file'"<<image_filename<<"'.\n";
+    }
+    static std::string find_image_file(const char* image_filename){
+        // 查找图像文件。如果定义了 RTW_IMAGES 环境变量，
+        // 则先在该目录中查找图像文件。如果找不到图像，
         // 首先从当前目录开始搜索指定的图像文件，然后在 images/ 子目录中搜索，
         // 接着是 父目录 的 images/ 子目录，然后是 那个父目录的父目录，依此类推，
-        // 向上搜索六个级别。如果图像没有成功加载，
-        // width() 和 height() 将返回 0。
+        // 向上搜索六个级别。找不到时返回空字符串。
         std::string filename = std::string(image_filename);
         auto imagedir = getenv("RTW_IMAGES");
 
-        if(imagedir && load(std::string(imagedir) + "/" + filename)) return;
-        if(load(filename)) return;
-        if(load("images/"+filename)) return;
-        if(load("../images/"+filename)) return;
-        if(load("../../images/"+filename)) return;
-        if(load("../../../images/"+filename)) return;
-        if(load("../../../../images/"+filename)) return;
-        if(load("../../../../../images/"+filename)) return;
-        if(load("../../../../../../images/"+filename)) return;
-
-        std::cerr<<"ERROR: Could not load image file'"<<image_filename<<"'.\n";
+        if(imagedir && exists(std::string(imagedir) + "/" + filename)) return std::string(imagedir) + "/" + filename;
+        if(exists(filename)) return filename;
+        std::string prefix = "";
+        for(int i = 0; i <= 6; i++){
+            if(exists(prefix + "images/" + filename)) return prefix + "images/" + filename;
+            prefix += "../";
+        }
+        return "";
     }
     bool load(const std::string& filename){
         // 从给定的文件名加载线性（gamma=1）图像数据。
@@ -41,29 +47,37 @@ public:
         // 范围内的浮点值（首先是红色，然后是绿色，然后是蓝色）。
         // 像素是连续的，从图像的宽度方向从左到右，接着是下一行，
         // 直到整个图像的高度。
+        // 浮点数据只在转换期间存在，转换为 8bit 后立即释放，只保留一份紧凑的数据。
         int n = bytes_per_pixel;
-        fdata = stbi_loadf(filename.c_str(),&image_width,&image_height,&n,bytes_per_pixel);
+        float* fdata = stbi_loadf(filename.c_str(),&image_width,&image_height,&n,bytes_per_pixel);
         if (fdata == nullptr) return false;
         bytes_per_scanline = image_width * bytes_per_pixel;
-        convert_to_bytes();
+        convert_to_bytes(fdata);
+        stbi_image_free(fdata);
         return true;
     }
-    int width() const {return (fdata == nullptr) ? 0 : image_width;}
-    int height() const {return (fdata == nullptr) ? 0 : image_height;}
+    int width() const {return bdata.empty() ? 0 : image_width;}
+    int height() const {return bdata.empty() ? 0 : image_height;}
+    const unsigned char* data() const {return bdata.data();}
     const unsigned char* pixel_data(int x,int y) const{
         static unsigned char magenta[] = {255,0,255};
-        if(bdata == nullptr) return magenta;
+        if(bdata.empty()) return magenta;
         x = clamp(x,0,image_width);
         y = clamp(y,0,image_height);
-        return bdata + y * bytes_per_scanline + x * bytes_per_pixel;
+        return bdata.data() + y * bytes_per_scanline + x * bytes_per_pixel;
     }
+    static const int bytes_per_pixel = 3;
 private:
-    const int bytes_per_pixel = 3;
-    float    *fdata = nullptr; // Linear floating point pixel data 每个像素的0~1的值
-    unsigned char *bdata = nullptr; //// Linear 8-bit pixel data 转换为8bit的颜色值
+    std::vector<unsigned char> bdata; // Linear 8-bit pixel data 转换为8bit的颜色值
     int       image_width = 0;
     int       image_height = 0;
     int       bytes_per_scanline = 0;
+    static bool exists(const std::string& filename){
+        FILE* f = fopen(filename.c_str(), "rb");
+        if(!f) return false;
+        fclose(f);
+        return true;
+    }
     static int clamp(int x,int low,int high){
         if (x<low) return low;
         if (x<high) return x;
@@ -74,16 +88,17 @@ private:
         if (value >= 1.0) return 255;
         return static_cast<unsigned char>(256.0 * value);//这里希望，比如0.99可以转换为255
     }
-    void convert_to_bytes(){
+    void convert_to_bytes(const float* fdata){
         // Convert the linear floating point pixel data to bytes, storing the resulting byte
         // data in the `bdata` member.
-        int total_bytes = image_width * image_height * bytes_per_pixel;
-        bdata = new unsigned char[total_bytes];
-        unsigned char *bptr = bdata;
-        float *fptr = fdata;
-        for (int i=0;i<total_bytes;i++,bptr++,fptr++){
-            *bptr = float_to_byte(*fptr);
-        }
+        int64_t total_bytes = int64_t(image_width) * image_height * bytes_per_pixel;
+        bdata.resize(total_bytes);
+        unsigned char *bptr = bdata.data();
+        ParallelFor(0, total_bytes, 0, [&](int64_t start, int64_t end){
+            for (int64_t i=start;i<end;i++){
+                bptr[i] = float_to_byte(fdata[i]);
+            }
+        });
     }
 };
 // Restore MSVC compiler warnings
@@ -1,12 +1,14 @@
 #ifndef RTWEEKEND_H
 #define RTWEEKEND_H
 #include <cmath>
+#include <cstdint>
 #include <iostream>
 #include <limits>
 #include <memory>
 #include <cmath>
 #include <span>
 #include <map>
+#include <utility>
 using std::shared_ptr;
 using std::make_shared;
 
@@ -16,8 +18,99 @@ const double pi=3.1415926535897932385;
 inline double degrees_to_radians(double degree){
     return degree * pi / 180.0;
 }
+inline double radians_to_degrees(double radians){
+    return radians * 180.0 / pi;
+}
+// PCG32（O'Neill），状态只有两个 64 位整数，可以 O(log n) 跳过任意多个数，
+// 渲染时每个样本按 (种子, 像素, 样本序号) 定位到自己的位置，结果与线程数、tile 划分和中断续渲无关
+class pcg32{
+public:
+    pcg32() { set_sequence(0); }
+    pcg32(uint64_t sequence, uint64_t offset = default_state) { set_sequence(sequence, offset); }
+
+    void set_sequence(uint64_t sequence, uint64_t offset = default_state){
+        state = 0u;
+        inc = (sequence << 1u) | 1u;
+        next();
+        state += offset;
+        next();
+    }
+    uint32_t next(){
+        uint64_t old = state;
+        state = old * multiplier + inc;
+        uint32_t xorshifted = uint32_t(((old >> 18u) ^ old) >> 27u);
+        uint32_t rot = uint32_t(old >> 59u);
+        return (xorshifted >> rot) | (xorshifted << ((~rot + 1u) & 31));
+    }
+    // [0, 1)
+    double uniform(){
+        return next() * 0x1p-32;
+    }
+    // 向前跳 delta 个数
+    void advance(uint64_t delta){
+        uint64_t cur_mult = multiplier, cur_plus = inc, acc_mult = 1u, acc_plus = 0u;
+        while(delta > 0){
+            if(delta & 1){
+                acc_mult *= cur_mult;
+                acc_plus = acc_plus * cur_mult + cur_plus;
+            }
+            cur_plus = (cur_mult + 1) * cur_plus;
+            cur_mult *= cur_mult;
+            delta /= 2;
+        }
+        state = acc_mult * state + acc_plus;
+    }
+private:
+    static constexpr uint64_t default_state = 0x853c49e6748fea9bULL;
+    static constexpr uint64_t multiplier = 0x5851f42d4c957f2dULL;
+    uint64_t state, inc;
+};
+
+// 64 位整数混合（MurmurHash3 的 finalizer），把种子和坐标打散成序列号
+inline uint64_t mix_bits(uint64_t v){
+    v ^= v >> 33;
+    v *= 0xff51afd7ed558ccdULL;
+    v ^= v >> 33;
+    v *= 0xc4ceb9fe1a85ec53ULL;
+    v ^= v >> 33;
+    return v;
+}
+
+// 每个线程一个生成器，没有采样器时（例如构建场景）random_double 从这里取数
+inline pcg32& random_generator(){
+    static thread_local pcg32 rng;
+    return rng;
+}
+inline void seed_random(uint64_t seed){
+    random_generator().set_sequence(mix_bits(seed));
+}
+
+// 采样器接口，各种实现在 sampler.h。相机在每个样本开始时调用 StartPixelSample，把采样器设为本线程的
+// active_sampler，之后路径上的 random_double / random_double2 依次取它的各个维度。
+class Sampler{
+public:
+    virtual ~Sampler() = default;
+    virtual void StartPixelSample(int x, int y, uint32_t sampleIndex) = 0;
+    virtual double Get1D() = 0;
+    virtual std::pair<double, double> Get2D() = 0;
+    // 像素内的位置，分层采样器在这里使用像素内的网格
+    virtual std::pair<double, double> GetPixel2D() { return Get2D(); }
+    virtual std::unique_ptr<Sampler> Clone() const = 0;
+};
+
+inline Sampler*& active_sampler(){
+    static thread_local Sampler* sampler = nullptr;
+    return sampler;
+}
 inline double random_double(){
-    return std::rand() / (RAND_MAX + 1.0);
+    Sampler* sampler = active_sampler();
+    return sampler ? sampler->Get1D() : random_generator().uniform();
+}
+// 二维采样（方向、面光源上的点等）用它取一对数，低差异采样器保证这两维一起分层
+inline std::pair<double, double> random_double2(){
+    if(Sampler* sampler = active_sampler()) return sampler->Get2D();
+    double u = random_generator().uniform();
+    return {u, random_generator().uniform()};
 }
 inline double random_double(double min,double max){
     return min + (max-min) * random_double();
@@ -0,0 +1,390 @@
+#ifndef SAMPLER_H
+#define SAMPLER_H
+#include "rtweekend.h"
+#include <algorithm>
+#include <bit>
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <vector>
+
+// 采样器的实现，接口 Sampler 在 rtweekend.h。除了 independent，其余都让同一个像素的 spp 个样本在每一维（或每两维）上分层，
+// 相同 spp 下误差更低。每个样本取多少维由路径决定（相机、材质、pdf 依次调用 random_double / random_double2）。
+// 所有采样器只依赖 (种子, 像素, 样本序号)，与线程和 tile 划分无关，检查点续渲也逐位一致。
+// 算法来自 pbrt-v4 的 IndependentSampler / StratifiedSampler / HaltonSampler / PaddedSobolSampler，
+// 蓝噪声按 Georgiev & Fajardo 的做法用一张 void-and-cluster 掩码对 Sobol 点做逐像素的平移。
+enum class sampler_type{
+    independent,
+    stratified,
+    halton,
+    sobol,
+    blue_noise
+};
+
+inline std::optional<sampler_type> parse_sampler_type(const std::string& name){
+    if(name == "independent") return sampler_type::independent;
+    if(name == "stratified") return sampler_type::stratified;
+    if(name == "halton") return sampler_type::halton;
+    if(name == "sobol") return sampler_type::sobol;
+    if(name == "blue-noise" || name == "bluenoise") return sampler_type::blue_noise;
+    return std::nullopt;
+}
+
+inline constexpr double OneMinusEpsilon = 0x1.fffffffffffffp-1;
+
+inline uint64_t SampleHash(int x, int y, uint64_t a, uint64_t b = 0){
+    return mix_bits(mix_bits(mix_bits((uint64_t(uint32_t(x)) << 32) | uint32_t(y)) ^ a) ^ b);
+}
+
+// [0, l) 的一个伪随机排列中第 i 个元素，排列由 p 决定（Kensler, "Correlated Multi-Jittered Sampling"）
+inline uint32_t PermutationElement(uint32_t i, uint32_t l, uint32_t p){
+    uint32_t w = l - 1;
+    w |= w >> 1;
+    w |= w >> 2;
+    w |= w >> 4;
+    w |= w >> 8;
+    w |= w >> 16;
+    do{
+        i ^= p;
+        i *= 0xe170893d;
+        i ^= p >> 16;
+        i ^= (i & w) >> 4;
+        i ^= p >> 8;
+        i *= 0x0929eb3f;
+        i ^= p >> 23;
+        i ^= (i & w) >> 1;
+        i *= 1 | p >> 27;
+        i *= 0x6935fa69;
+        i ^= (i & w) >> 11;
+        i *= 0x74dcb303;
+        i ^= (i & w) >> 2;
+        i *= 0x9e501cc3;
+        i ^= (i & w) >> 2;
+        i *= 0xc860a3df;
+        i &= w;
+        i ^= i >> 5;
+    }while(i >= l);
+    return (i + p) % l;
+}
+
+inline uint32_t ReverseBits32(uint32_t n){
+    n = (n << 16) | (n >> 16);
+    n = ((n & 0x00ff00ff) << 8) | ((n & 0xff00ff00) >> 8);
+    n = ((n & 0x0f0f0f0f) << 4) | ((n & 0xf0f0f0f0) >> 4);
+    n = ((n & 0x33333333) << 2) | ((n & 0xcccccccc) >> 2);
+    n = ((n & 0x55555555) << 1) | ((n & 0xaaaaaaaa) >> 1);
+    return n;
+}
+
+// 近似的 Owen 扰乱（Burley 的 hash 版本），保持 Sobol 点的分层性质
+inline uint32_t FastOwenScramble(uint32_t v, uint32_t seed){
+    v = ReverseBits32(v);
+    v ^= v * 0x3d20adea;
+    v += seed;
+    v *= (seed >> 16) | 1;
+    v ^= v * 0x05526c56;
+    v ^= v * 0x53a22864;
+    return ReverseBits32(v);
+}
+
+// Sobol 序列的前两维：第 0 维是按位反转（van der Corput），第 1 维的生成矩阵是模 2 的 Pascal 矩阵。
+// 两维合起来是 (0,2) 序列，前 2^k 个点在每种 2^a x 2^b = 2^k 的网格划分里都恰好每格一个
+inline uint32_t Sobol2D(uint32_t a, int dimension){
+    if(dimension == 0) return ReverseBits32(a);
+    uint32_t v = 0;
+    for(uint32_t column = 0x80000000u; a != 0; a >>= 1, column ^= column >> 1){
+        if(a & 1) v ^= column;
+    }
+    return v;
+}
+
+inline double SobolSample(uint32_t a, int dimension, uint32_t scramble){
+    return std::min(FastOwenScramble(Sobol2D(a, dimension), scramble) * 0x1p-32, OneMinusEpsilon);
+}
+
+// 每个样本从 (种子, 像素, 样本序号) 对应的位置开始取 pcg32，与 spp 无关
+class IndependentSampler : public Sampler{
+public:
+    explicit IndependentSampler(unsigned seed) : seed(seed) {}
+    void StartPixelSample(int x, int y, uint32_t sampleIndex) override{
+        rng.set_sequence(SampleHash(x, y, seed));
+        rng.advance(uint64_t(sampleIndex) << 16);
+    }
+    double Get1D() override { return rng.uniform(); }
+    std::pair<double, double> Get2D() override{
+        double u = rng.uniform();
+        return {u, rng.uniform()};
+    }
+    std::unique_ptr<Sampler> Clone() const override { return std::make_unique<IndependentSampler>(*this); }
+private:
+    unsigned seed;
+    pcg32 rng;
+};
+
+// 每一维把 [0,1) 分成 spp 层，每个样本占一层并在层内抖动；哪个样本占哪一层在每一维上随机排列，维度之间不相关。
+// 二维按 x_samples * y_samples = spp 的网格分层，spp 不是平方数时取最接近正方形的分解，不丢样本
+class StratifiedSampler : public Sampler{
+public:
+    StratifiedSampler(int spp, unsigned seed) : spp(uint32_t(std::max(1, spp))), seed(seed){
+        x_samples = int(std::sqrt(double(this->spp)));
+        while(this->spp % x_samples) x_samples--;
+        y_samples = int(this->spp) / x_samples;
+    }
+    void StartPixelSample(int x, int y, uint32_t sampleIndex) override{
+        pixel_hash = SampleHash(x, y, seed);
+        index = sampleIndex;
+        dimension = 0;
+        rng.set_sequence(pixel_hash);
+        rng.advance(uint64_t(sampleIndex) << 16);
+    }
+    double Get1D() override{
+        uint32_t stratum = PermutationElement(index, spp, uint32_t(mix_bits(pixel_hash ^ dimension)));
+        dimension++;
+        return (stratum + rng.uniform()) / spp;
+    }
+    std::pair<double, double> Get2D() override{
+        uint32_t stratum = PermutationElement(index, spp, uint32_t(mix_bits(pixel_hash ^ dimension)));
+        dimension += 2;
+        int x = int(stratum) % x_samples, y = int(stratum) / x_samples;
+        double dx = rng.uniform(), dy = rng.uniform();
+        return {(x + dx) / x_samples, (y + dy) / y_samples};
+    }
+    std::unique_ptr<Sampler> Clone() const override { return std::make_unique<StratifiedSampler>(*this); }
+private:
+    uint32_t spp;
+    unsigned seed;
+    int x_samples, y_samples;
+    uint64_t pixel_hash = 0;
+    uint32_t index = 0, dimension = 0;
+    pcg32 rng;
+};
+
+// 第 d 维取以第 d 个素数为底的根反演，每个像素、每一维用不同的嵌套扰乱去相关：每一位数字按它前面的数字决定的
+// 随机量循环平移（底为 2 时与 Owen 扰乱相同），保持分层。
+// 与 pbrt 不同，这里按像素内的样本序号取点，不把整幅图像映射到同一个序列上。维数超过素数表时退回随机数
+class HaltonSampler : public Sampler{
+public:
+    explicit HaltonSampler(unsigned seed) : seed(seed) {}
+    void StartPixelSample(int x, int y, uint32_t sampleIndex) override{
+        pixel_hash = SampleHash(x, y, seed);
+        index = sampleIndex;
+        dimension = 0;
+        rng.set_sequence(pixel_hash);
+        rng.advance(uint64_t(sampleIndex) << 16);
+    }
+    double Get1D() override{
+        const std::vector<int>& primes = Primes();
+        if(dimension >= primes.size()) return rng.uniform();
+        uint32_t d = dimension++;
+        return OwenScrambledRadicalInverse(primes[d], index, mix_bits(pixel_hash ^ (uint64_t(d) + 1)));
+    }
+    std::pair<double, double> Get2D() override{
+        double u = Get1D();
+        return {u, Get1D()};
+    }
+    std::unique_ptr<Sampler> Clone() const override { return std::make_unique<HaltonSampler>(*this); }
+
+    // 前 1024 个素数，第一次使用时筛出来
+    static const std::vector<int>& Primes(){
+        static const std::vector<int> primes = []{
+            std::vector<int> p;
+            std::vector<bool> composite(8192, false);
+            for(int i = 2; i < 8192 && p.size() < 1024; i++){
+                if(composite[i]) continue;
+                p.push_back(i);
+                for(int j = i * i; j < 8192; j += i) composite[j] = true;
+            }
+            return p;
+        }();
+        return primes;
+    }
+private:
+    // 每一位数字按 (hash, 更低位的数字) 决定的量平移。样本序号的数字用完之后剩下的全是 0，
+    // 逐位扰乱的结果在当前区间内均匀分布，用一个 hash 出来的均匀数代替，不必再一位一位地算
+    static double OwenScrambledRadicalInverse(int base, uint64_t a, uint64_t hash){
+        double inv_base = 1.0 / base, inv_base_m = 1;
+        uint64_t reversed_digits = 0;
+        while(a != 0){
+            uint64_t next = a / base;
+            uint32_t digit = uint32_t(a - next * base);
+            digit = uint32_t((digit + mix_bits(hash ^ reversed_digits)) % base);
+            reversed_digits = reversed_digits * base + digit;
+            inv_base_m *= inv_base;
+            a = next;
+        }
+        double tail = (mix_bits(hash ^ reversed_digits ^ 0x9e3779b97f4a7c15ULL) >> 11) * 0x1p-53;
+        return std::min(inv_base_m * (double(reversed_digits) + tail), OneMinusEpsilon);
+    }
+
+    unsigned seed;
+    uint64_t pixel_hash = 0;
+    uint32_t index = 0, dimension = 0;
+    pcg32 rng;
+};
+
+// pbrt 的 PaddedSobolSampler：每一维（或每两维）都用 Sobol 序列的前两维，样本序号在每一维上随机排列、
+// 点做 Owen 扰乱，维度之间不相关但每一维内部是 (0,2) 序列。spp 为 2 的幂时分层最好
+class SobolSampler : public Sampler{
+public:
+    SobolSampler(int spp, unsigned seed) : spp(uint32_t(std::max(1, spp))), seed(seed) {}
+    void StartPixelSample(int x, int y, uint32_t sampleIndex) override{
+        pixel_hash = SampleHash(x, y, seed);
+        index = sampleIndex;
+        dimension = 0;
+    }
+    double Get1D() override{
+        uint64_t hash = mix_bits(pixel_hash ^ dimension);
+        uint32_t i = PermutationElement(index, spp, uint32_t(hash));
+        dimension++;
+        return SobolSample(i, 0, uint32_t(hash >> 32));
+    }
+    std::pair<double, double> Get2D() override{
+        uint64_t hash = mix_bits(pixel_hash ^ dimension);
+        uint32_t i = PermutationElement(index, spp, uint32_t(hash));
+        dimension += 2;
+        uint64_t scramble = mix_bits(hash);
+        return {SobolSample(i, 0, uint32_t(scramble)), SobolSample(i, 1, uint32_t(scramble >> 32))};
+    }
+    std::unique_ptr<Sampler> Clone() const override { return std::make_unique<SobolSampler>(*this); }
+private:
+    uint32_t spp;
+    unsigned seed;
+    uint64_t pixel_hash = 0;
+    uint32_t index = 0, dimension = 0;
+};
+
+// 每个像素用同一组 Sobol 点（每一维的扰乱只取决于维度和种子），再按蓝噪声掩码在 [0,1) 上循环平移。
+// 相邻像素的平移量差得尽量远，误差在屏幕上表现为高频噪声，低 spp 时看起来更平滑。
+// 不同维度在掩码上取不同的偏移，相当于用了多张去相关的掩码
+class BlueNoiseSampler : public Sampler{
+public:
+    static constexpr int MaskSize = 64;
+
+    BlueNoiseSampler(int spp, unsigned seed) : spp(uint32_t(std::max(1, spp))), seed(seed) {}
+    void StartPixelSample(int x, int y, uint32_t sampleIndex) override{
+        px = x;
+        py = y;
+        index = sampleIndex;
+        dimension = 0;
+    }
+    double Get1D() override{
+        uint64_t hash = mix_bits((uint64_t(dimension) << 32) ^ seed);
+        uint32_t i = PermutationElement(index, spp, uint32_t(hash));
+        double u = SobolSample(i, 0, uint32_t(hash >> 32)) + Shift(dimension);
+        dimension++;
+        return u < 1 ? u : u - 1;
+    }
+    std::pair<double, double> Get2D() override{
+        uint64_t hash = mix_bits((uint64_t(dimension) << 32) ^ seed);
+        uint32_t i = PermutationElement(index, spp, uint32_t(hash));
+        uint64_t scramble = mix_bits(hash);
+        double u = SobolSample(i, 0, uint32_t(scramble)) + Shift(dimension);
+        double v = SobolSample(i, 1, uint32_t(scramble >> 32)) + Shift(dimension + 1);
+        dimension += 2;
+        return {u < 1 ? u : u - 1, v < 1 ? v : v - 1};
+    }
+    std::unique_ptr<Sampler> Clone() const override { return std::make_unique<BlueNoiseSampler>(*this); }
+
+    // MaskSize x MaskSize 的蓝噪声掩码，值为 (排名 + 0.5) / 像素数，第一次使用时用 void-and-cluster 生成
+    static const std::vector<float>& Mask(){
+        static const std::vector<float> mask = GenerateMask();
+        return mask;
+    }
+private:
+    double Shift(uint32_t d) const{
+        uint64_t offset = mix_bits(uint64_t(d) + 1);
+        int x = (px + int(offset & (MaskSize - 1))) & (MaskSize - 1);
+        int y = (py + int((offset >> 8) & (MaskSize - 1))) & (MaskSize - 1);
+        return Mask()[y * MaskSize + x];
+    }
+
+    // Ulichney 的 void-and-cluster：能量是已选点的环面高斯卷积，反复从最密处取点、往最空处放点
+    static std::vector<float> GenerateMask(){
+        constexpr int N = MaskSize * MaskSize;
+        constexpr double sigma = 1.9;
+        std::vector<double> kernel(N);
+        for(int y = 0; y < MaskSize; y++){
+            for(int x = 0; x < MaskSize; x++){
+                int dx = std::min(x, MaskSize - x), dy = std::min(y, MaskSize - y);
+                kernel[y * MaskSize + x] = std::exp(-(dx * dx + dy * dy) / (2 * sigma * sigma));
+            }
+        }
+        std::vector<double> energy(N, 0);
+        std::vector<char> on(N, 0);
+        auto splat = [&](int p, double sign){
+            int px = p % MaskSize, py = p / MaskSize;
+            for(int y = 0; y < MaskSize; y++){
+                int ky = ((y - py) & (MaskSize - 1)) * MaskSize;
+                for(int x = 0; x < MaskSize; x++) energy[y * MaskSize + x] += sign * kernel[ky + ((x - px) & (MaskSize - 1))];
+            }
+        };
+        auto tightest_cluster = [&]{
+            int best = -1;
+            for(int i = 0; i < N; i++) if(on[i] && (best < 0 || energy[i] > energy[best])) best = i;
+            return best;
+        };
+        auto largest_void = [&]{
+            int best = -1;
+            for(int i = 0; i < N; i++) if(!on[i] && (best < 0 || energy[i] < energy[best])) best = i;
+            return best;
+        };
+
+        // 初始图案：随机撒 1/10 的点，再把最密的点挪到最空处，直到不再变化（最多 N 步，防止来回振荡）
+        pcg32 rng(0x5eed);
+        int ones = 0;
+        while(ones < N / 10){
+            int p = int(rng.next() % N);
+            if(on[p]) continue;
+            on[p] = 1;
+            splat(p, 1);
+            ones++;
+        }
+        for(int step = 0; step < N; step++){
+            int cluster = tightest_cluster();
+            on[cluster] = 0;
+            splat(cluster, -1);
+            int empty = largest_void();
+            on[empty] = 1;
+            splat(empty, 1);
+            if(empty == cluster) break;
+        }
+
+        std::vector<int> rank(N);
+        std::vector<char> initial = on;
+        std::vector<double> initial_energy = energy;
+        for(int r = ones - 1; r >= 0; r--){
+            int cluster = tightest_cluster();
+            on[cluster] = 0;
+            splat(cluster, -1);
+            rank[cluster] = r;
+        }
+        on = initial;
+        energy = initial_energy;
+        for(int r = ones; r < N; r++){
+            int empty = largest_void();
+            on[empty] = 1;
+            splat(empty, 1);
+            rank[empty] = r;
+        }
+        std::vector<float> mask(N);
+        for(int i = 0; i < N; i++) mask[i] = (rank[i] + 0.5f) / N;
+        return mask;
+    }
+
+    uint32_t spp;
+    unsigned seed;
+    int px = 0, py = 0;
+    uint32_t index = 0, dimension = 0;
+};
+
+inline std::unique_ptr<Sampler> CreateSampler(sampler_type type, int spp, unsigned seed){
+    switch(type){
+    case sampler_type::independent: return std::make_unique<IndependentSampler>(seed);
+    case sampler_type::stratified: return std::make_unique<StratifiedSampler>(spp, seed);
+    case sampler_type::halton: return std::make_unique<HaltonSampler>(seed);
+    case sampler_type::sobol: return std::make_unique<SobolSampler>(spp, seed);
+    case sampler_type::blue_noise: return std::make_unique<BlueNoiseSampler>(spp, seed);
+    }
+    return std::make_unique<IndependentSampler>(seed);
+}
+#endif
@@ -0,0 +1,42 @@
+#ifndef SCENE_H
+#define SCENE_H
+#include "rtweekend.h"
+#include "camera.h"
+#include "hittable_list.h"
+#include "bvh.h"
+#include "light_list.h"
+#include <chrono>
+#include <string>
+
+// 一个可渲染的场景：几何体、可选的光源（用于重要性采样）以及相机参数
+struct scene{
+    std::string name;
+    shared_ptr<hittable> world;
+    shared_ptr<hittable> lights;   // 为空时只按材质采样
+    camera cam;
+    double bvh_build_ms = 0;
+    double load_ms = 0;            // 构建或从缓存读回场景的总耗时，只有 make_scene 带缓存目录时才统计
+    bool from_cache = false;
+
+    explicit scene(std::string name) : name(std::move(name)) {}
+
+    // 构建 BVH，并把耗时累加到 bvh_build_ms
+    shared_ptr<hittable> build_bvh(hittable_list& list){
+        auto t1 = std::chrono::steady_clock::now();
+        auto node = make_shared<bvh_node>(list.objects, 0, list.objects.size() - 1);
+        auto t2 = std::chrono::steady_clock::now();
+        bvh_build_ms += std::chrono::duration<double, std::milli>(t2 - t1).count();
+        return node;
+    }
+
+    // 把 world 中所有发光的图元收集成光源列表，代替手工重复一份光源几何体
+    void collect_lights(){
+        lights = light_list::collect(world);
+    }
+
+    void render(){
+        if(lights) cam.render(*world, *lights);
+        else cam.render(*world);
+    }
+};
+#endif
@@ -0,0 +1,626 @@
+#ifndef SCENE_CACHE_H
+#define SCENE_CACHE_H
+#include "rtweekend.h"
+#include "hittable_list.h"
+#include "sphere.h"
+#include "quad.h"
+#include "constant_medium.h"
+#include "heterogeneous_medium.h"
+#include "texture.h"
+#include "material.h"
+#include "linear_bvh.h"
+#include "light_list.h"
+#include "mapped_file.h"
+#include "scene.h"
+#include <cstring>
+#include <filesystem>
+#include <optional>
+#include <unordered_map>
+#include <vector>
+
+// 构建好的场景（物体、材质、纹理、BVH 和相机）的二进制缓存，.rtwscene 文件。
+//
+// 文件头之后依次是纹理、材质、物体三张定长记录表，记录之间用表内下标互相引用，
+// 被引用的记录总是排在前面；变长数据（子物体列表、文件名、噪声表）放在 blob 区。
+// BVH 节点按页对齐存放，是展平后的 linear_bvh_node，读回时直接在映射的内存上遍历，不做任何指针修正。
+// bvh_node 读回后变成 linear_bvh，其余物体按记录重新创建，这部分只是几次分配和拷贝。
+//
+// key 由调用方决定（场景文件的哈希、内置场景的名字和编译时间等），不一致时 load 返回空。
+class scene_cache{
+public:
+    static bool save(const scene& s, const std::string& filename, uint64_t key){
+        writer w;
+        if(!w.add_scene(s)) return false;
+        return w.write(filename, key, s);
+    }
+
+    static std::optional<scene> load(const std::string& filename, uint64_t key){
+        auto file = mapped_file::open(filename);
+        if(!file || file->size() < sizeof(file_header)) return std::nullopt;
+        file_header header;
+        std::memcpy(&header, file->data(), sizeof(header));
+        if(std::memcmp(header.magic, magic, sizeof(magic)) != 0 || header.version != version || header.key != key) return std::nullopt;
+        reader r(file, header);
+        if(!r.valid()) return std::nullopt;
+        return r.build();
+    }
+
+    // dir/<name>-<key>.rtwscene
+    static std::string path(const std::string& dir, const std::string& name, uint64_t key){
+        char hex[17];
+        snprintf(hex, sizeof(hex), "%016llx", (unsigned long long)key);
+        return (std::filesystem::path(dir) / (name + "-" + hex + ".rtwscene")).string();
+    }
+
+    // FNV-1a，用来给场景来源算 key
+    static uint64_t hash(const void* data, size_t size, uint64_t h = 0xcbf29ce484222325ull){
+        const unsigned char* p = static_cast<const unsigned char*>(data);
+        for(size_t i = 0; i < size; i++){
+            h ^= p[i];
+            h *= 0x100000001b3ull;
+        }
+        return h;
+    }
+    static uint64_t hash(const std::string& s, uint64_t h = 0xcbf29ce484222325ull){
+        return hash(s.data(), s.size(), h);
+    }
+
+private:
+    static constexpr char magic[8] = {'R', 'T', 'W', 'S', 'C', 'E', 'N', 'E'};
+    static constexpr uint32_t version = 3;
+    static constexpr size_t page = 4096;
+
+    enum record_type : uint32_t{
+        // 纹理
+        tex_solid, tex_checker, tex_image, tex_noise,
+        // 材质
+        mat_none, mat_lambertian, mat_metal, mat_dielectric, mat_diffuse_light, mat_isotropic,
+        // 物体
+        obj_sphere, obj_quad, obj_list, obj_bvh, obj_translate, obj_rotate_y, obj_constant_medium, obj_light_list, obj_heterogeneous_medium
+    };
+
+    struct record{
+        uint32_t type;
+        int32_t ref[3];         // 引用其他记录的下标，-1 表示空
+        uint64_t blob[2];       // 变长数据在 blob 区中的偏移
+        uint64_t size[2];       // 变长数据的字节数
+        double v[12];
+    };
+
+    struct file_header{
+        char magic[8];
+        uint32_t version;
+        uint32_t texture_count, material_count, object_count, node_count;
+        int32_t world, lights;
+        uint64_t key;
+        uint64_t records_offset, nodes_offset, blob_offset, blob_size;
+        char name[64];
+        double aspect_ratio, vfov, defocus_angle, focus_dist, bvh_build_ms;
+        double lookfrom[3], lookat[3], vup[3], background[3];
+        int32_t image_width, samples_per_pixel, max_depth, pad;
+    };
+
+    static size_t align_up(size_t x, size_t a){ return (x + a - 1) / a * a; }
+    static void put3(double* v, const vec3& x){ v[0] = x.x(); v[1] = x.y(); v[2] = x.z(); }
+    static vec3 get3(const double* v){ return vec3(v[0], v[1], v[2]); }
+
+    class writer{
+    public:
+        std::vector<record> textures, materials, objects;
+        std::vector<linear_bvh_node> nodes;
+        std::vector<unsigned char> blob;
+        int world = -1, lights = -1;
+
+        bool add_scene(const scene& s){
+            world = add_object(s.world);
+            lights = s.lights ? add_object(s.lights) : -1;
+            return ok;
+        }
+
+        bool write(const std::string& filename, uint64_t key, const scene& s) const{
+            file_header h{};
+            std::memcpy(h.magic, magic, sizeof(magic));
+            h.version = version;
+            h.texture_count = uint32_t(textures.size());
+            h.material_count = uint32_t(materials.size());
+            h.object_count = uint32_t(objects.size());
+            h.node_count = uint32_t(nodes.size());
+            h.world = world;
+            h.lights = lights;
+            h.key = key;
+            std::strncpy(h.name, s.name.c_str(), sizeof(h.name) - 1);
+            const camera& c = s.cam;
+            h.aspect_ratio = c.aspect_ratio;
+            h.vfov = c.vfov;
+            h.defocus_angle = c.defocus_angle;
+            h.focus_dist = c.focus_dist;
+            h.bvh_build_ms = s.bvh_build_ms;
+            put3(h.lookfrom, c.lookfrom);
+            put3(h.lookat, c.lookat);
+            put3(h.vup, c.vup);
+            put3(h.background, c.background);
+            h.image_width = c.image_width;
+            h.samples_per_pixel = c.samples_per_pixel;
+            h.max_depth = c.max_depth;
+
+            size_t record_count = textures.size() + materials.size() + objects.size();
+            h.records_offset = align_up(sizeof(h), alignof(record));
+            h.nodes_offset = align_up(h.records_offset + record_count * sizeof(record), page);
+            h.blob_offset = align_up(h.nodes_offset + nodes.size() * sizeof(linear_bvh_node), 8);
+            h.blob_size = blob.size();
+
+            // 先写临时文件再改名，避免别的进程映射到写了一半的文件
+            std::string tmp = unique_temp_path(filename);
+            FILE* f = fopen(tmp.c_str(), "wb");
+            if(!f) return false;
+            auto pad_to = [&](size_t pos){
+                long cur = ftell(f);
+                if(cur < 0) return false;
+                std::vector<char> zeros(pos - size_t(cur), 0);
+                return zeros.empty() || fwrite(zeros.data(), 1, zeros.size(), f) == zeros.size();
+            };
+            auto put = [&](const auto& v){
+                return v.empty() || fwrite(v.data(), sizeof(v[0]), v.size(), f) == v.size();
+            };
+            bool written = fwrite(&h, sizeof(h), 1, f) == 1 && pad_to(h.records_offset) &&
+                           put(textures) && put(materials) && put(objects) &&
+                           pad_to(h.nodes_offset) && put(nodes) &&
+                           pad_to(h.blob_offset) && put(blob);
+            written = (fclose(f) == 0) && written;
+            std::error_code ec;
+            if(written) std::filesystem::rename(tmp, filename, ec);
+            if(!written || ec){
+                std::filesystem::remove(tmp, ec);
+                return false;
+            }
+            return true;
+        }
+
+    private:
+        bool ok = true;
+        std::unordered_map<const void*, int> texture_index, material_index, object_index;
+
+        record make(uint32_t type){
+            record r{};
+            r.type = type;
+            r.ref[0] = r.ref[1] = r.ref[2] = -1;
+            return r;
+        }
+        void put_blob(record& r, int slot, const void* data, size_t size){
+            size_t offset = align_up(blob.size(), 8);
+            blob.resize(offset + size);
+            if(size) std::memcpy(blob.data() + offset, data, size);
+            r.blob[slot] = offset;
+            r.size[slot] = size;
+        }
+        bool unsupported(const char* kind, const void* p){
+            std::cerr << "scene cache: unsupported " << kind << " type " << p << "\n";
+            ok = false;
+            return false;
+        }
+
+        int add_texture(const shared_ptr<texture>& t){
+            if(!t) return -1;
+            auto it = texture_index.find(t.get());
+            if(it != texture_index.end()) return it->second;
+            record r;
+            if(auto solid = std::dynamic_pointer_cast<solid_color>(t)){
+                r = make(tex_solid);
+                put3(r.v, solid->albedo);
+            }
+            else if(auto checker = std::dynamic_pointer_cast<check_texture>(t)){
+                int even = add_texture(checker->even), odd = add_texture(checker->odd);
+                r = make(tex_checker);
+                r.ref[0] = even;
+                r.ref[1] = odd;
+                r.v[0] = checker->inv_scale;
+            }
+            else if(auto image = std::dynamic_pointer_cast<image_texture>(t)){
+                r = make(tex_image);
+                put_blob(r, 0, image->filename.data(), image->filename.size());
+                r.v[0] = double(int(image->filter));
+            }
+            else if(auto noise = std::dynamic_pointer_cast<noise_texture>(t)){
+                r = make(tex_noise);
+                r.v[0] = noise->scale;
+                const perlin& p = noise->noise;
+                std::vector<unsigned char> tables(sizeof(p.grad) + sizeof(p.perm_x) * 3);
+                unsigned char* out = tables.data();
+                std::memcpy(out, p.grad, sizeof(p.grad)); out += sizeof(p.grad);
+                std::memcpy(out, p.perm_x, sizeof(p.perm_x)); out += sizeof(p.perm_x);
+                std::memcpy(out, p.perm_y, sizeof(p.perm_y)); out += sizeof(p.perm_y);
+                std::memcpy(out, p.perm_z, sizeof(p.perm_z));
+                put_blob(r, 0, tables.data(), tables.size());
+                if(const perlin_volume* vol = noise->volume.get()){
+                    r.ref[0] = vol->res;
+                    put3(r.v + 1, vol->min);
+                    put3(r.v + 4, vol->cell);
+                    put_blob(r, 1, vol->data.data(), vol->data.size() * sizeof(float));
+                }
+            }
+            else{
+                unsupported("texture", t.get());
+                return -1;
+            }
+            textures.push_back(r);
+            return texture_index[t.get()] = int(textures.size()) - 1;
+        }
+
+        int add_material(const shared_ptr<material>& m){
+            if(!m) return -1;
+            auto it = material_index.find(m.get());
+            if(it != material_index.end()) return it->second;
+            record r;
+            if(auto l = std::dynamic_pointer_cast<lambertian>(m)){
+                int tex = add_texture(l->tex);
+                r = make(mat_lambertian);
+                r.ref[0] = tex;
+            }
+            else if(auto metal_mat = std::dynamic_pointer_cast<metal>(m)){
+                r = make(mat_metal);
+                put3(r.v, metal_mat->albedo);
+                r.v[3] = metal_mat->fuzz;
+            }
+            else if(auto d = std::dynamic_pointer_cast<dielectric>(m)){
+                r = make(mat_dielectric);
+                r.v[0] = d->refraction_index;
+            }
+            else if(auto light = std::dynamic_pointer_cast<diffuse_light>(m)){
+                int tex = add_texture(light->tex);
+                r = make(mat_diffuse_light);
+                r.ref[0] = tex;
+            }
+            else if(auto iso = std::dynamic_pointer_cast<isotropic>(m)){
+                int tex = add_texture(iso->tex);
+                r = make(mat_isotropic);
+                r.ref[0] = tex;
+            }
+            else if(typeid(*m) == typeid(material)){
+                r = make(mat_none);
+            }
+            else{
+                unsupported("material", m.get());
+                return -1;
+            }
+            materials.push_back(r);
+            return material_index[m.get()] = int(materials.size()) - 1;
+        }
+
+        void add_children(record& r, const std::vector<shared_ptr<hittable>>& objects){
+            std::vector<int32_t> children;
+            for(const auto& child : objects) children.push_back(add_object(child));
+            put_blob(r, 0, children.data(), children.size() * sizeof(int32_t));
+        }
+
+        int add_object(const shared_ptr<hittable>& o){
+            auto it = object_index.find(o.get());
+            if(it != object_index.end()) return it->second;
+            record r;
+            if(auto s = std::dynamic_pointer_cast<sphere>(o)){
+                int mat = add_material(s->mat);
+                r = make(obj_sphere);
+                r.ref[0] = mat;
+                put3(r.v, s->center1);
+                put3(r.v + 3, s->center_vec);
+                r.v[6] = s->radius;
+                r.v[7] = s->is_moving ? 1 : 0;
+            }
+            else if(auto q = std::dynamic_pointer_cast<quad>(o)){
+                int mat = add_material(q->mat);
+                r = make(obj_quad);
+                r.ref[0] = mat;
+                put3(r.v, q->Q);
+                put3(r.v + 3, q->u);
+                put3(r.v + 6, q->v);
+            }
+            else if(auto list = std::dynamic_pointer_cast<hittable_list>(o)){
+                r = make(obj_list);
+                add_children(r, list->objects);
+            }
+            else if(auto volume = std::dynamic_pointer_cast<heterogeneous_medium>(o)){
+                int phase = add_material(volume->phase_function);
+                const density_grid& g = *volume->grid;
+                r = make(obj_heterogeneous_medium);
+                r.ref[0] = phase;
+                int32_t res[4] = {g.res[0], g.res[1], g.res[2], volume->majorant_res};
+                put_blob(r, 0, g.data.data(), g.data.size() * sizeof(float));
+                put_blob(r, 1, res, sizeof(res));
+                put3(r.v, g.min);
+                put3(r.v + 3, g.max);
+                r.v[6] = volume->density_scale;
+            }
+            else if(auto lights = std::dynamic_pointer_cast<light_list>(o)){
+                r = make(obj_light_list);
+                add_children(r, lights->lights);
+            }
+            else if(auto bvh = std::dynamic_pointer_cast<bvh_node>(o)){
+                int root = linear_bvh::flatten(*bvh, nodes, [&](const shared_ptr<hittable>& child){ return add_object(child); });
+                r = make(obj_bvh);
+                r.ref[0] = root;
+            }
+            else if(auto t = std::dynamic_pointer_cast<translate>(o)){
+                int child = add_object(t->object);
+                r = make(obj_translate);
+                r.ref[0] = child;
+                put3(r.v, t->offset);
+            }
+            else if(auto rot = std::dynamic_pointer_cast<rotate_y>(o)){
+                int child = add_object(rot->object);
+                r = make(obj_rotate_y);
+                r.ref[0] = child;
+                r.v[0] = rot->sin_theta;
+                r.v[1] = rot->cos_theta;
+            }
+            else if(auto medium = std::dynamic_pointer_cast<constant_medium>(o)){
+                int boundary = add_object(medium->boundary);
+                int phase = add_material(medium->phase_fuction);
+                r = make(obj_constant_medium);
+                r.ref[0] = boundary;
+                r.ref[1] = phase;
+                r.v[0] = medium->neg_inv_density;
+            }
+            else{
+                unsupported("object", o.get());
+                return -1;
+            }
+            objects.push_back(r);
+            return object_index[o.get()] = int(objects.size()) - 1;
+        }
+    };
+
+    class reader{
+    public:
+        reader(shared_ptr<mapped_file> file, const file_header& header) : file(std::move(file)), h(header) {}
+
+        // 检查各个区段都在文件范围内并且对齐
+        bool valid() const{
+            size_t size = file->size();
+            size_t record_count = size_t(h.texture_count) + h.material_count + h.object_count;
+            return h.records_offset % alignof(record) == 0 && h.records_offset + record_count * sizeof(record) <= size &&
+                   h.nodes_offset % alignof(linear_bvh_node) == 0 &&
+                   h.nodes_offset + size_t(h.node_count) * sizeof(linear_bvh_node) <= size &&
+                   h.blob_offset + h.blob_size <= size &&
+                   h.world >= 0 && uint32_t(h.world) < h.object_count &&
+                   h.lights >= -1 && (h.lights < 0 || uint32_t(h.lights) < h.object_count);
+        }
+
+        std::optional<scene> build(){
+            std::string name(h.name, strnlen(h.name, sizeof(h.name)));
+            scene s(name);
+            camera& c = s.cam;
+            c.aspect_ratio = h.aspect_ratio;
+            c.vfov = h.vfov;
+            c.defocus_angle = h.defocus_angle;
+            c.focus_dist = h.focus_dist;
+            c.lookfrom = get3(h.lookfrom);
+            c.lookat = get3(h.lookat);
+            c.vup = get3(h.vup);
+            c.background = get3(h.background);
+            c.image_width = h.image_width;
+            c.samples_per_pixel = h.samples_per_pixel;
+            c.max_depth = h.max_depth;
+            s.bvh_build_ms = h.bvh_build_ms;
+
+            const record* records = reinterpret_cast<const record*>(file->data() + h.records_offset);
+            nodes = reinterpret_cast<const linear_bvh_node*>(file->data() + h.nodes_offset);
+            for(uint32_t i = 0; i < h.texture_count; i++){
+                auto t = make_texture(records[i]);
+                if(!t) return std::nullopt;
+                textures.push_back(t);
+            }
+            records += h.texture_count;
+            for(uint32_t i = 0; i < h.material_count; i++){
+                auto m = make_material(records[i]);
+                if(!m) return std::nullopt;
+                materials.push_back(m);
+            }
+            records += h.material_count;
+            objects.reserve(h.object_count);
+            for(uint32_t i = 0; i < h.object_count; i++){
+                auto o = make_object(records[i]);
+                if(!o) return std::nullopt;
+                objects.push_back(o);
+            }
+            s.world = objects[h.world];
+            if(h.lights >= 0) s.lights = objects[h.lights];
+            return s;
+        }
+    private:
+        shared_ptr<mapped_file> file;
+        file_header h;
+        const linear_bvh_node* nodes = nullptr;
+        std::vector<shared_ptr<texture>> textures;
+        std::vector<shared_ptr<material>> materials;
+        std::vector<shared_ptr<hittable>> objects;
+
+        // 引用只能指向已经创建好的记录
+        template <typename T>
+        static shared_ptr<T> ref(const std::vector<shared_ptr<T>>& table, int32_t index){
+            if(index < 0 || size_t(index) >= table.size()) return nullptr;
+            return table[index];
+        }
+        const unsigned char* blob(const record& r, int slot) const{
+            if(r.blob[slot] + r.size[slot] > h.blob_size) return nullptr;
+            return file->data() + h.blob_offset + r.blob[slot];
+        }
+
+        shared_ptr<texture> make_texture(const record& r){
+            switch(r.type){
+            case tex_solid:
+                return make_shared<solid_color>(get3(r.v));
+            case tex_checker:{
+                auto even = ref(textures, r.ref[0]), odd = ref(textures, r.ref[1]);
+                if(!even || !odd) return nullptr;
+                auto checker = make_shared<check_texture>(1.0, even, odd);
+                checker->inv_scale = r.v[0];
+                return checker;
+            }
+            case tex_image:{
+                const unsigned char* name = blob(r, 0);
+                if(!name) return nullptr;
+                std::string filename(reinterpret_cast<const char*>(name), r.size[0]);
+                return make_shared<image_texture>(filename.c_str(), mip_filter(int(r.v[0])));
+            }
+            case tex_noise:{
+                auto noise = make_shared<noise_texture>(r.v[0]);
+                perlin& p = noise->noise;
+                const unsigned char* tables = blob(r, 0);
+                if(!tables || r.size[0] != sizeof(p.grad) + sizeof(p.perm_x) * 3) return nullptr;
+                std::memcpy(p.grad, tables, sizeof(p.grad)); tables += sizeof(p.grad);
+                std::memcpy(p.perm_x, tables, sizeof(p.perm_x)); tables += sizeof(p.perm_x);
+                std::memcpy(p.perm_y, tables, sizeof(p.perm_y)); tables += sizeof(p.perm_y);
+                std::memcpy(p.perm_z, tables, sizeof(p.perm_z));
+                if(r.ref[0] > 0){
+                    const unsigned char* data = blob(r, 1);
+                    size_t count = size_t(r.ref[0]) * r.ref[0] * r.ref[0];
+                    if(!data || r.size[1] != count * sizeof(float)) return nullptr;
+                    shared_ptr<perlin_volume> vol(new perlin_volume());
+                    vol->res = r.ref[0];
+                    vol->min = get3(r.v + 1);
+                    vol->cell = get3(r.v + 4);
+                    vol->data.resize(count);
+                    std::memcpy(vol->data.data(), data, r.size[1]);
+                    noise->volume = vol;
+                }
+                return noise;
+            }
+            }
+            return nullptr;
+        }
+
+        shared_ptr<material> make_material(const record& r){
+            switch(r.type){
+            case mat_none:
+                return make_shared<material>();
+            case mat_lambertian:
+                if(auto t = ref(textures, r.ref[0])) return make_shared<lambertian>(t);
+                return nullptr;
+            case mat_metal:
+                return make_shared<metal>(get3(r.v), r.v[3]);
+            case mat_dielectric:
+                return make_shared<dielectric>(r.v[0]);
+            case mat_diffuse_light:
+                if(auto t = ref(textures, r.ref[0])) return make_shared<diffuse_light>(t);
+                return nullptr;
+            case mat_isotropic:
+                if(auto t = ref(textures, r.ref[0])) return make_shared<isotropic>(t);
+                return nullptr;
+            }
+            return nullptr;
+        }
+
+        bool read_children(const record& r, std::vector<shared_ptr<hittable>>& children) const{
+            const unsigned char* data = blob(r, 0);
+            if(!data || r.size[0] % sizeof(int32_t) != 0) return false;
+            for(size_t i = 0; i < r.size[0] / sizeof(int32_t); i++){
+                int32_t index;
+                std::memcpy(&index, data + i * sizeof(int32_t), sizeof(index));
+                auto child = ref(objects, index);
+                if(!child) return false;
+                children.push_back(child);
+            }
+            return true;
+        }
+
+        shared_ptr<hittable> make_object(const record& r){
+            switch(r.type){
+            case obj_sphere:{
+                auto mat = ref(materials, r.ref[0]);
+                if(!mat) return nullptr;
+                if(r.v[7] != 0) return make_shared<sphere>(get3(r.v), get3(r.v) + get3(r.v + 3), r.v[6], mat);
+                return make_shared<sphere>(get3(r.v), r.v[6], mat);
+            }
+            case obj_quad:{
+                auto mat = ref(materials, r.ref[0]);
+                if(!mat) return nullptr;
+                return make_shared<quad>(get3(r.v), get3(r.v + 3), get3(r.v + 6), mat);
+            }
+            case obj_list:{
+                std::vector<shared_ptr<hittable>> children;
+                if(!read_children(r, children)) return nullptr;
+                auto list = make_shared<hittable_list>();
+                for(const auto& child : children) list->add(child);
+                return list;
+            }
+            case obj_heterogeneous_medium:{
+                auto phase = ref(materials, r.ref[0]);
+                const unsigned char* data = blob(r, 0);
+                const unsigned char* res_data = blob(r, 1);
+                int32_t res[4];
+                if(!phase || !data || !res_data || r.size[1] != sizeof(res)) return nullptr;
+                std::memcpy(res, res_data, sizeof(res));
+                if(res[0] <= 0 || res[1] <= 0 || res[2] <= 0 || res[3] <= 0) return nullptr;
+                size_t count = size_t(res[0]) * res[1] * res[2];
+                if(r.size[0] != count * sizeof(float)) return nullptr;
+                std::vector<float> density(count);
+                std::memcpy(density.data(), data, r.size[0]);
+                auto grid = make_shared<density_grid>(res[0], res[1], res[2], get3(r.v), get3(r.v + 3), std::move(density));
+                auto volume = make_shared<heterogeneous_medium>(grid, r.v[6], color(0, 0, 0), res[3]);
+                volume->phase_function = phase;
+                return volume;
+            }
+            case obj_light_list:{
+                std::vector<shared_ptr<hittable>> children;
+                if(!read_children(r, children) || children.empty()) return nullptr;
+                return make_shared<light_list>(std::move(children));
+            }
+            case obj_bvh:{
+                int first, end;
+                if(r.ref[0] < 0 || uint32_t(r.ref[0]) >= h.node_count || !valid_tree(r.ref[0], first, end)) return nullptr;
+                // 只把叶子引用的那一段图元交给 BVH，BVH 自己不在里面
+                std::vector<shared_ptr<hittable>> primitives(objects.begin() + first, objects.begin() + end);
+                return make_shared<linear_bvh>(nodes, r.ref[0], std::move(primitives), first, file);
+            }
+            case obj_translate:{
+                auto child = ref(objects, r.ref[0]);
+                if(!child) return nullptr;
+                return make_shared<translate>(child, get3(r.v));
+            }
+            case obj_rotate_y:{
+                auto child = ref(objects, r.ref[0]);
+                if(!child) return nullptr;
+                auto rot = make_shared<rotate_y>(child, radians_to_degrees(std::atan2(r.v[0], r.v[1])));
+                rot->sin_theta = r.v[0];
+                rot->cos_theta = r.v[1];
+                return rot;
+            }
+            case obj_constant_medium:{
+                auto boundary = ref(objects, r.ref[0]);
+                auto phase = ref(materials, r.ref[1]);
+                if(!boundary || !phase) return nullptr;
+                auto medium = make_shared<constant_medium>(boundary, 1.0, color(0, 0, 0));
+                medium->neg_inv_density = r.v[0];
+                medium->phase_fuction = phase;
+                return medium;
+            }
+            }
+            return nullptr;
+        }
+
+        // 子树中的下标都在范围内、叶子只引用已经创建的物体、深度不超过遍历栈，才能放心地直接遍历
+        // 检查树的结构，同时求出叶子引用的图元范围 [first, end)
+        bool valid_tree(int root, int& first, int& end) const{
+            first = int(objects.size());
+            end = 0;
+            std::vector<std::pair<int, int>> stack = {{root, 1}};
+            while(!stack.empty()){
+                auto [index, depth] = stack.back();
+                stack.pop_back();
+                if(index < 0 || uint32_t(index) >= h.node_count || depth > linear_bvh::max_depth) return false;
+                const linear_bvh_node& n = nodes[index];
+                if(n.count > 0){
+                    if(n.offset < 0 || size_t(n.offset) + n.count > objects.size()) return false;
+                    first = std::min(first, n.offset);
+                    end = std::max(end, n.offset + n.count);
+                }
+                else{
+                    if(n.axis < 0 || n.axis > 2 || n.offset <= index) return false;
+                    stack.push_back({index + 1, depth + 1});
+                    stack.push_back({n.offset, depth + 1});
+                }
+            }
+            return first < end;
+        }
+    };
+};
+#endif
@@ -0,0 +1,428 @@
+#ifndef SCENE_LOADER_H
+#define SCENE_LOADER_H
+#include "rtweekend.h"
+#include "hittable_list.h"
+#include "sphere.h"
+#include "quad.h"
+#include "constant_medium.h"
+#include "heterogeneous_medium.h"
+#include "texture.h"
+#include "material.h"
+#include "scene.h"
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <optional>
+#include <sstream>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+// .rtw 场景文件：每行一条语句，# 之后是注释。语句由关键字、位置参数和 key=value 参数组成，
+// 向量写成 x,y,z（单个数表示三个分量相同），带空格的字符串用双引号。
+//
+//   camera width=800 spp=100 depth=50 aspect_ratio=1 vfov=40 lookfrom=278,278,-800 lookat=278,278,0
+//          vup=0,1,0 defocus_angle=0 focus_dist=10 background=0,0,0
+//   texture NAME solid color=r,g,b | checker scale= even=c odd=c (或 even_texture= odd_texture=)
+//                | image file=path [filter=bilinear|trilinear|ewa] | noise scale=s
+//   material NAME lambertian albedo=c|texture=T | metal albedo= fuzz= | dielectric ior=
+//                 | diffuse_light emit=c|texture=T | isotropic albedo=c|texture=T
+//   sphere center= [center2=] radius= material=M
+//   quad q= u= v= material=M
+//   box min= max= material=M
+//   constant_medium boundary=OBJ density= albedo=c|texture=T
+//   volume min= max= res=nx,ny,nz file=raw|noise=scale density= albedo=c|texture=T [majorant=16]
+//                                 密度不均匀的介质，file 是 float32 原始体数据（x 变化最快），noise 用 Perlin 噪声生成
+//   translate object=OBJ offset=
+//   rotate_y object=OBJ angle=
+//   group NAME [bvh] ... end      把中间的物体收集成一个列表（或 BVH），作为命名物体
+//   add OBJ                       把命名物体加入当前列表
+//   light <几何体语句>             只加入光源列表，用于重要性采样，material 可省略
+//   lights auto                   把场景中所有 diffuse_light 物体作为光源，不能和 light 混用
+//   world bvh|list                顶层物体是否构建 BVH，默认 list
+//
+// 几何体语句带 name=N 时只定义不加入场景，之后可以被 add/object=/boundary= 引用。
+class scene_loader{
+public:
+    // 出错时在 stderr 打印 文件:行号: 信息，返回空
+    static std::optional<scene> load(const std::string& filename){
+        std::ifstream in(filename, std::ios::binary);
+        if(!in){
+            std::cerr << filename << ": cannot open scene file\n";
+            return std::nullopt;
+        }
+        std::stringstream buffer;
+        buffer << in.rdbuf();
+        scene_loader loader(filename);
+        return loader.parse(buffer.str());
+    }
+    static std::optional<scene> parse_string(const std::string& text, const std::string& name = "<string>"){
+        scene_loader loader(name);
+        return loader.parse(text);
+    }
+private:
+    struct parse_error{
+        std::string message;
+    };
+    struct statement{
+        std::vector<std::string_view> positional;
+        std::vector<std::pair<std::string_view, std::string_view>> params;
+        std::vector<bool> used;
+    };
+
+    std::string filename;
+    std::filesystem::path directory;
+    int line_number = 0;
+    std::unordered_map<std::string, shared_ptr<texture>> textures;
+    std::unordered_map<std::string, shared_ptr<material>> materials;
+    std::unordered_map<std::string, shared_ptr<hittable>> objects;
+    std::vector<std::pair<std::string, hittable_list>> groups;   // 正在收集的 group，最后一个是当前的
+    std::vector<bool> group_bvh;
+    std::vector<shared_ptr<hittable>> lights;
+    bool auto_lights = false;
+    bool world_bvh = false;
+
+    explicit scene_loader(const std::string& filename)
+     : filename(filename), directory(std::filesystem::path(filename).parent_path()) {}
+
+    std::optional<scene> parse(const std::string& text){
+        std::string stem = std::filesystem::path(filename).stem().string();
+        scene s(stem.empty() ? filename : stem);
+        groups.emplace_back("", hittable_list());
+        group_bvh.push_back(false);
+        prefetch_images(text);
+        try{
+            size_t pos = 0;
+            while(pos < text.size()){
+                size_t end = text.find('\n', pos);
+                if(end == std::string::npos) end = text.size();
+                line_number++;
+                std::string_view line(text.data() + pos, end - pos);
+                pos = end + 1;
+                statement st = tokenize(line);
+                if(st.positional.empty()){
+                    if(!st.params.empty()) fail("statement without keyword");
+                    continue;
+                }
+                execute(st, s);
+            }
+            if(groups.size() > 1) fail("group '" + groups.back().first + "' is missing 'end'");
+            hittable_list& world = groups.back().second;
+            if(world.objects.empty()) fail("scene has no objects");
+            s.world = world_bvh ? s.build_bvh(world) : make_shared<hittable_list>(world);
+            if(auto_lights && !lights.empty()) fail("'lights auto' cannot be combined with 'light'");
+            if(auto_lights) s.collect_lights();
+            else if(lights.size() == 1) s.lights = lights[0];
+            else if(!lights.empty()) s.lights = make_shared<light_list>(lights);
+        }
+        catch(const parse_error& e){
+            std::cerr << filename << ":" << line_number << ": " << e.message << "\n";
+            return std::nullopt;
+        }
+        return s;
+    }
+
+    // 先扫一遍所有 image 纹理，在后台开始解码，解析和构建 BVH 的同时纹理也在加载
+    void prefetch_images(const std::string& text) const{
+        size_t pos = 0;
+        while(pos < text.size()){
+            size_t end = text.find('\n', pos);
+            if(end == std::string::npos) end = text.size();
+            std::string_view line(text.data() + pos, end - pos);
+            pos = end + 1;
+            statement st;
+            try{
+                st = tokenize(line);
+            }
+            catch(const parse_error&){
+                continue;   // 语法错误留给正式解析时报告
+            }
+            if(st.positional.size() != 3 || st.positional[0] != "texture" || st.positional[2] != "image") continue;
+            for(const auto& [key, value] : st.params){
+                if(key == "file") texture_cache::prefetch(resolve(value));
+            }
+        }
+    }
+
+    [[noreturn]] static void fail(const std::string& message){
+        throw parse_error{message};
+    }
+
+    static statement tokenize(std::string_view line){
+        statement st;
+        size_t i = 0;
+        auto skip_space = [&]{ while(i < line.size() && (line[i] == ' ' || line[i] == '\t' || line[i] == '\r')) i++; };
+        while(true){
+            skip_space();
+            if(i >= line.size() || line[i] == '#') break;
+            size_t start = i;
+            size_t eq = std::string_view::npos;
+            while(i < line.size() && line[i] != ' ' && line[i] != '\t' && line[i] != '\r'){
+                if(line[i] == '=' && eq == std::string_view::npos) eq = i;
+                if(line[i] == '"'){
+                    size_t close = line.find('"', i + 1);
+                    if(close == std::string_view::npos) fail("unterminated string");
+                    i = close;
+                }
+                i++;
+            }
+            std::string_view token = line.substr(start, i - start);
+            if(eq == std::string_view::npos){
+                st.positional.push_back(unquote(token));
+            }
+            else{
+                st.params.emplace_back(token.substr(0, eq - start), unquote(token.substr(eq - start + 1)));
+            }
+        }
+        st.used.assign(st.params.size(), false);
+        return st;
+    }
+    static std::string_view unquote(std::string_view s){
+        if(s.size() >= 2 && s.front() == '"' && s.back() == '"') return s.substr(1, s.size() - 2);
+        return s;
+    }
+
+    static std::optional<std::string_view> find(statement& st, std::string_view key){
+        for(size_t i = 0; i < st.params.size(); i++){
+            if(st.params[i].first == key){
+                st.used[i] = true;
+                return st.params[i].second;
+            }
+        }
+        return std::nullopt;
+    }
+    static std::string_view require(statement& st, std::string_view key){
+        auto v = find(st, key);
+        if(!v) fail("missing parameter '" + std::string(key) + "'");
+        return *v;
+    }
+    static double to_double(std::string_view s, std::string_view key){
+        // strtod 需要以 0 结尾的字符串，数字都很短，拷到栈上
+        char buf[64];
+        if(s.empty() || s.size() >= sizeof(buf)) fail("bad number '" + std::string(s) + "' for '" + std::string(key) + "'");
+        std::memcpy(buf, s.data(), s.size());
+        buf[s.size()] = 0;
+        char* end = nullptr;
+        double value = std::strtod(buf, &end);
+        if(end != buf + s.size()) fail("bad number '" + std::string(s) + "' for '" + std::string(key) + "'");
+        return value;
+    }
+    static vec3 to_vec3(std::string_view s, std::string_view key){
+        double v[3];
+        int n = 0;
+        size_t start = 0;
+        while(n < 3){
+            size_t comma = s.find(',', start);
+            v[n++] = to_double(s.substr(start, comma == std::string_view::npos ? comma : comma - start), key);
+            if(comma == std::string_view::npos) break;
+            start = comma + 1;
+            if(n == 3) fail("too many components for '" + std::string(key) + "'");
+        }
+        if(n == 1) return vec3(v[0], v[0], v[0]);
+        if(n != 3) fail("'" + std::string(key) + "' needs 1 or 3 components");
+        return vec3(v[0], v[1], v[2]);
+    }
+    static double get_double(statement& st, std::string_view key){ return to_double(require(st, key), key); }
+    static double get_double(statement& st, std::string_view key, double def){
+        auto v = find(st, key);
+        return v ? to_double(*v, key) : def;
+    }
+    static vec3 get_vec3(statement& st, std::string_view key){ return to_vec3(require(st, key), key); }
+    static vec3 get_vec3(statement& st, std::string_view key, const vec3& def){
+        auto v = find(st, key);
+        return v ? to_vec3(*v, key) : def;
+    }
+
+    template <typename T>
+    static shared_ptr<T> lookup(const std::unordered_map<std::string, shared_ptr<T>>& table, std::string_view name,
+                                const char* kind){
+        auto it = table.find(std::string(name));
+        if(it == table.end()) fail(std::string("unknown ") + kind + " '" + std::string(name) + "'");
+        return it->second;
+    }
+    shared_ptr<texture> get_texture(statement& st, std::string_view key){
+        return lookup(textures, require(st, key), "texture");
+    }
+    // color 参数和 texture 参数二选一
+    shared_ptr<texture> color_or_texture(statement& st, std::string_view color_key, std::string_view texture_key){
+        if(auto t = find(st, texture_key)) return lookup(textures, *t, "texture");
+        return make_shared<solid_color>(get_vec3(st, color_key));
+    }
+
+    // 确认所有参数都被用到了，拼错的参数名不会被悄悄忽略
+    static void finish(const statement& st){
+        for(size_t i = 0; i < st.params.size(); i++){
+            if(!st.used[i]) fail("unknown parameter '" + std::string(st.params[i].first) + "'");
+        }
+    }
+
+    void execute(statement& st, scene& s){
+        std::string_view keyword = st.positional[0];
+        if(keyword == "camera") parse_camera(st, s.cam);
+        else if(keyword == "texture") parse_texture(st);
+        else if(keyword == "material") parse_material(st);
+        else if(keyword == "group"){
+            if(st.positional.size() < 2) fail("group needs a name");
+            bool bvh = st.positional.size() > 2 && st.positional[2] == "bvh";
+            if(st.positional.size() > 2 && !bvh) fail("unknown group option '" + std::string(st.positional[2]) + "'");
+            groups.emplace_back(std::string(st.positional[1]), hittable_list());
+            group_bvh.push_back(bvh);
+        }
+        else if(keyword == "end"){
+            if(groups.size() < 2) fail("'end' without 'group'");
+            auto [name, list] = std::move(groups.back());
+            bool bvh = group_bvh.back();
+            groups.pop_back();
+            group_bvh.pop_back();
+            if(list.objects.empty()) fail("group '" + name + "' is empty");
+            objects[name] = bvh ? s.build_bvh(list) : make_shared<hittable_list>(list);
+        }
+        else if(keyword == "add"){
+            if(st.positional.size() < 2) fail("add needs an object name");
+            for(size_t i = 1; i < st.positional.size(); i++){
+                groups.back().second.add(lookup(objects, st.positional[i], "object"));
+            }
+        }
+        else if(keyword == "world"){
+            if(st.positional.size() != 2 || (st.positional[1] != "bvh" && st.positional[1] != "list")){
+                fail("expected 'world bvh' or 'world list'");
+            }
+            world_bvh = st.positional[1] == "bvh";
+        }
+        else if(keyword == "light"){
+            if(st.positional.size() < 2) fail("light needs a shape");
+            st.positional.erase(st.positional.begin());
+            lights.push_back(parse_shape(st, true));
+        }
+        else if(keyword == "lights"){
+            if(st.positional.size() != 2 || st.positional[1] != "auto") fail("expected 'lights auto'");
+            auto_lights = true;
+        }
+        else{
+            auto object = parse_shape(st, false);
+            if(auto name = find(st, "name")) objects[std::string(*name)] = object;
+            else groups.back().second.add(object);
+        }
+        finish(st);
+    }
+
+    void parse_camera(statement& st, camera& cam){
+        cam.aspect_ratio = get_double(st, "aspect_ratio", cam.aspect_ratio);
+        cam.image_width = int(get_double(st, "width", cam.image_width));
+        cam.samples_per_pixel = int(get_double(st, "spp", cam.samples_per_pixel));
+        cam.max_depth = int(get_double(st, "depth", cam.max_depth));
+        cam.vfov = get_double(st, "vfov", cam.vfov);
+        cam.lookfrom = get_vec3(st, "lookfrom", cam.lookfrom);
+        cam.lookat = get_vec3(st, "lookat", cam.lookat);
+        cam.vup = get_vec3(st, "vup", cam.vup);
+        cam.defocus_angle = get_double(st, "defocus_angle", cam.defocus_angle);
+        cam.focus_dist = get_double(st, "focus_dist", cam.focus_dist);
+        cam.background = get_vec3(st, "background", cam.background);
+    }
+
+    void parse_texture(statement& st){
+        if(st.positional.size() != 3) fail("expected 'texture NAME TYPE ...'");
+        std::string name(st.positional[1]);
+        std::string_view type = st.positional[2];
+        shared_ptr<texture> tex;
+        if(type == "solid") tex = make_shared<solid_color>(get_vec3(st, "color"));
+        else if(type == "checker"){
+            double scale = get_double(st, "scale");
+            tex = make_shared<check_texture>(scale, color_or_texture(st, "even", "even_texture"),
+                                             color_or_texture(st, "odd", "odd_texture"));
+        }
+        else if(type == "image"){
+            mip_filter filter = mip_filter::trilinear;
+            if(auto f = find(st, "filter")){
+                if(*f == "bilinear") filter = mip_filter::bilinear;
+                else if(*f == "trilinear") filter = mip_filter::trilinear;
+                else if(*f == "ewa") filter = mip_filter::ewa;
+                else fail("unknown filter '" + std::string(*f) + "'");
+            }
+            tex = make_shared<image_texture>(resolve(require(st, "file")).c_str(), filter);
+        }
+        else if(type == "noise") tex = make_shared<noise_texture>(get_double(st, "scale"));
+        else fail("unknown texture type '" + std::string(type) + "'");
+        textures[name] = tex;
+    }
+
+    void parse_material(statement& st){
+        if(st.positional.size() != 3) fail("expected 'material NAME TYPE ...'");
+        std::string name(st.positional[1]);
+        std::string_view type = st.positional[2];
+        shared_ptr<material> mat;
+        if(type == "lambertian") mat = make_shared<lambertian>(color_or_texture(st, "albedo", "texture"));
+        else if(type == "metal") mat = make_shared<metal>(get_vec3(st, "albedo"), get_double(st, "fuzz", 0));
+        else if(type == "dielectric") mat = make_shared<dielectric>(get_double(st, "ior"));
+        else if(type == "diffuse_light") mat = make_shared<diffuse_light>(color_or_texture(st, "emit", "texture"));
+        else if(type == "isotropic") mat = make_shared<isotropic>(color_or_texture(st, "albedo", "texture"));
+        else fail("unknown material type '" + std::string(type) + "'");
+        materials[name] = mat;
+    }
+
+    shared_ptr<material> shape_material(statement& st, bool light){
+        auto name = find(st, "material");
+        if(name) return lookup(materials, *name, "material");
+        if(light) return make_shared<material>();
+        fail("missing parameter 'material'");
+    }
+
+    shared_ptr<hittable> parse_shape(statement& st, bool light){
+        std::string_view type = st.positional[0];
+        if(st.positional.size() != 1) fail("unexpected argument '" + std::string(st.positional[1]) + "'");
+        if(type == "sphere"){
+            Point3 center = get_vec3(st, "center");
+            double radius = get_double(st, "radius");
+            auto mat = shape_material(st, light);
+            if(auto c2 = find(st, "center2")) return make_shared<sphere>(center, to_vec3(*c2, "center2"), radius, mat);
+            return make_shared<sphere>(center, radius, mat);
+        }
+        if(type == "quad"){
+            Point3 q = get_vec3(st, "q");
+            vec3 u = get_vec3(st, "u"), v = get_vec3(st, "v");
+            return make_shared<quad>(q, u, v, shape_material(st, light));
+        }
+        if(type == "box"){
+            Point3 a = get_vec3(st, "min"), b = get_vec3(st, "max");
+            return box(a, b, shape_material(st, light));
+        }
+        if(type == "constant_medium"){
+            auto boundary = lookup(objects, require(st, "boundary"), "object");
+            double density = get_double(st, "density");
+            return make_shared<constant_medium>(boundary, density, color_or_texture(st, "albedo", "texture"));
+        }
+        if(type == "volume"){
+            Point3 min = get_vec3(st, "min"), max = get_vec3(st, "max");
+            vec3 res = get_vec3(st, "res", vec3(64, 64, 64));
+            int nx = int(res.x()), ny = int(res.y()), nz = int(res.z());
+            if(nx <= 0 || ny <= 0 || nz <= 0) fail("res must be positive");
+            shared_ptr<density_grid> grid;
+            if(auto file = find(st, "file")){
+                grid = density_grid::load_raw(resolve(*file), nx, ny, nz, min, max);
+                if(!grid) fail("cannot load volume '" + std::string(*file) + "'");
+            }
+            else grid = density_grid::from_noise(nx, ny, nz, min, max, get_double(st, "noise"));
+            double density = get_double(st, "density");
+            int majorant = int(get_double(st, "majorant", 16));
+            return make_shared<heterogeneous_medium>(grid, density, color_or_texture(st, "albedo", "texture"), majorant);
+        }
+        if(type == "translate"){
+            auto object = lookup(objects, require(st, "object"), "object");
+            return make_shared<translate>(object, get_vec3(st, "offset"));
+        }
+        if(type == "rotate_y"){
+            auto object = lookup(objects, require(st, "object"), "object");
+            return make_shared<rotate_y>(object, get_double(st, "angle"));
+        }
+        fail("unknown statement '" + std::string(type) + "'");
+    }
+
+    // 相对路径先相对场景文件所在目录找，找不到再交给 rtw_image 的默认查找规则
+    std::string resolve(std::string_view file) const{
+        std::filesystem::path p(file);
+        if(p.is_relative() && !directory.empty() && std::filesystem::exists(directory / p)) return (directory / p).string();
+        return std::string(file);
+    }
+};
+#endif
@@ -0,0 +1,101 @@
+#ifndef SIMD_H
+#define SIMD_H
+#include <cmath>
+#include <algorithm>
+
+#if defined(__SSE2__) || defined(_M_X64) || defined(_M_AMD64)
+    #define RTW_SIMD_SSE
+    #include <emmintrin.h>
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+    #define RTW_SIMD_NEON
+    #include <arm_neon.h>
+#endif
+
+// 4 路 float 向量。x86-64 上用 SSE2，ARM 上用 NEON，其他平台退化为普通循环。
+struct float4
+{
+#if defined(RTW_SIMD_SSE)
+    __m128 v;
+    float4() = default;
+    float4(__m128 v) : v(v) {}
+    explicit float4(float s) : v(_mm_set1_ps(s)) {}
+    float4(float a, float b, float c, float d) : v(_mm_setr_ps(a, b, c, d)) {}
+    static float4 load(const float* p) { return _mm_loadu_ps(p); }
+    void store(float* p) const { _mm_storeu_ps(p, v); }
+    friend float4 operator+(float4 a, float4 b) { return _mm_add_ps(a.v, b.v); }
+    friend float4 operator-(float4 a, float4 b) { return _mm_sub_ps(a.v, b.v); }
+    friend float4 operator*(float4 a, float4 b) { return _mm_mul_ps(a.v, b.v); }
+    friend float4 operator/(float4 a, float4 b) { return _mm_div_ps(a.v, b.v); }
+    friend float4 min(float4 a, float4 b) { return _mm_min_ps(a.v, b.v); }
+    friend float4 max(float4 a, float4 b) { return _mm_max_ps(a.v, b.v); }
+    friend float4 sqrt(float4 a) { return _mm_sqrt_ps(a.v); }
+    float hsum() const
+    {
+        __m128 shuf = _mm_shuffle_ps(v, v, _MM_SHUFFLE(2, 3, 0, 1));
+        __m128 sums = _mm_add_ps(v, shuf);
+        shuf = _mm_movehl_ps(shuf, sums);
+        return _mm_cvtss_f32(_mm_add_ss(sums, shuf));
+    }
+#elif defined(RTW_SIMD_NEON)
+    float32x4_t v;
+    float4() = default;
+    float4(float32x4_t v) : v(v) {}
+    explicit float4(float s) : v(vdupq_n_f32(s)) {}
+    float4(float a, float b, float c, float d)
+    {
+        float t[4] = {a, b, c, d};
+        v = vld1q_f32(t);
+    }
+    static float4 load(const float* p) { return vld1q_f32(p); }
+    void store(float* p) const { vst1q_f32(p, v); }
+    friend float4 operator+(float4 a, float4 b) { return vaddq_f32(a.v, b.v); }
+    friend float4 operator-(float4 a, float4 b) { return vsubq_f32(a.v, b.v); }
+    friend float4 operator*(float4 a, float4 b) { return vmulq_f32(a.v, b.v); }
+    friend float4 operator/(float4 a, float4 b) { return vdivq_f32(a.v, b.v); }
+    friend float4 min(float4 a, float4 b) { return vminq_f32(a.v, b.v); }
+    friend float4 max(float4 a, float4 b) { return vmaxq_f32(a.v, b.v); }
+    friend float4 sqrt(float4 a) { return vsqrtq_f32(a.v); }
+    float hsum() const { return vaddvq_f32(v); }
+#else
+    float v[4];
+    float4() = default;
+    explicit float4(float s) : v{s, s, s, s} {}
+    float4(float a, float b, float c, float d) : v{a, b, c, d} {}
+    static float4 load(const float* p) { return float4(p[0], p[1], p[2], p[3]); }
+    void store(float* p) const { for(int i = 0; i < 4; ++i) p[i] = v[i]; }
+    friend float4 operator+(float4 a, float4 b) { return {a.v[0] + b.v[0], a.v[1] + b.v[1], a.v[2] + b.v[2], a.v[3] + b.v[3]}; }
+    friend float4 operator-(float4 a, float4 b) { return {a.v[0] - b.v[0], a.v[1] - b.v[1], a.v[2] - b.v[2], a.v[3] - b.v[3]}; }
+    friend float4 operator*(float4 a, float4 b) { return {a.v[0] * b.v[0], a.v[1] * b.v[1], a.v[2] * b.v[2], a.v[3] * b.v[3]}; }
+    friend float4 operator/(float4 a, float4 b) { return {a.v[0] / b.v[0], a.v[1] / b.v[1], a.v[2] / b.v[2], a.v[3] / b.v[3]}; }
+    friend float4 min(float4 a, float4 b) { return {std::min(a.v[0], b.v[0]), std::min(a.v[1], b.v[1]), std::min(a.v[2], b.v[2]), std::min(a.v[3], b.v[3])}; }
+    friend float4 max(float4 a, float4 b) { return {std::max(a.v[0], b.v[0]), std::max(a.v[1], b.v[1]), std::max(a.v[2], b.v[2]), std::max(a.v[3], b.v[3])}; }
+    friend float4 sqrt(float4 a) { return {std::sqrt(a.v[0]), std::sqrt(a.v[1]), std::sqrt(a.v[2]), std::sqrt(a.v[3])}; }
+    float hsum() const { return (v[0] + v[1]) + (v[2] + v[3]); }
+#endif
+    float4& operator+=(float4 b) { return *this = *this + b; }
+    float4& operator-=(float4 b) { return *this = *this - b; }
+    float4& operator*=(float4 b) { return *this = *this * b; }
+    float4& operator/=(float4 b) { return *this = *this / b; }
+};
+
+// 4x4 转置：把 4 个 AoS 的 {x,y,z,w} 变成 x、y、z、w 四个 SoA 向量
+inline void transpose4(float4& r0, float4& r1, float4& r2, float4& r3)
+{
+#if defined(RTW_SIMD_SSE)
+    _MM_TRANSPOSE4_PS(r0.v, r1.v, r2.v, r3.v);
+#elif defined(RTW_SIMD_NEON)
+    float32x4x2_t t01 = vtrnq_f32(r0.v, r1.v);
+    float32x4x2_t t23 = vtrnq_f32(r2.v, r3.v);
+    r0.v = vcombine_f32(vget_low_f32(t01.val[0]), vget_low_f32(t23.val[0]));
+    r1.v = vcombine_f32(vget_low_f32(t01.val[1]), vget_low_f32(t23.val[1]));
+    r2.v = vcombine_f32(vget_high_f32(t01.val[0]), vget_high_f32(t23.val[0]));
+    r3.v = vcombine_f32(vget_high_f32(t01.val[1]), vget_high_f32(t23.val[1]));
+#else
+    float4* r[4] = {&r0, &r1, &r2, &r3};
+    for(int i = 0; i < 4; ++i)
+        for(int j = i + 1; j < 4; ++j)
+            std::swap(r[i]->v[j], r[j]->v[i]);
+#endif
+}
+
+#endif
@@ -4,9 +4,11 @@
 #include "vecmath.h"
 #include "color.h"
 #include "taggedptr.h"
+#include "simd.h"
 
 constexpr float Lambda_min = 360, Lambda_max = 830;
 static constexpr int NSpectrumSamples = 4;
+static_assert(NSpectrumSamples % 4 == 0, "SampledSpectrum is processed 4 floats at a time");
 static constexpr float CIE_Y_integral = 106.856895;
 inline float BlackBody(float lambda, float T)
 {
@@ -72,9 +74,9 @@ public:
 
     SampledSpectrum& operator+=(const SampledSpectrum& s)
     {
-        for(int i = 0; i < NSpectrumSamples; ++i)
+        for(int i = 0; i < NSpectrumSamples; i += 4)
         {
-            values[i] += s.values[i];
+            (lane(i) + s.lane(i)).store(&values[i]);
         }
         return *this;
     }
@@ -89,18 +91,18 @@ public:
     friend SampledSpectrum operator-(float a, const SampledSpectrum& s) 
     {
         SampledSpectrum ret;
-        for(int i = 0; i < NSpectrumSamples; ++i)
+        for(int i = 0; i < NSpectrumSamples; i += 4)
         {
-            ret.values[i] = a - s.values[i];
+            (float4(a) - s.lane(i)).store(&ret.values[i]);
         }
         return ret;
     }
 
     SampledSpectrum& operator-=(const SampledSpectrum& s)
     {
-        for(int i = 0; i < NSpectrumSamples; ++i)
+        for(int i = 0; i < NSpectrumSamples; i += 4)
         {
-            values[i] -= s.values[i];
+            (lane(i) - s.lane(i)).store(&values[i]);
         }
         return *this;
     }
@@ -114,9 +116,9 @@ public:
 
     SampledSpectrum& operator*=(const SampledSpectrum& s)
     {
-        for(int i = 0; i < NSpectrumSamples; ++i)
+        for(int i = 0; i < NSpectrumSamples; i += 4)
         {
-            values[i] *= s.values[i];
+            (lane(i) * s.lane(i)).store(&values[i]);
         }
         return *this;
     }
@@ -124,18 +126,15 @@ public:
     SampledSpectrum operator*(float a) const 
     {
         SampledSpectrum ret = *this;
-        for(int i = 0; i < NSpectrumSamples; ++i)
-        {
-            ret.values[i] *= a;
-        }
+        ret *= a;
         return ret;
     }
 
     SampledSpectrum& operator*=(float a)
     {
-        for(int i = 0; i < NSpectrumSamples; ++i)
+        for(int i = 0; i < NSpectrumSamples; i += 4)
         {
-            values[i] *= a;
+            (lane(i) * float4(a)).store(&values[i]);
         }
         return *this;
     }
@@ -147,9 +146,9 @@ public:
 
     SampledSpectrum& operator /=(const SampledSpectrum& s)
     {
-        for(int i = 0; i < NSpectrumSamples; ++i)
+        for(int i = 0; i < NSpectrumSamples; i += 4)
         {
-            values[i] /= s.values[i];
+            (lane(i) / s.lane(i)).store(&values[i]);
         }
         return *this;
     }
@@ -164,11 +163,7 @@ public:
     SampledSpectrum& operator/=(float a)
     {
         CHECK_NE(a, 0.f);
-        for(int i = 0; i < NSpectrumSamples; ++i)
-        {
-            values[i] /= a;
-        }
-        return *this;
+        return *this *= 1.f / a;
     }
 
     SampledSpectrum operator/(float a) const
@@ -180,12 +175,7 @@ public:
 
     SampledSpectrum operator-() const
     {
-        SampledSpectrum ret = *this;
-        for(int i = 0; i < NSpectrumSamples; ++i)
-        {
-            ret.values[i] = -ret.values[i];
-        }
-        return ret;
+        return 0.f - *this;
     }
 
     bool operator==(const SampledSpectrum& s) const
@@ -261,16 +251,19 @@ public:
 
     float Average() const
     {
-        float sum = 0.f;
-        for(int i = 0; i < NSpectrumSamples; ++i)
+        float4 sum(0.f);
+        for(int i = 0; i < NSpectrumSamples; i += 4)
         {
-            sum += values[i];
+            sum += lane(i);
         }
-        return sum / NSpectrumSamples;
+        return sum.hsum() / NSpectrumSamples;
     }
 
+    // 第 i 个起的 4 个分量
+    float4 lane(int i) const { return float4::load(&values[i]); }
+
 private:
-    std::array<float, NSpectrumSamples> values;
+    alignas(16) std::array<float, NSpectrumSamples> values;
 };
 
 class SampledWavelengths
@@ -292,6 +285,8 @@ public:
 
     float operator[](int i) const { return lambda[i]; }
 
+    const float* data() const { return lambda.data(); }
+
     float& operator[](int i) { return lambda[i]; }
 
     SampledSpectrum PDF() const { return SampledSpectrum(pdf); }
@@ -317,7 +312,7 @@ public:
     }
 
 private:
-    std::array<float, NSpectrumSamples> lambda, pdf;
+    alignas(16) std::array<float, NSpectrumSamples> lambda, pdf;
 };
 
 class ConstantSpectrum
@@ -378,6 +373,18 @@ public:
         return *std::max_element(values.begin(), values.end());
     }
 
+    // 以 1nm 间隔对任意函数采样
+    template<typename F>
+    static DenselySampledSpectrum SampleFunction(F func, int _lambda_min = Lambda_min, int _lambda_max = Lambda_max)
+    {
+        DenselySampledSpectrum s(Spectrum(), _lambda_min, _lambda_max);
+        for(int lambda = _lambda_min; lambda <= _lambda_max; ++lambda)
+        {
+            s.values[lambda - _lambda_min] = func(lambda);
+        }
+        return s;
+    }
+
     std::string ToString() const;
 
 private:
@@ -438,6 +445,16 @@ private:
     float normalizationFactor;
 };
 
+inline SampledSpectrum SampleSigmoid(const RGBSigmoidPolynomial& rsp, const SampledWavelengths& lambda)
+{
+    SampledSpectrum s;
+    for(int i = 0; i < NSpectrumSamples; i += 4)
+    {
+        rsp.Evaluate4(lambda.data() + i, &s[i]);
+    }
+    return s;
+}
+
 class RGBAlbedoSpectrum
 {
 public:
@@ -447,12 +464,7 @@ public:
 
     SampledSpectrum Sample(const SampledWavelengths& lambda) const
     {
-        SampledSpectrum s;
-        for(int i = 0; i < NSpectrumSamples; ++i)
-        {
-            s[i] = rsp(lambda[i]);
-        }
-        return s;
+        return SampleSigmoid(rsp, lambda);
     }
 
     std::string ToString() const;
@@ -471,12 +483,7 @@ public:
 
     SampledSpectrum Sample(const SampledWavelengths& lambda) const 
     {
-        SampledSpectrum s;
-        for(int i = 0; i < NSpectrumSamples; ++i)
-        {
-            s[i] = rsp(lambda[i]) * scale;
-        }
-        return s;
+        return SampleSigmoid(rsp, lambda) * scale;
     }
 
     std::string ToString() const;
@@ -505,12 +512,7 @@ public:
     SampledSpectrum Sample(const SampledWavelengths& lambda) const
     {
         if(!illuminant) return SampledSpectrum(0);
-        SampledSpectrum s;
-        for(int i = 0; i < NSpectrumSamples; ++i)
-        {
-            s[i] = scale * rsp(lambda[i]);
-        }
-        return s * illuminant->Sample(lambda);
+        return SampleSigmoid(rsp, lambda) * scale * illuminant->Sample(lambda);
     }
 
     std::string ToString() const;
@@ -544,9 +546,9 @@ inline SampledSpectrum Clamp(const SampledSpectrum& a, U low, V high)
 inline SampledSpectrum ClampZero(const SampledSpectrum& a)
 {
     SampledSpectrum ret;
-    for(int i = 0; i < NSpectrumSamples; ++i)
+    for(int i = 0; i < NSpectrumSamples; i += 4)
     {
-        ret[i] = std::max<float>(0.f, a[i]);
+        max(a.lane(i), float4(0.f)).store(&ret[i]);
     }
     return ret;
 }
@@ -554,21 +556,16 @@ inline SampledSpectrum ClampZero(const SampledSpectrum& a)
 inline SampledSpectrum Sqrt(const SampledSpectrum& s)
 {
     SampledSpectrum ret;
-    for(int i = 0; i < NSpectrumSamples; ++i)
+    for(int i = 0; i < NSpectrumSamples; i += 4)
     {
-        ret[i] = std::sqrt(s[i]);
+        sqrt(s.lane(i)).store(&ret[i]);
     }
     return ret;
 }
 
 inline SampledSpectrum SafeSqrt(const SampledSpectrum& s)
 {
-    SampledSpectrum ret;
-    for(int i = 0; i < NSpectrumSamples; ++i)
-    {
-        ret[i] = std::sqrt(std::max<float>(0.0f, s[i]));
-    }
-    return ret;
+    return Sqrt(ClampZero(s));
 }
 
 inline SampledSpectrum Pow(const SampledSpectrum& s, float e)
@@ -605,6 +602,9 @@ inline SampledSpectrum Bilerp(std::array<float, 2> p, std::span<const SampledSpe
 
 namespace Spectra
 {
+    // 初始化 CIE 配色函数和具名光谱，使用 X()/Y()/Z() 之前必须调用
+    void Init();
+
     inline const DenselySampledSpectrum& X()
     {
         extern DenselySampledSpectrum* x;
@@ -636,4 +636,6 @@ inline float InnerProduct(Spectrum f, Spectrum g)
 
 XYZ SpectrumToXYZ(Spectrum s);
 
+Spectrum GetNamedSpectrum(std::string name);
+
 #endif
\ No newline at end of file
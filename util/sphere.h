@@ -1,7 +1,9 @@
 #ifndef SPHERE_H
 #define SPHERE_H
 #include "hittable.h"
+#include "material.h"
 #include "rtweekend.h"
+#include "stats.h"
 class sphere : public hittable{
 public:
     sphere(const Point3& center,double radius,shared_ptr<material> mat) 
@@ -24,6 +26,8 @@ public:
         return bbox;
     }
     bool hit(const Ray& r,interval ray_t,hit_record& rec) const override{
+        RTW_STAT_TIMER(Sphere);
+        RTW_STAT_COUNT(SphereTests);
         Point3 center = is_moving? sphere_center(r.time()) : center1;
         vec3 oc=center-r.origin();
         double a=r.direction().length_squared();
@@ -45,8 +49,38 @@ public:
         rec.set_face_normal(r,outwrad_normal);
         rec.mat=mat;
         get_sphere_uv(outwrad_normal,rec.u,rec.v);
+        // u = phi / 2pi 绕 y 轴一圈，v = theta / pi 从南极到北极
+        rec.dpdu = 2 * pi * radius * std::sqrt(std::max(0.0, 1 - outwrad_normal.y() * outwrad_normal.y()));
+        rec.dpdv = pi * radius;
+        rec.curvature = 1.0 / radius;
+        RTW_STAT_COUNT(SphereHits);
         return true;
     }
+    // 按球对 origin 张成的立体角均匀采样。运动的球按 time = 0 时的位置采样；origin 在球内时退化成整个球面均匀采样
+    double pdf_value(const Point3& origin, const vec3& direction) const override{
+        vec3 oc = center1 - origin;
+        double dist_squared = oc.length_squared();
+        double sin2_theta_max = radius * radius / dist_squared;
+        if(sin2_theta_max >= 1) return 1.0 / (4 * pi);
+        // 方向在锥内，即与 oc 的夹角余弦不小于 cos_theta_max
+        double c = dot(direction, oc);
+        if(c <= 0 || c * c < (1 - sin2_theta_max) * direction.length_squared() * dist_squared) return 0.0;
+        return 1.0 / (2 * pi * one_minus_cos_theta_max(sin2_theta_max));
+    }
+    vec3 random(const Point3& origin) const override{
+        vec3 oc = center1 - origin;
+        double dist_squared = oc.length_squared();
+        double sin2_theta_max = radius * radius / dist_squared;
+        if(sin2_theta_max >= 1) return random_unit_vector();
+        ONB uvw(oc);
+        return uvw.transform(random_to_sphere(one_minus_cos_theta_max(sin2_theta_max)));
+    }
+    void collect_lights(const shared_ptr<hittable>& self, std::vector<shared_ptr<hittable>>& lights) const override{
+        if(light_power() > 0) lights.push_back(self);
+    }
+    double light_power() const override{
+        return luminance(mat->average_emitted()) * 4 * pi * radius * radius;
+    }
     static void get_sphere_uv(const Point3& p,double &u , double& v){
         auto theta = std::acos(-p.y());
         auto phi = std::atan2(-p.z(),p.x())+pi;
@@ -54,6 +88,7 @@ public:
         v = theta / pi;
     }
 private:
+    friend class scene_cache;
     bool is_moving;
     vec3 center_vec;
     Point3 center1;
@@ -63,5 +98,17 @@ private:
     Point3 sphere_center(double time) const{
         return center1 + time*center_vec;
     }
+    // 1 - cos = sin^2 / (1 + cos)，远处的小球 sin^2 很小时直接相减会丢掉全部有效位
+    static double one_minus_cos_theta_max(double sin2_theta_max){
+        return sin2_theta_max / (1 + std::sqrt(1 - sin2_theta_max));
+    }
+    // 以 z 轴为中心、半角为 theta_max 的锥内均匀采样
+    static vec3 random_to_sphere(double one_minus_cos_max){
+        auto [r1, r2] = random_double2();
+        double z = 1 - r2 * one_minus_cos_max;
+        double phi = 2 * pi * r1;
+        double sin_theta = std::sqrt(std::max(0.0, 1 - z * z));
+        return vec3(std::cos(phi) * sin_theta, std::sin(phi) * sin_theta, z);
+    }
 };
 #endif
\ No newline at end of file
@@ -0,0 +1,210 @@
+#ifndef STATS_H
+#define STATS_H
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <iomanip>
+#include <mutex>
+#include <ostream>
+#include <vector>
+
+// 热路径上的计数器和计时器。默认编译掉，定义 RTW_STATS 后才生效：
+//   RTW_STAT_COUNT(SphereTests);   计数器 +1
+//   RTW_STAT_TIMER(Sphere);        作用域计时，同一阶段递归嵌套时只记录最外层
+// 每个线程写自己的 thread_local 数据，camera::render 结束时统一合并。
+// 读时钟比一次求交还贵，所以计时器只对每 TimerSampleRate 次调用取一次样，总时间按调用次数外推。
+namespace stats
+{
+enum Counter
+{
+    BVHNodeVisits,
+    SphereTests,
+    SphereHits,
+    QuadTests,
+    QuadHits,
+    MaterialScatters,
+    LightPdfSamples,
+    LightPdfEvals,
+    TextureLookups,
+    CounterCount
+};
+
+enum Phase
+{
+    BVH,
+    Sphere,
+    Quad,
+    Scatter,
+    LightPdf,
+    Texture,
+    PhaseCount
+};
+
+inline const char* CounterName(int c)
+{
+    static const char* names[CounterCount] = {
+        "bvh node visits", "sphere tests", "sphere hits", "quad tests", "quad hits",
+        "material scatters", "light pdf samples", "light pdf evals", "texture lookups"
+    };
+    return names[c];
+}
+
+inline const char* PhaseName(int p)
+{
+    static const char* names[PhaseCount] = {
+        "bvh_node::hit", "sphere::hit", "quad::hit", "material::scatter", "hittable_pdf", "texture::value"
+    };
+    return names[p];
+}
+
+constexpr uint64_t TimerSampleRate = 64;
+
+struct Totals
+{
+    uint64_t counters[CounterCount] = {};
+    uint64_t phaseCalls[PhaseCount] = {};
+    uint64_t phaseSamples[PhaseCount] = {};
+    uint64_t phaseSampledNs[PhaseCount] = {};
+
+    Totals& operator+=(const Totals& t)
+    {
+        for(int i = 0; i < CounterCount; i++) counters[i] += t.counters[i];
+        for(int i = 0; i < PhaseCount; i++)
+        {
+            phaseCalls[i] += t.phaseCalls[i];
+            phaseSamples[i] += t.phaseSamples[i];
+            phaseSampledNs[i] += t.phaseSampledNs[i];
+        }
+        return *this;
+    }
+    // 按取样的平均耗时外推出的总时间
+    double PhaseMs(int p) const
+    {
+        return phaseSamples[p] ? 1e-6 * phaseSampledNs[p] / phaseSamples[p] * phaseCalls[p] : 0.0;
+    }
+};
+
+class Registry;
+
+// 每个线程一份，第一次使用时登记到 Registry，线程退出时把剩余的数据并入 Registry
+struct ThreadStats
+{
+    Totals totals;
+    int depth[PhaseCount] = {};
+
+    ThreadStats();
+    ~ThreadStats();
+};
+
+class Registry
+{
+public:
+    static Registry& Get()
+    {
+        static Registry registry;
+        return registry;
+    }
+    void Add(ThreadStats* t)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        threads.push_back(t);
+    }
+    void Remove(ThreadStats* t)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        retired += t->totals;
+        std::erase(threads, t);
+    }
+    // 只在没有渲染任务执行时调用，此时各线程不会再写自己的数据
+    Totals Merge() const
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        Totals sum = retired;
+        for(const ThreadStats* t : threads) sum += t->totals;
+        return sum;
+    }
+    void Reset()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        retired = Totals();
+        for(ThreadStats* t : threads) t->totals = Totals();
+    }
+private:
+    mutable std::mutex mutex;
+    std::vector<ThreadStats*> threads;
+    Totals retired;
+};
+
+inline ThreadStats::ThreadStats() { Registry::Get().Add(this); }
+inline ThreadStats::~ThreadStats() { Registry::Get().Remove(this); }
+
+inline ThreadStats& Local()
+{
+    static thread_local ThreadStats local;
+    return local;
+}
+
+class ScopedTimer
+{
+public:
+    explicit ScopedTimer(Phase phase) : phase(phase), stats(Local())
+    {
+        if(stats.depth[phase]++ == 0)
+        {
+            sampled = stats.totals.phaseCalls[phase]++ % TimerSampleRate == 0;
+            if(sampled) start = std::chrono::steady_clock::now();
+        }
+    }
+    ~ScopedTimer()
+    {
+        if(--stats.depth[phase] == 0 && sampled)
+        {
+            auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start);
+            stats.totals.phaseSampledNs[phase] += ns.count();
+            stats.totals.phaseSamples[phase]++;
+        }
+    }
+    ScopedTimer(const ScopedTimer&) = delete;
+    ScopedTimer& operator=(const ScopedTimer&) = delete;
+private:
+    Phase phase;
+    ThreadStats& stats;
+    bool sampled = false;
+    std::chrono::steady_clock::time_point start;
+};
+
+// 阶段之间互相嵌套（bvh 里包含求交，scatter 里包含纹理查询），所以各阶段时间是包含关系，不能相加。
+// 时间是所有线程的 CPU 时间之和。
+inline void Report(std::ostream& out, const Totals& t)
+{
+    out << "statistics:\n";
+    for(int i = 0; i < CounterCount; i++)
+    {
+        out << "  " << std::left << std::setw(20) << CounterName(i) << std::right << std::setw(14) << t.counters[i] << "\n";
+    }
+    uint64_t tests = t.counters[SphereTests] + t.counters[QuadTests];
+    uint64_t hits = t.counters[SphereHits] + t.counters[QuadHits];
+    if(tests > 0) out << "  primitive hit rate  " << std::setw(13) << std::fixed << std::setprecision(2)
+                      << 100.0 * hits / tests << "%\n" << std::defaultfloat;
+    out << "phase times (inclusive, summed over threads, 1/" << TimerSampleRate << " calls timed):\n";
+    for(int i = 0; i < PhaseCount; i++)
+    {
+        if(t.phaseCalls[i] == 0) continue;
+        double ms = t.PhaseMs(i);
+        out << "  " << std::left << std::setw(20) << PhaseName(i) << std::right << std::fixed << std::setprecision(1)
+            << std::setw(12) << ms << "ms" << std::setw(14) << t.phaseCalls[i] << " calls"
+            << std::setw(10) << ms * 1e6 / t.phaseCalls[i] << "ns/call\n" << std::defaultfloat;
+    }
+}
+}
+
+#ifdef RTW_STATS
+#define RTW_STAT_COUNT(c) (++stats::Local().totals.counters[stats::c])
+#define RTW_STAT_TIMER_CONCAT(a, b) a##b
+#define RTW_STAT_TIMER_NAME(line) RTW_STAT_TIMER_CONCAT(rtwStatTimer, line)
+#define RTW_STAT_TIMER(p) stats::ScopedTimer RTW_STAT_TIMER_NAME(__LINE__)(stats::p)
+#else
+#define RTW_STAT_COUNT(c) ((void)0)
+#define RTW_STAT_TIMER(p) ((void)0)
+#endif
+#endif
@@ -128,7 +128,7 @@ public:
 
     void* ptr() { return reinterpret_cast<void*>(bits & ptrMask); }
 
-    const void* ptr() const { return reinterpret_cast<const void*>(bits * ptrMask); }
+    const void* ptr() const { return reinterpret_cast<const void*>(bits & ptrMask); }
 
     unsigned int Tag() const { return ((bits & tagMask) >> tagShift); }
 
@@ -1,12 +1,16 @@
 #ifndef TEXTURE_H
 #define TEXTURE_H
 #include "rtweekend.h"
-#include "rtw_image.h"
+#include "texture_cache.h"
 #include "perlin.h"
 class texture{
 public:
     virtual ~texture() = default;
     virtual color value(double u,double v,const Point3& p) const = 0;
+    // 带足迹的查询，纹理可以据此选择 MIP 层级或减少计算量；默认忽略足迹
+    virtual color filtered_value(double u, double v, const Point3& p, const texture_footprint& fp) const{
+        return value(u, v, p);
+    }
 };
 class solid_color : public texture{
 public:
@@ -16,6 +20,7 @@ public:
         return albedo;
     }
 private:
+    friend class scene_cache;
     color albedo;    
 };
 class check_texture : public texture{
@@ -23,43 +28,68 @@ public:
     check_texture(double scale,shared_ptr<texture> even,shared_ptr<texture> odd) : inv_scale(1.0 / scale),even(even),odd(odd) {}
     check_texture(double scale , const color& c1, const color& c2) :check_texture(scale,make_shared<solid_color>(c1),make_shared<solid_color>(c2)) {}
     color value(double u,double v,const Point3& p) const override{
+        return is_even(p) ? even->value(u,v,p) :odd ->value(u,v,p);
+    }
+    color filtered_value(double u, double v, const Point3& p, const texture_footprint& fp) const override{
+        return is_even(p) ? even->filtered_value(u, v, p, fp) : odd->filtered_value(u, v, p, fp);
+    }
+private:
+    friend class scene_cache;
+    bool is_even(const Point3& p) const{
         auto xInterger = int(std::floor(inv_scale*p.x()));
         auto yInterger = int(std::floor(inv_scale*p.y()));
         auto zInterger = int(std::floor(inv_scale*p.z()));
-        bool isEven = (xInterger+yInterger+zInterger) % 2 == 0;
-        return isEven ? even->value(u,v,p) :odd ->value(u,v,p);
+        return (xInterger+yInterger+zInterger) % 2 == 0;
     }
-private:
     double inv_scale;
     shared_ptr<texture> even;
     shared_ptr<texture> odd;
 };
 class image_texture : public texture{
 public:
-    image_texture(const char* image_filename) : image(image_filename){}
+    image_texture(const char* image_filename, mip_filter filter = mip_filter::trilinear)
+     : filename(image_filename), image(texture_cache::get(image_filename)), filter(filter){}
     color value(double u,double v,const Point3& p) const override{
         // If we have no texture data, then return solid cyan as a debugging aid.
-        if(image.height() <= 0) return color(0,1,1);
+        if(image->empty()) return color(0,1,1);
         // Clamp input texture coordinates to [0,1] x [1,0]
         u = interval(0,1).clamp(u);
         v = 1.0-interval(0,1).clamp(v);
-        int i = int(u*image.width());
-        int j = int(v*image.height());
-        auto pixel = image.pixel_data(i,j);
-        double color_scale = 1.0 / 255.0;
-        return color(color_scale*pixel[0],color_scale*pixel[1],color_scale*pixel[2]);
+        return image->filter(filter, u, v, 0, 0, 0, 0);
+    }
+    color filtered_value(double u, double v, const Point3& p, const texture_footprint& fp) const override{
+        if(image->empty()) return color(0,1,1);
+        u = interval(0,1).clamp(u);
+        v = 1.0-interval(0,1).clamp(v);
+        return image->filter(filter, u, v, fp.du, 0, 0, fp.dv);
     }
 private:
-    rtw_image image;
+    friend class scene_cache;
+    std::string filename;
+    shared_ptr<const mipmap> image;
+    mip_filter filter;
 };
 class noise_texture : public texture{
 public:
     noise_texture(double scale) : scale(scale){}
+    // 在 [min,max] 内预先烘焙 turb，包围盒外仍然直接计算
+    noise_texture(double scale, const Point3& min, const Point3& max, int resolution)
+     : scale(scale), volume(make_shared<perlin_volume>(noise, min, max, resolution, 7)){}
     color value(double u,double v,const Point3& p) const override{
-        return color(.5, .5, .5) * (1 + std::sin(scale * p.z() + 10 * noise.turb(p, 7)));
+        double t = (volume && volume->contains(p)) ? volume->lookup(p) : noise.turb(p, 7);
+        return color(.5, .5, .5) * (1 + std::sin(scale * p.z() + 10 * t));
+    }
+    // 第 i 个八度的特征尺寸约为 2^-i，小于足迹的八度会被平均掉，不必再算
+    color filtered_value(double u, double v, const Point3& p, const texture_footprint& fp) const override{
+        if(fp.width <= 0 || (volume && volume->contains(p))) return value(u, v, p);
+        int depth = std::clamp(int(std::ceil(-std::log2(fp.width))) + 1, 1, 7);
+        double t = noise.turb(p, depth);
+        return color(.5, .5, .5) * (1 + std::sin(scale * p.z() + 10 * t));
     }
 private:
+    friend class scene_cache;
     perlin noise;
     double scale;
+    shared_ptr<perlin_volume> volume;
 };
 #endif
\ No newline at end of file
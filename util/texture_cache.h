@@ -0,0 +1,90 @@
+#ifndef TEXTURE_CACHE_H
+#define TEXTURE_CACHE_H
+#include "rtweekend.h"
+#include "mipmap.h"
+#include "parallel.h"
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+// 进程内共享的纹理缓存：同一个文件只加载一次，多个 image_texture 共用同一个 mipmap。
+// 解码在线程池上异步进行，prefetch 之后可以接着构建场景，第一次 get 时才等它解码完。
+class texture_cache{
+public:
+    using load_job = AsyncJob<shared_ptr<const mipmap>>;
+
+    // 开始在后台加载，已经在加载或已加载时什么也不做
+    static shared_ptr<load_job> prefetch(const std::string& filename){
+        std::lock_guard<std::mutex> lock(mutex());
+        auto& entries = cache();
+        auto it = entries.find(filename);
+        if(it != entries.end()) return it->second;
+        auto job = RunAsync([filename]{
+            // 目录搜索只在第一次请求时做一次
+            std::string path = rtw_image::find_image_file(filename.c_str());
+            if(path.empty()){
+                std::cerr<<"ERROR: Could not load image file'"<<filename<<"'.\n";
+                return make_shared<const mipmap>();
+            }
+            return mipmap::load(path);
+        });
+        entries.emplace(filename, job);
+        return job;
+    }
+
+    static shared_ptr<const mipmap> get(const std::string& filename){
+        // 等待时不持有缓存的锁，其它纹理可以同时请求
+        return prefetch(filename)->GetResult();
+    }
+
+    static size_t memory_usage(){
+        size_t bytes = 0;
+        for(const auto& mip : loaded()) bytes += mip->memory_usage();
+        return bytes;
+    }
+
+    static size_t mapped_bytes(){
+        size_t bytes = 0;
+        for(const auto& mip : loaded()) bytes += mip->mapped_bytes();
+        return bytes;
+    }
+
+    static size_t size(){
+        std::lock_guard<std::mutex> lock(mutex());
+        return cache().size();
+    }
+
+    // 等所有加载任务做完。任务记着提交它的线程池，重建或销毁线程池（ParallelInit/ParallelCleanup）之前必须调用，
+    // 否则之后 get/report 等待时会访问已经删掉的线程池
+    static void wait_all(){
+        loaded();
+    }
+
+    static void report(std::ostream& out){
+        size_t count = size();
+        if(count == 0) return;
+        out << "texture memory: " << memory_usage() / 1024 << " KB resident ("
+            << mapped_bytes() / 1024 << " KB mapped) in " << count << " textures\n";
+    }
+private:
+    static std::unordered_map<std::string, shared_ptr<load_job>>& cache(){
+        static std::unordered_map<std::string, shared_ptr<load_job>> entries;
+        return entries;
+    }
+    static std::mutex& mutex(){
+        static std::mutex m;
+        return m;
+    }
+    // 所有纹理（等还在解码的做完）
+    static std::vector<shared_ptr<const mipmap>> loaded(){
+        std::vector<shared_ptr<load_job>> jobs;
+        {
+            std::lock_guard<std::mutex> lock(mutex());
+            for(const auto& [name, job] : cache()) jobs.push_back(job);
+        }
+        std::vector<shared_ptr<const mipmap>> mips;
+        for(const auto& job : jobs) mips.push_back(job->GetResult());
+        return mips;
+    }
+};
+#endif
@@ -89,8 +89,13 @@ inline vec3 random_in_unit_sphere(){
         }
     }
 }
+// 球面上均匀分布，每次固定用两维随机数
 inline vec3 random_unit_vector(){
-    return unit_vector(random_in_unit_sphere());
+    auto [u1, u2] = random_double2();
+    double z = 1 - 2 * u1;
+    double r = std::sqrt(std::max(0.0, 1 - z * z));
+    double phi = 2 * pi * u2;
+    return vec3(r * std::cos(phi), r * std::sin(phi), z);
 }
 inline vec3 random_on_hemisphere(const vec3& normal){
     vec3 on_unit_sphere = random_unit_vector();
@@ -113,20 +118,26 @@ inline vec3 refract(const vec3& uv,const vec3& n,double etai_over_etat){
     vec3 r_out_parallel = -std::sqrt(std::fabs(1.0-r_out_perp.length_squared())) * n;
     return unit_vector(r_out_parallel + r_out_perp);
 }
+// 同心圆映射（Shirley-Chiu），正方形上分层的样本映射到圆盘上仍然分层
 inline vec3 random_in_unit_disk(){
-    while(true){
-        vec3 p = vec3(random_double(-1,1),random_double(-1,1),0.0);
-        if(p.length() < 1.0){
-            return p;
-        }
+    auto [u1, u2] = random_double2();
+    double a = 2 * u1 - 1, b = 2 * u2 - 1;
+    if(a == 0 && b == 0) return vec3(0, 0, 0);
+    double r, theta;
+    if(std::fabs(a) > std::fabs(b)){
+        r = a;
+        theta = pi / 4 * (b / a);
+    }
+    else{
+        r = b;
+        theta = pi / 2 - pi / 4 * (a / b);
     }
+    return vec3(r * std::cos(theta), r * std::sin(theta), 0.0);
 }
 
 inline vec3 random_cosine_direction()
 {
-    vec3 ret;
-    double r1 = random_double();
-    double r2 = random_double();
+    auto [r1, r2] = random_double2();
     double z = std::sqrt(1.0 - r2);
     double phi = 2 * pi * r1;
     double x = std::cos(phi) * std::sqrt(r2);
@@ -331,7 +331,7 @@ template<typename Ta, typename Tb, typename Tc, typename Td>
 inline auto DifferenceOfProducts(Ta a, Tb b, Tc c, Td d)
 {
     auto cd = c * d;
-    auto differenceOfProducts = FMA(a, b, cd);
+    auto differenceOfProducts = FMA(a, b, -cd);
     auto error = FMA(-c, d, cd);
     return differenceOfProducts + error;
 }